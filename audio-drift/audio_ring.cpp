@@ -0,0 +1,73 @@
+#include "audio_ring.hpp"
+#include <algorithm>
+#include <string.h>
+
+namespace PyroFling
+{
+void AudioRing::init(size_t capacity_frames, unsigned channels_)
+{
+	capacity = 1;
+	while (capacity < capacity_frames)
+		capacity <<= 1;
+
+	channels = channels_;
+	buffer.clear();
+	buffer.resize(capacity * channels);
+	write_count.store(0, std::memory_order_relaxed);
+	read_count.store(0, std::memory_order_relaxed);
+}
+
+size_t AudioRing::write(const float *data, size_t frames)
+{
+	size_t w = write_count.load(std::memory_order_relaxed);
+	size_t r = read_count.load(std::memory_order_acquire);
+	frames = std::min(frames, capacity - (w - r));
+
+	size_t offset = w & (capacity - 1);
+	size_t first = std::min(frames, capacity - offset);
+	memcpy(buffer.data() + offset * channels, data, first * channels * sizeof(float));
+	memcpy(buffer.data(), data + first * channels, (frames - first) * channels * sizeof(float));
+
+	write_count.store(w + frames, std::memory_order_release);
+	return frames;
+}
+
+size_t AudioRing::read(float *data, size_t frames)
+{
+	size_t r = read_count.load(std::memory_order_relaxed);
+	size_t w = write_count.load(std::memory_order_acquire);
+	frames = std::min(frames, w - r);
+
+	size_t offset = r & (capacity - 1);
+	size_t first = std::min(frames, capacity - offset);
+	memcpy(data, buffer.data() + offset * channels, first * channels * sizeof(float));
+	memcpy(data + first * channels, buffer.data(), (frames - first) * channels * sizeof(float));
+
+	read_count.store(r + frames, std::memory_order_release);
+	return frames;
+}
+
+size_t AudioRing::discard(size_t frames)
+{
+	size_t r = read_count.load(std::memory_order_relaxed);
+	size_t w = write_count.load(std::memory_order_acquire);
+	frames = std::min(frames, w - r);
+	read_count.store(r + frames, std::memory_order_release);
+	return frames;
+}
+
+size_t AudioRing::get_read_avail() const
+{
+	return write_count.load(std::memory_order_acquire) - read_count.load(std::memory_order_relaxed);
+}
+
+size_t AudioRing::get_capacity() const
+{
+	return capacity;
+}
+
+unsigned AudioRing::get_num_channels() const
+{
+	return channels;
+}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+
+namespace PyroFling
+{
+// Single producer, single consumer ring of interleaved float frames.
+// Neither side ever blocks or takes a lock, so the capture thread cannot be held up by the encoder.
+class AudioRing
+{
+public:
+	// Capacity is rounded up to a power of two.
+	void init(size_t capacity_frames, unsigned channels);
+
+	// Producer side. Frames which do not fit are dropped. Returns number of frames written.
+	size_t write(const float *data, size_t frames);
+
+	// Consumer side.
+	size_t read(float *data, size_t frames);
+	size_t discard(size_t frames);
+	size_t get_read_avail() const;
+
+	size_t get_capacity() const;
+	unsigned get_num_channels() const;
+
+private:
+	std::vector<float> buffer;
+	size_t capacity = 0;
+	unsigned channels = 0;
+	// Free running frame counters. Only the owning side stores to its counter.
+	std::atomic<size_t> write_count{0};
+	std::atomic<size_t> read_count{0};
+};
+}
@@ -0,0 +1,182 @@
+#include "drift_compensator.hpp"
+#include <algorithm>
+#include <string.h>
+
+namespace PyroFling
+{
+bool AudioDriftCompensator::init(unsigned sample_rate_, unsigned channels_, const Options &options_)
+{
+	if (!sample_rate_ || !channels_ || options_.ring_size_ms <= options_.target_latency_ms)
+		return false;
+
+	options = options_;
+	sample_rate = sample_rate_;
+	channels = channels_;
+	min_target_frames = double(options.target_latency_ms) * sample_rate * 1e-3;
+	target_frames = min_target_frames;
+	max_read_frames = 0;
+	max_write_frames.store(0, std::memory_order_relaxed);
+
+	ring.init(size_t(uint64_t(options.ring_size_ms) * sample_rate / 1000), channels);
+	resampler.init(channels);
+
+	started = false;
+	priming = true;
+	output_frames = 0;
+	filtered_backlog = 0.0;
+	integral = 0.0;
+	return true;
+}
+
+size_t AudioDriftCompensator::write(const float *data, size_t frames, int64_t now_ns)
+{
+	if (frames > max_write_frames.load(std::memory_order_relaxed))
+		max_write_frames.store(frames, std::memory_order_relaxed);
+	last_write_ns.store(now_ns, std::memory_order_relaxed);
+	size_t written = ring.write(data, frames);
+	if (written < frames)
+		overrun_frames.fetch_add(frames - written, std::memory_order_relaxed);
+	return written;
+}
+
+double AudioDriftCompensator::get_backlog_frames() const
+{
+	return double(ring.get_read_avail()) + resampler.get_buffered_input_frames();
+}
+
+// Capture delivers in blocks, so the raw backlog is a sawtooth.
+// Frames captured since the last block are already in flight, so counting them smooths out the sawtooth.
+double AudioDriftCompensator::get_smooth_backlog_frames(int64_t now_ns) const
+{
+	// A stalled capture only has up to one block in flight.
+	double in_flight = double(now_ns - last_write_ns.load(std::memory_order_relaxed)) * 1e-9 * sample_rate;
+	in_flight = std::max(0.0, std::min(in_flight, double(max_write_frames.load(std::memory_order_relaxed))));
+	return get_backlog_frames() + in_flight;
+}
+
+// Right before a read, the ring may be short of a full capture block, and the read itself needs
+// enough frames for the resampler to look ahead. A quarter on top covers scheduling jitter.
+void AudioDriftCompensator::update_target()
+{
+	double needed = double(max_write_frames.load(std::memory_order_relaxed) + max_read_frames +
+	                       DriftResampler::HalfTaps) * 1.25;
+	target_frames = std::max(min_target_frames, needed);
+	target_us.store(uint32_t(target_frames * 1e6 / sample_rate), std::memory_order_relaxed);
+}
+
+size_t AudioDriftCompensator::update(int64_t now_ns)
+{
+	update_target();
+
+	if (!started)
+	{
+		started = true;
+		start_ns = now_ns;
+		last_ns = now_ns;
+		filtered_backlog = target_frames;
+	}
+
+	double dt = double(now_ns - last_ns) * 1e-9;
+	last_ns = now_ns;
+	double backlog = get_smooth_backlog_frames(now_ns);
+
+	if (priming)
+	{
+		if (backlog < target_frames)
+		{
+			latency_us.store(uint32_t(backlog * 1e6 / sample_rate), std::memory_order_relaxed);
+			return size_t(std::max<int64_t>(0, int64_t(double(now_ns - start_ns) * 1e-9 * sample_rate) -
+			                                   int64_t(output_frames)));
+		}
+
+		// Priming only checks once per update, so the backlog overshoots by up to one update interval.
+		// Nothing has been played yet, so trim the excess rather than letting it wind up the integrator.
+		priming = false;
+		if (backlog > target_frames)
+		{
+			discarded_frames.fetch_add(ring.discard(size_t(backlog - target_frames)), std::memory_order_relaxed);
+			backlog = get_smooth_backlog_frames(now_ns);
+		}
+		filtered_backlog = backlog;
+	}
+
+	// If the encoder stalled, catching up by resampling would take forever. Drop the excess instead.
+	if (backlog > 4.0 * target_frames)
+	{
+		size_t excess = size_t(backlog - target_frames);
+		discarded_frames.fetch_add(ring.discard(excess), std::memory_order_relaxed);
+		backlog = get_smooth_backlog_frames(now_ns);
+		filtered_backlog = backlog;
+	}
+
+	if (dt > 0.0)
+	{
+		double alpha = dt / (options.backlog_filter_seconds + dt);
+		filtered_backlog += alpha * (backlog - filtered_backlog);
+
+		double error = (filtered_backlog - target_frames) / double(sample_rate);
+		integral += options.ki * error * dt;
+		integral = std::max(-options.max_ratio_deviation, std::min(options.max_ratio_deviation, integral));
+
+		double deviation = options.kp * error + integral;
+		deviation = std::max(-options.max_ratio_deviation, std::min(options.max_ratio_deviation, deviation));
+		resampler.set_ratio(1.0 + deviation);
+
+		// The integrator settles on the actual clock ratio.
+		drift_ppb.store(int32_t(integral * 1e9), std::memory_order_relaxed);
+		ratio_ppb.store(int32_t(deviation * 1e9), std::memory_order_relaxed);
+	}
+
+	latency_us.store(uint32_t(filtered_backlog * 1e6 / sample_rate), std::memory_order_relaxed);
+
+	int64_t owed = int64_t(double(now_ns - start_ns) * 1e-9 * sample_rate) - int64_t(output_frames);
+	return size_t(std::max<int64_t>(0, owed));
+}
+
+size_t AudioDriftCompensator::read(float *data, size_t frames)
+{
+	size_t produced = 0;
+	max_read_frames = std::max(max_read_frames, frames);
+
+	if (!priming)
+	{
+		size_t needed = std::min(resampler.get_required_input_frames(frames), ring.get_read_avail());
+		if (needed)
+		{
+			scratch.resize(needed * channels);
+			size_t num_read = ring.read(scratch.data(), needed);
+			resampler.push_input(scratch.data(), num_read);
+		}
+
+		produced = resampler.produce(data, frames);
+
+		if (produced < frames)
+		{
+			underrun_frames.fetch_add(frames - produced, std::memory_order_relaxed);
+			priming = true;
+		}
+	}
+
+	memset(data + produced * channels, 0, (frames - produced) * channels * sizeof(float));
+	output_frames += frames;
+	return frames;
+}
+
+uint32_t AudioDriftCompensator::get_latency_us() const
+{
+	return latency_us.load(std::memory_order_relaxed);
+}
+
+AudioDriftCompensator::Stats AudioDriftCompensator::get_stats() const
+{
+	Stats stats = {};
+	stats.drift_ppm = double(drift_ppb.load(std::memory_order_relaxed)) * 1e-3;
+	stats.ratio_ppm = double(ratio_ppb.load(std::memory_order_relaxed)) * 1e-3;
+	stats.backlog_ms = double(latency_us.load(std::memory_order_relaxed)) * 1e-3;
+	stats.target_ms = double(target_us.load(std::memory_order_relaxed)) * 1e-3;
+	stats.overrun_frames = overrun_frames.load(std::memory_order_relaxed);
+	stats.underrun_frames = underrun_frames.load(std::memory_order_relaxed);
+	stats.discarded_frames = discarded_frames.load(std::memory_order_relaxed);
+	return stats;
+}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "audio_ring.hpp"
+#include "drift_resampler.hpp"
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace PyroFling
+{
+// Sits between an audio capture thread running on the device clock and an encoder running on the
+// reference clock, i.e. the clock which drives the heartbeat and video PTS.
+// The encoder is handed exactly sample_rate frames per second of reference time.
+// Any drift of the device clock shows up as a growing or shrinking backlog, which a PI controller
+// turns into a resampling ratio, so the backlog stays at the target latency.
+// Sample rate and channel layout pass through unchanged.
+class AudioDriftCompensator
+{
+public:
+	struct Options
+	{
+		// Buffered between capture and encode. It is raised automatically if capture blocks and
+		// encoder reads are too large for it, since that would lead to underruns.
+		unsigned target_latency_ms = 40;
+		// Capacity of the capture ring.
+		unsigned ring_size_ms = 500;
+		// Gains for the backlog error in seconds. The output is the relative ratio deviation.
+		double kp = 0.1;
+		double ki = 0.005;
+		// Time constant of the backlog filter, which hides capture block granularity.
+		double backlog_filter_seconds = 0.5;
+		// Anything beyond this is not drift, but e.g. a stalled capture device.
+		double max_ratio_deviation = 0.005;
+	};
+
+	struct Stats
+	{
+		// Positive when the device clock runs fast relative to the reference clock.
+		double drift_ppm;
+		// Resampling ratio currently applied, including the correction of any backlog error.
+		double ratio_ppm;
+		double backlog_ms;
+		double target_ms;
+		uint64_t overrun_frames;
+		uint64_t underrun_frames;
+		uint64_t discarded_frames;
+	};
+
+	bool init(unsigned sample_rate, unsigned channels, const Options &options);
+
+	// Capture thread. now_ns is when the frames were captured, on the reference clock.
+	size_t write(const float *data, size_t frames, int64_t now_ns);
+
+	// Encoder thread. Returns how many frames are owed to the encoder at now_ns on the reference clock.
+	size_t update(int64_t now_ns);
+	// Always produces the requested number of frames. Missing input is replaced with silence.
+	size_t read(float *data, size_t frames);
+	uint32_t get_latency_us() const;
+	// Any thread.
+	Stats get_stats() const;
+
+private:
+	Options options;
+	AudioRing ring;
+	DriftResampler resampler;
+	std::vector<float> scratch;
+	unsigned sample_rate = 0;
+	unsigned channels = 0;
+	double min_target_frames = 0.0;
+	double target_frames = 0.0;
+	size_t max_read_frames = 0;
+	std::atomic<size_t> max_write_frames{0};
+
+	// Encoder thread only.
+	bool started = false;
+	// Outputs silence until the backlog reaches the target, after start and after an underrun.
+	bool priming = true;
+	int64_t start_ns = 0;
+	int64_t last_ns = 0;
+	uint64_t output_frames = 0;
+	double filtered_backlog = 0.0;
+	double integral = 0.0;
+
+	std::atomic<uint64_t> overrun_frames{0};
+	std::atomic<uint64_t> underrun_frames{0};
+	std::atomic<uint64_t> discarded_frames{0};
+	std::atomic<int64_t> last_write_ns{0};
+	std::atomic<uint32_t> latency_us{0};
+	std::atomic<uint32_t> target_us{0};
+	std::atomic<int32_t> drift_ppb{0};
+	std::atomic<int32_t> ratio_ppb{0};
+
+	double get_backlog_frames() const;
+	double get_smooth_backlog_frames(int64_t now_ns) const;
+	void update_target();
+};
+}
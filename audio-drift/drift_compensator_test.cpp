@@ -0,0 +1,248 @@
+#include "drift_compensator.hpp"
+#include "drift_resampler.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <random>
+#include <vector>
+
+using namespace PyroFling;
+
+static const double Pi = 3.14159265358979323846;
+
+// Capture runs on a device clock which is off by drift_ppm relative to the reference clock,
+// and delivers audio in fixed blocks of device time with some scheduling jitter.
+// The encoder pulls audio on a 60 Hz heartbeat of the reference clock.
+// Every channel carries a sine of its own frequency, so mixed up channels are caught as noise.
+struct Scenario
+{
+	const char *name;
+	unsigned sample_rate;
+	unsigned channels;
+	double drift_ppm;
+	unsigned block_frames;
+	double seconds;
+	// Capture stops delivering for a while at the halfway point.
+	double stall_seconds;
+};
+
+struct SimulationResult
+{
+	double estimated_drift_ppm;
+	double max_backlog_error_ms;
+	// Largest deviation of the applied ratio from the true drift. Shows up as pitch wobble.
+	double max_ratio_wander_ppm;
+	uint64_t underrun_frames;
+	uint64_t overrun_frames;
+	int64_t output_frame_error;
+};
+
+static double channel_frequency(unsigned channel)
+{
+	return 441.0 + 997.0 * channel;
+}
+
+// Least squares fit of a sine with known frequency, returning signal to residual ratio.
+static double measure_snr_db(const std::vector<float> &output, unsigned channels, unsigned channel,
+                             size_t first_frame, size_t num_frames, double omega)
+{
+	double ss = 0.0, sc = 0.0, cc = 0.0, ys = 0.0, yc = 0.0;
+	for (size_t i = first_frame; i < first_frame + num_frames; i++)
+	{
+		double s = sin(omega * double(i));
+		double c = cos(omega * double(i));
+		double y = output[i * channels + channel];
+		ss += s * s;
+		sc += s * c;
+		cc += c * c;
+		ys += y * s;
+		yc += y * c;
+	}
+
+	double det = ss * cc - sc * sc;
+	double a = (ys * cc - yc * sc) / det;
+	double b = (yc * ss - ys * sc) / det;
+
+	double signal = 0.0, noise = 0.0;
+	for (size_t i = first_frame; i < first_frame + num_frames; i++)
+	{
+		double fit = a * sin(omega * double(i)) + b * cos(omega * double(i));
+		double err = output[i * channels + channel] - fit;
+		signal += fit * fit;
+		noise += err * err;
+	}
+
+	return 10.0 * log10(signal / std::max(noise, 1e-30));
+}
+
+static SimulationResult run_simulation(const Scenario &scenario, uint64_t seed)
+{
+	AudioDriftCompensator compensator;
+	AudioDriftCompensator::Options options;
+	compensator.init(scenario.sample_rate, scenario.channels, options);
+
+	std::mt19937 rnd(seed);
+	std::uniform_real_distribution<double> capture_jitter(0.0, 2e-3);
+	std::uniform_real_distribution<double> heartbeat_jitter(0.0, 1e-3);
+
+	const double device_rate = double(scenario.sample_rate) * (1.0 + scenario.drift_ppm * 1e-6);
+	const double heartbeat = 1.0 / 60.0;
+	const double stall_begin = scenario.seconds * 0.5;
+	const double stall_end = stall_begin + scenario.stall_seconds;
+
+	std::vector<float> block(scenario.block_frames * scenario.channels);
+	std::vector<float> output;
+	uint64_t captured_frames = 0;
+	double next_block_time = double(scenario.block_frames) / device_rate;
+
+	SimulationResult result = {};
+	double first_now = 0.0;
+	double last_now = 0.0;
+
+	auto num_ticks = unsigned(scenario.seconds / heartbeat);
+	for (unsigned tick = 1; tick <= num_ticks; tick++)
+	{
+		double now = tick * heartbeat + heartbeat_jitter(rnd);
+
+		// Deliver every block which has completed on the device clock by now.
+		double delivery_time;
+		while ((delivery_time = next_block_time + capture_jitter(rnd)) <= now)
+		{
+			for (unsigned i = 0; i < scenario.block_frames; i++)
+			{
+				for (unsigned c = 0; c < scenario.channels; c++)
+				{
+					double phase = 2.0 * Pi * channel_frequency(c) * double(captured_frames + i) / scenario.sample_rate;
+					block[i * scenario.channels + c] = float(0.5 * sin(phase));
+				}
+			}
+
+			bool stalled = next_block_time >= stall_begin && next_block_time < stall_end;
+			if (!stalled)
+				compensator.write(block.data(), scenario.block_frames, int64_t(delivery_time * 1e9));
+			captured_frames += scenario.block_frames;
+			next_block_time += double(scenario.block_frames) / device_rate;
+		}
+
+		if (tick == 1)
+			first_now = now;
+		last_now = now;
+
+		size_t frames = compensator.update(int64_t(now * 1e9));
+		size_t offset = output.size();
+		output.resize(offset + frames * scenario.channels);
+		compensator.read(output.data() + offset, frames);
+
+		// Judge steady state in the last quarter, well after start-up and any stall.
+		if (now > scenario.seconds * 0.75)
+		{
+			auto stats = compensator.get_stats();
+			double error = fabs(stats.backlog_ms - stats.target_ms);
+			result.max_backlog_error_ms = std::max(result.max_backlog_error_ms, error);
+			result.max_ratio_wander_ppm = std::max(result.max_ratio_wander_ppm,
+			                                       fabs(stats.ratio_ppm - scenario.drift_ppm));
+		}
+	}
+
+	// Output follows the reference clock exactly, regardless of drift and stalls.
+	size_t num_output_frames = output.size() / scenario.channels;
+	result.output_frame_error = int64_t(num_output_frames) -
+	                            int64_t((last_now - first_now) * scenario.sample_rate);
+
+	auto stats = compensator.get_stats();
+	result.estimated_drift_ppm = stats.drift_ppm;
+	result.underrun_frames = stats.underrun_frames;
+	result.overrun_frames = stats.overrun_frames;
+	return result;
+}
+
+static bool check(const Scenario &scenario, uint64_t seed)
+{
+	auto result = run_simulation(scenario, seed);
+
+	// The proportional term follows capture jitter a little. 50 ppm is well below 0.1 cents of pitch.
+	bool ok = fabs(result.estimated_drift_ppm - scenario.drift_ppm) < 5.0 &&
+	          result.max_backlog_error_ms < 3.0 &&
+	          result.max_ratio_wander_ppm < 50.0 &&
+	          result.overrun_frames == 0 &&
+	          std::abs(result.output_frame_error) <= 1 &&
+	          (scenario.stall_seconds > 0.0 || result.underrun_frames == 0);
+
+	fprintf(stderr, "%s: %s, drift %.1f ppm (actual %.1f), backlog error %.2f ms, ratio wander %.1f ppm, "
+	                "%llu underrun frames, output frame error %lld.\n",
+	        scenario.name, ok ? "OK" : "FAIL",
+	        result.estimated_drift_ppm, scenario.drift_ppm, result.max_backlog_error_ms, result.max_ratio_wander_ppm,
+	        static_cast<unsigned long long>(result.underrun_frames),
+	        static_cast<long long>(result.output_frame_error));
+
+	return ok;
+}
+
+// Resampling a sine at a fixed ratio must give a clean sine at the scaled frequency.
+// Input is pushed in odd sized chunks to exercise the streaming path.
+static bool check_resampler(unsigned channels, double ratio, uint64_t seed)
+{
+	const unsigned sample_rate = 48000;
+	const size_t num_output_frames = sample_rate;
+	DriftResampler resampler;
+	resampler.init(channels);
+	resampler.set_ratio(ratio);
+
+	std::mt19937 rnd(seed);
+	std::uniform_int_distribution<size_t> chunk_size(1, 700);
+	std::vector<float> output(num_output_frames * channels);
+	std::vector<float> chunk;
+	size_t input_frames = 0;
+	size_t produced = 0;
+
+	while (produced < num_output_frames)
+	{
+		size_t frames = chunk_size(rnd);
+		chunk.resize(frames * channels);
+		for (size_t i = 0; i < frames; i++)
+			for (unsigned c = 0; c < channels; c++)
+				chunk[i * channels + c] = float(0.5 * sin(2.0 * Pi * channel_frequency(c) * double(input_frames + i) / sample_rate));
+		resampler.push_input(chunk.data(), frames);
+		input_frames += frames;
+
+		produced += resampler.produce(output.data() + produced * channels,
+		                              std::min(num_output_frames - produced, chunk_size(rnd)));
+	}
+
+	// Skip the start, where the filter still sees the silent history.
+	double min_snr = 1000.0;
+	for (unsigned c = 0; c < channels; c++)
+	{
+		double omega = 2.0 * Pi * channel_frequency(c) * ratio / sample_rate;
+		size_t skip = DriftResampler::HalfTaps;
+		min_snr = std::min(min_snr, measure_snr_db(output, channels, c, skip, num_output_frames - skip, omega));
+	}
+
+	bool ok = min_snr > 90.0;
+	fprintf(stderr, "resampler %u channels @ %.4f: %s, SNR %.1f dB.\n", channels, ratio, ok ? "OK" : "FAIL", min_snr);
+	return ok;
+}
+
+int main()
+{
+	const Scenario scenarios[] = {
+		{ "no-drift", 48000, 2, 0.0, 480, 120.0, 0.0 },
+		{ "fast-device", 48000, 2, 120.0, 480, 120.0, 0.0 },
+		{ "slow-device", 44100, 2, -250.0, 441, 120.0, 0.0 },
+		{ "5.1", 48000, 6, 60.0, 1024, 120.0, 0.0 },
+		{ "large-drift", 48000, 2, 2000.0, 480, 120.0, 0.0 },
+		{ "stall", 48000, 2, 80.0, 480, 120.0, 0.25 },
+	};
+
+	bool success = true;
+	uint64_t seed = 1;
+
+	success = check_resampler(2, 1.0, seed++) && success;
+	success = check_resampler(2, 1.0005, seed++) && success;
+	success = check_resampler(8, 0.995, seed++) && success;
+
+	for (auto &scenario : scenarios)
+		success = check(scenario, seed++) && success;
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
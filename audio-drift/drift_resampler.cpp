@@ -0,0 +1,146 @@
+#include "drift_resampler.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace PyroFling
+{
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window.
+static double bessel_i0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+void DriftResampler::init(unsigned channels_)
+{
+	channels = channels_;
+
+	// Drift is tiny, so the cutoff only needs a little margin below Nyquist.
+	// Kaiser beta of 9 gives roughly 90 dB stopband attenuation.
+	constexpr double cutoff = 0.95;
+	constexpr double beta = 9.0;
+	const double pi = 3.14159265358979323846;
+
+	kernel.resize((Phases + 1) * Taps);
+	for (unsigned phase = 0; phase <= Phases; phase++)
+	{
+		double frac = double(phase) / double(Phases);
+		float *row = kernel.data() + phase * Taps;
+		double sum = 0.0;
+
+		for (unsigned tap = 0; tap < Taps; tap++)
+		{
+			// Distance from the output position to the input frame this tap is applied to.
+			double x = double(tap) + 1.0 - double(HalfTaps) - frac;
+			double w = x / double(HalfTaps);
+			double window = std::abs(w) < 1.0 ? bessel_i0(beta * std::sqrt(1.0 - w * w)) / bessel_i0(beta) : 0.0;
+			double sinc = x == 0.0 ? 1.0 : std::sin(pi * cutoff * x) / (pi * cutoff * x);
+			row[tap] = float(cutoff * sinc * window);
+			sum += row[tap];
+		}
+
+		// Unity gain at DC for every phase, or the ripple between phases becomes audible noise.
+		for (unsigned tap = 0; tap < Taps; tap++)
+			row[tap] = float(row[tap] / sum);
+	}
+
+	reset();
+}
+
+void DriftResampler::reset()
+{
+	// Start with silent history, so the first output frame lines up with the first input frame.
+	input.clear();
+	input.resize(HalfTaps * channels);
+	position = double(HalfTaps);
+}
+
+void DriftResampler::set_ratio(double ratio_)
+{
+	ratio = ratio_;
+}
+
+double DriftResampler::get_ratio() const
+{
+	return ratio;
+}
+
+size_t DriftResampler::get_num_input_frames() const
+{
+	return channels ? input.size() / channels : 0;
+}
+
+size_t DriftResampler::get_required_input_frames(size_t output_frames) const
+{
+	if (!output_frames)
+		return 0;
+
+	double last = position + double(output_frames - 1) * ratio;
+	size_t needed = size_t(last) + HalfTaps + 1;
+	size_t num_frames = get_num_input_frames();
+	return needed > num_frames ? needed - num_frames : 0;
+}
+
+double DriftResampler::get_buffered_input_frames() const
+{
+	return std::max(0.0, double(get_num_input_frames()) - position);
+}
+
+void DriftResampler::push_input(const float *data, size_t frames)
+{
+	input.insert(input.end(), data, data + frames * channels);
+}
+
+size_t DriftResampler::produce(float *output, size_t output_frames)
+{
+	size_t num_frames = get_num_input_frames();
+	size_t produced = 0;
+	float weights[Taps];
+
+	while (produced < output_frames)
+	{
+		auto index = size_t(position);
+		if (index + HalfTaps >= num_frames)
+			break;
+
+		// Linear interpolation between the two nearest phases of the kernel.
+		double phase = (position - double(index)) * Phases;
+		auto phase_index = unsigned(phase);
+		auto t = float(phase - double(phase_index));
+		const float *k0 = kernel.data() + phase_index * Taps;
+		const float *k1 = k0 + Taps;
+		for (unsigned tap = 0; tap < Taps; tap++)
+			weights[tap] = k0[tap] + t * (k1[tap] - k0[tap]);
+
+		const float *src = input.data() + (index + 1 - HalfTaps) * channels;
+		float *dst = output + produced * channels;
+		for (unsigned c = 0; c < channels; c++)
+		{
+			float acc = 0.0f;
+			for (unsigned tap = 0; tap < Taps; tap++)
+				acc += weights[tap] * src[tap * channels + c];
+			dst[c] = acc;
+		}
+
+		position += ratio;
+		produced++;
+	}
+
+	// Drop history which no future output frame can reach.
+	auto index = size_t(position);
+	if (index >= HalfTaps)
+	{
+		size_t drop = std::min(index + 1 - HalfTaps, num_frames);
+		input.erase(input.begin(), input.begin() + drop * channels);
+		position -= double(drop);
+	}
+
+	return produced;
+}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+namespace PyroFling
+{
+// Windowed sinc resampler for ratios close to 1, used to absorb drift between two clocks.
+// The ratio can change between any two output frames without discontinuities.
+// Channels are interleaved and filtered independently, so any channel layout works as-is.
+class DriftResampler
+{
+public:
+	enum { HalfTaps = 16, Taps = 2 * HalfTaps, Phases = 256 };
+
+	void init(unsigned channels);
+	void reset();
+
+	// Input frames consumed per output frame.
+	void set_ratio(double ratio);
+	double get_ratio() const;
+
+	// Number of input frames which must be pushed before output_frames can be produced.
+	size_t get_required_input_frames(size_t output_frames) const;
+	// Input frames which have been pushed but not consumed yet, including the fractional position.
+	double get_buffered_input_frames() const;
+
+	void push_input(const float *data, size_t frames);
+	// Produces up to output_frames, limited by the input pushed so far.
+	size_t produce(float *output, size_t output_frames);
+
+private:
+	// Phases + 1 rows, so interpolation between phases never needs to wrap.
+	std::vector<float> kernel;
+	std::vector<float> input;
+	unsigned channels = 0;
+	double position = 0.0;
+	double ratio = 1.0;
+
+	size_t get_num_input_frames() const;
+};
+}
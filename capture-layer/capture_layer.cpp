@@ -574,6 +574,11 @@ VkResult SurfaceState::processPresent(VkQueue queue, uint32_t index, uint64_t kh
 	if (!pollConnection())
 		return VK_SUCCESS;
 
+	// If the server is not keeping up with earlier messages, skip capturing this frame.
+	// Queuing more would eventually fill the write queue and fail the send, which tears down the session.
+	if (client->is_congested())
+		return VK_SUCCESS;
+
 	// Blocking in present isn't great.
 	// If we implement WSI ourselves, we would deal with it more properly where acquire ties to client acquire.
 	uint32_t clientIndex;
@@ -719,6 +724,7 @@ VkResult SurfaceState::processPresent(VkQueue queue, uint32_t index, uint64_t kh
 	img.ready = false;
 	img.fencePending = true;
 
+	// The write queue was empty above, so a failed send is a broken connection, not backpressure.
 	if (!client->send_wire_message(wire, &release_fd, 1))
 	{
 		std::unique_lock<std::mutex> holder{clientLock};
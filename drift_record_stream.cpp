@@ -0,0 +1,107 @@
+#include "drift_record_stream.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <chrono>
+
+namespace PyroFling
+{
+DriftCompensatedRecordStream::DriftCompensatedRecordStream(Granite::Audio::RecordStream *device_,
+                                                           float sample_rate_, unsigned channels_,
+                                                           const AudioDriftCompensator::Options &options_)
+	: device(device_), options(options_)
+{
+	sample_rate = sample_rate_;
+	num_channels = channels_;
+}
+
+DriftCompensatedRecordStream::~DriftCompensatedRecordStream()
+{
+	stop();
+}
+
+bool DriftCompensatedRecordStream::start()
+{
+	if (running)
+		return true;
+
+	if (!compensator.init(unsigned(sample_rate), num_channels, options))
+	{
+		LOGE("Invalid audio drift compensation options.\n");
+		return false;
+	}
+
+	if (!device->start())
+		return false;
+
+	running = true;
+	capture_thread = std::thread(&DriftCompensatedRecordStream::capture_loop, this);
+	return true;
+}
+
+bool DriftCompensatedRecordStream::stop()
+{
+	if (!running)
+		return true;
+
+	running = false;
+	capture_thread.join();
+	return device->stop();
+}
+
+void DriftCompensatedRecordStream::capture_loop()
+{
+	std::vector<float> buffer;
+
+	while (running)
+	{
+		size_t avail = 0;
+		uint32_t device_latency_us = 0;
+		if (device->get_buffer_status(avail, device_latency_us) && avail)
+		{
+			buffer.resize(avail * num_channels);
+			size_t frames = device->read_frames_interleaved_f32(buffer.data(), avail, false);
+
+			// Stamp with arrival time. Device latency is constant, so it only offsets the backlog.
+			if (frames)
+				compensator.write(buffer.data(), frames, Util::get_current_time_nsecs());
+		}
+		else
+		{
+			// Devices deliver in blocks of several milliseconds, so polling at 1 ms adds little jitter.
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+bool DriftCompensatedRecordStream::get_buffer_status(size_t &read_avail, uint32_t &latency_usec)
+{
+	if (!running)
+		return false;
+
+	read_avail = compensator.update(Util::get_current_time_nsecs());
+	latency_usec = compensator.get_latency_us();
+	return true;
+}
+
+size_t DriftCompensatedRecordStream::read_frames_interleaved_f32(float *data, size_t frames, bool)
+{
+	return compensator.read(data, frames);
+}
+
+size_t DriftCompensatedRecordStream::read_frames_deinterleaved_f32(float * const *data, size_t frames, bool)
+{
+	interleaved.resize(frames * num_channels);
+	compensator.read(interleaved.data(), frames);
+
+	for (unsigned c = 0; c < num_channels; c++)
+		for (size_t i = 0; i < frames; i++)
+			data[c][i] = interleaved[i * num_channels + c];
+
+	return frames;
+}
+
+AudioDriftCompensator::Stats DriftCompensatedRecordStream::get_stats() const
+{
+	return compensator.get_stats();
+}
+}
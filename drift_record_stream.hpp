@@ -0,0 +1,41 @@
+#pragma once
+
+#include "audio_interface.hpp"
+#include "drift_compensator.hpp"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace PyroFling
+{
+// Record stream handed to the encoder in place of the device stream.
+// A capture thread drains the device into an AudioDriftCompensator as soon as frames arrive,
+// and the encoder receives exactly sample_rate frames per second on the heartbeat clock,
+// no matter how far the audio device clock drifts from it.
+class DriftCompensatedRecordStream final : public Granite::Audio::RecordStream
+{
+public:
+	DriftCompensatedRecordStream(Granite::Audio::RecordStream *device, float sample_rate, unsigned channels,
+	                             const AudioDriftCompensator::Options &options);
+	~DriftCompensatedRecordStream() override;
+
+	size_t read_frames_deinterleaved_f32(float * const *data, size_t frames, bool blocking) override;
+	size_t read_frames_interleaved_f32(float *data, size_t frames, bool blocking) override;
+	bool get_buffer_status(size_t &read_avail, uint32_t &latency_usec) override;
+	bool start() override;
+	bool stop() override;
+
+	AudioDriftCompensator::Stats get_stats() const;
+
+private:
+	std::unique_ptr<Granite::Audio::RecordStream> device;
+	AudioDriftCompensator::Options options;
+	AudioDriftCompensator compensator;
+	std::vector<float> interleaved;
+
+	std::thread capture_thread;
+	std::atomic_bool running{false};
+	void capture_loop();
+};
+}
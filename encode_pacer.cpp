@@ -0,0 +1,120 @@
+#include "encode_pacer.hpp"
+#include <algorithm>
+
+namespace PyroFling
+{
+void EncodePacer::set_options(const Options &options_)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	options = options_;
+	options.window_frames = std::max(options.window_frames, 1u);
+}
+
+// Frames in flight are encoded one after the other, each taking the average cost.
+uint64_t EncodePacer::predict_done_ns(uint64_t now_ns) const
+{
+	auto cost = uint64_t(cost_ns);
+	uint64_t t = last_done_ns;
+	for (uint64_t latch_ns : in_flight)
+		t = std::max(t, latch_ns) + cost;
+	return std::max(t, now_ns) + cost;
+}
+
+void EncodePacer::update_overload(bool dropped)
+{
+	window_count++;
+	if (dropped)
+		window_drops++;
+
+	if (window_count < options.window_frames)
+		return;
+
+	bool next = overloaded;
+	if (double(window_drops) >= options.overload_drop_ratio * double(window_count))
+		next = true;
+	else if (window_drops == 0)
+		next = false;
+
+	if (next != overloaded)
+	{
+		overloaded = next;
+		overload_changed = true;
+	}
+
+	window_count = 0;
+	window_drops = 0;
+}
+
+bool EncodePacer::begin_frame(uint64_t now_ns)
+{
+	std::lock_guard<std::mutex> holder{lock};
+
+	// Until the first frame is done, the cost is unknown, so don't queue anything behind it.
+	bool drop = options.budget_ns && !in_flight.empty() &&
+	            (!has_cost || predict_done_ns(now_ns) > now_ns + options.budget_ns);
+
+	update_overload(drop);
+
+	if (drop)
+	{
+		dropped_frames++;
+		return false;
+	}
+
+	in_flight.push_back(now_ns);
+	return true;
+}
+
+void EncodePacer::end_frame(uint64_t now_ns)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	if (in_flight.empty())
+		return;
+
+	uint64_t latch_ns = in_flight.front();
+	in_flight.pop_front();
+
+	// The encode could only start once the previous frame was done,
+	// so waiting in the queue does not count towards the cost.
+	uint64_t start_ns = std::max(latch_ns, last_done_ns);
+	double cost = double(now_ns > start_ns ? now_ns - start_ns : 0);
+	last_done_ns = std::max(last_done_ns, now_ns);
+
+	if (has_cost)
+		cost_ns += options.cost_weight * (cost - cost_ns);
+	else
+		cost_ns = cost;
+	has_cost = true;
+
+	encoded_frames++;
+	if (options.budget_ns && now_ns > latch_ns + options.budget_ns)
+		late_frames++;
+}
+
+bool EncodePacer::is_overloaded() const
+{
+	std::lock_guard<std::mutex> holder{lock};
+	return overloaded;
+}
+
+bool EncodePacer::get_and_clear_overload_change(bool &overloaded_)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	overloaded_ = overloaded;
+	bool changed = overload_changed;
+	overload_changed = false;
+	return changed;
+}
+
+EncodePacer::Stats EncodePacer::get_stats() const
+{
+	std::lock_guard<std::mutex> holder{lock};
+	Stats stats = {};
+	stats.cost_ms = cost_ns * 1e-6;
+	stats.encoded_frames = encoded_frames;
+	stats.dropped_frames = dropped_frames;
+	stats.late_frames = late_frames;
+	stats.overloaded = overloaded;
+	return stats;
+}
+}
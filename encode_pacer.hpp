@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+
+namespace PyroFling
+{
+// Keeps the time from latching a frame until it is fully encoded within a budget.
+// Frames complete in latch order, so a frame latched while earlier frames are still encoding has to wait for them.
+// With parallel encode, several frames encode at once, but the reorder stage still completes them in order,
+// and the measured cost becomes the interval between completions rather than the time for one encode.
+// From the measured encode cost, the pacer predicts when a new frame would be done, and turns down frames
+// which would miss the budget. The next latched frame carries the newer content anyway,
+// so under overload frames are merged instead of queued, and latency stays bounded.
+// A frame is never turned down if nothing is encoding, since it cannot be done any sooner.
+class EncodePacer
+{
+public:
+	struct Options
+	{
+		// 0 disables dropping, e.g. when every frame must be encoded.
+		uint64_t budget_ns = 0;
+		// Weight of the latest frame in the encode cost average.
+		double cost_weight = 0.1;
+		// Overload is evaluated over windows of this many frames.
+		unsigned window_frames = 60;
+		// Fraction of dropped frames within a window which is considered overload.
+		// Overload is cleared after a window without drops.
+		double overload_drop_ratio = 0.1;
+	};
+
+	struct Stats
+	{
+		double cost_ms;
+		uint64_t encoded_frames;
+		uint64_t dropped_frames;
+		// Encoded, but took longer than the budget since the prediction was off.
+		uint64_t late_frames;
+		bool overloaded;
+	};
+
+	void set_options(const Options &options);
+
+	// Heartbeat thread. Returns false if the frame should be dropped.
+	// Otherwise, the frame is considered in flight until end_frame().
+	bool begin_frame(uint64_t now_ns);
+
+	// Encode threads. Called once all encodes of the frame are done, in the same order as begin_frame().
+	void end_frame(uint64_t now_ns);
+
+	// Set when frames are being dropped persistently, i.e. encoding cannot keep up with the frame rate.
+	bool is_overloaded() const;
+
+	// Returns true once every time the overload state changes.
+	bool get_and_clear_overload_change(bool &overloaded);
+
+	Stats get_stats() const;
+
+private:
+	Options options;
+	mutable std::mutex lock;
+	// Latch time of frames which are not done encoding yet, oldest first.
+	std::deque<uint64_t> in_flight;
+	uint64_t last_done_ns = 0;
+	double cost_ns = 0.0;
+	bool has_cost = false;
+
+	uint64_t encoded_frames = 0;
+	uint64_t dropped_frames = 0;
+	uint64_t late_frames = 0;
+
+	unsigned window_count = 0;
+	unsigned window_drops = 0;
+	bool overloaded = false;
+	bool overload_changed = false;
+
+	uint64_t predict_done_ns(uint64_t now_ns) const;
+	void update_overload(bool dropped);
+};
+}
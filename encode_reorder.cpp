@@ -0,0 +1,85 @@
+#include "encode_reorder.hpp"
+
+namespace PyroFling
+{
+EncodeReorder::Callback::Callback(EncodeReorder &reorder_, bool primary_)
+	: reorder(reorder_), primary(primary_)
+{
+}
+
+void EncodeReorder::Callback::set_codec_parameters(const pyro_codec_parameters &codec)
+{
+	if (primary)
+		reorder.target.set_codec_parameters(codec);
+}
+
+void EncodeReorder::Callback::write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size,
+                                                 bool is_key_frame)
+{
+	// The encoder reuses its packet storage, so it has to be copied to outlive the callback.
+	packets.push_back({ pts, dts, reorder.pool->copy(data, size), true, is_key_frame });
+}
+
+void EncodeReorder::Callback::write_audio_packet(int64_t pts, int64_t dts, const void *data, size_t size)
+{
+	packets.push_back({ pts, dts, reorder.pool->copy(data, size), false, false });
+}
+
+bool EncodeReorder::Callback::should_force_idr()
+{
+	return primary && reorder.target.should_force_idr();
+}
+
+EncodeReorder::EncodeReorder(Granite::MuxStreamCallback &target_, Util::IntrusivePtr<PacketBufferPool> pool_,
+                             unsigned num_encoders)
+	: target(target_), pool(std::move(pool_))
+{
+	for (unsigned i = 0; i < num_encoders; i++)
+		callbacks.emplace_back(new Callback(*this, i == 0));
+}
+
+unsigned EncodeReorder::get_num_encoders() const
+{
+	return unsigned(callbacks.size());
+}
+
+Granite::MuxStreamCallback &EncodeReorder::get_callback(unsigned index)
+{
+	return *callbacks[index];
+}
+
+uint64_t EncodeReorder::begin_frame()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	return next_begin++;
+}
+
+void EncodeReorder::end_frame(uint64_t frame, unsigned index, std::function<void ()> done)
+{
+	std::lock_guard<std::mutex> holder{lock};
+
+	auto &entry = frames[frame];
+	entry.packets = std::move(callbacks[index]->packets);
+	entry.done = std::move(done);
+	callbacks[index]->packets.clear();
+
+	// Forwarding happens under the lock, so the target sees one stream, even if it is not thread-safe itself.
+	for (auto itr = frames.find(next_forward); itr != frames.end(); itr = frames.find(next_forward))
+	{
+		for (auto &packet : itr->second.packets)
+		{
+			if (packet.is_video)
+				target.write_video_packet(packet.pts, packet.dts, packet.data->data(), packet.data->size(),
+				                          packet.is_key_frame);
+			else
+				target.write_audio_packet(packet.pts, packet.dts, packet.data->data(), packet.data->size());
+		}
+
+		if (itr->second.done)
+			itr->second.done();
+
+		frames.erase(itr);
+		next_forward++;
+	}
+}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "ffmpeg_encode.hpp"
+#include "pyro_protocol.h"
+#include "packet_buffer.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace PyroFling
+{
+// Puts packets from several encoders which run concurrently back in frame order.
+// Frames of intra-only codecs do not depend on each other, so they can be spread over independent encoders,
+// but pyro clients and muxers still expect one stream in frame order.
+// Every encoder gets its own callback, which buffers the packets of the frame it is encoding.
+// Once a frame is done, its packets are forwarded as soon as all earlier frames have been forwarded.
+class EncodeReorder
+{
+public:
+	// Packets are forwarded to target from whichever encode thread completes the oldest frame,
+	// but never concurrently.
+	EncodeReorder(Granite::MuxStreamCallback &target, Util::IntrusivePtr<PacketBufferPool> pool,
+	              unsigned num_encoders);
+
+	unsigned get_num_encoders() const;
+
+	// Mux callback for one encoder. An encoder must only encode one frame at a time.
+	// All encoders are configured the same, so only the first one forwards codec parameters and IDR requests.
+	Granite::MuxStreamCallback &get_callback(unsigned index);
+
+	// Heartbeat thread. Returns the frame number to complete with end_frame().
+	uint64_t begin_frame();
+
+	// Encode threads. Takes the packets encoder index buffered since its last end_frame().
+	// Every frame from begin_frame() must be ended, even if encoding failed, or later frames are held forever.
+	// done is called in frame order right after the packets of the frame were forwarded.
+	void end_frame(uint64_t frame, unsigned index, std::function<void ()> done);
+
+private:
+	struct Packet
+	{
+		int64_t pts;
+		int64_t dts;
+		PacketBufferHandle data;
+		bool is_video;
+		bool is_key_frame;
+	};
+
+	class Callback final : public Granite::MuxStreamCallback
+	{
+	public:
+		Callback(EncodeReorder &reorder, bool primary);
+
+		void set_codec_parameters(const pyro_codec_parameters &codec) override;
+		void write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame) override;
+		void write_audio_packet(int64_t pts, int64_t dts, const void *data, size_t size) override;
+		bool should_force_idr() override;
+
+	private:
+		friend class EncodeReorder;
+		EncodeReorder &reorder;
+		bool primary;
+		std::vector<Packet> packets;
+	};
+
+	struct Frame
+	{
+		std::vector<Packet> packets;
+		std::function<void ()> done;
+	};
+
+	Granite::MuxStreamCallback &target;
+	Util::IntrusivePtr<PacketBufferPool> pool;
+	std::vector<std::unique_ptr<Callback>> callbacks;
+
+	std::mutex lock;
+	// Frames which are done encoding, but wait for earlier frames to be forwarded first.
+	std::map<uint64_t, Frame> frames;
+	uint64_t next_begin = 0;
+	uint64_t next_forward = 0;
+};
+}
@@ -0,0 +1,226 @@
+#include "encoder_probe.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace PyroFling
+{
+// Bump when the meaning of entries changes, so old files are ignored.
+static const char CacheMagic[] = "pyrofling-encoder-cache 2";
+
+std::string EncoderProbeCache::get_default_directory()
+{
+	if (const char *xdg = getenv("XDG_CACHE_HOME"))
+		if (*xdg)
+			return std::string(xdg) + "/pyrofling";
+
+	if (const char *home = getenv("HOME"))
+		if (*home)
+			return std::string(home) + "/.cache/pyrofling";
+
+	return {};
+}
+
+std::string EncoderProbeCache::make_key(const char *encoder, unsigned format, unsigned width, unsigned height)
+{
+	char key[256];
+	snprintf(key, sizeof(key), "%s format %u %ux%u", encoder, format, width, height);
+	return key;
+}
+
+void EncoderProbeCache::load(const std::string &directory, const uint8_t (&device_uuid)[16], uint32_t driver_version_)
+{
+	entries.clear();
+	dirty = false;
+	driver_version = driver_version_;
+	path.clear();
+
+	if (directory.empty())
+		return;
+
+	path = directory + "/encoders-";
+	for (uint8_t v : device_uuid)
+	{
+		char hex[3];
+		snprintf(hex, sizeof(hex), "%02x", v);
+		path += hex;
+	}
+	path += ".txt";
+
+	FILE *file = fopen(path.c_str(), "r");
+	if (!file)
+		return;
+
+	char line[1024];
+	bool valid = fgets(line, sizeof(line), file) && strncmp(line, CacheMagic, strlen(CacheMagic)) == 0;
+
+	unsigned long cached_driver_version = 0;
+	valid = valid && fgets(line, sizeof(line), file) &&
+	        sscanf(line, "driver %lu", &cached_driver_version) == 1 &&
+	        cached_driver_version == driver_version;
+
+	if (!valid)
+	{
+		LOGI("Encoder probe cache %s is stale, probing again.\n", path.c_str());
+		fclose(file);
+		// Rewrite it for the current driver, even if nothing new is probed.
+		dirty = true;
+		return;
+	}
+
+	while (fgets(line, sizeof(line), file))
+	{
+		size_t len = strlen(line);
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+
+		Entry entry;
+		int offset = 0;
+		unsigned failures = 0;
+		long long failure_time = 0;
+
+		if (sscanf(line, "supported %n", &offset) == 0 && offset > 0)
+		{
+			entry.result = Result::Supported;
+		}
+		else if (sscanf(line, "unsupported %u %lld %n", &failures, &failure_time, &offset) == 2 && offset > 0)
+		{
+			entry.result = Result::Unsupported;
+			entry.failures = std::max(failures, 1u);
+			entry.failure_time = failure_time;
+		}
+		else
+			continue;
+
+		if (line[offset] != '\0')
+			entries[line + offset] = entry;
+	}
+
+	fclose(file);
+}
+
+static bool create_directories(const std::string &path)
+{
+	for (size_t i = 1; i <= path.size(); i++)
+	{
+		if (i == path.size() || path[i] == '/')
+		{
+			std::string dir = path.substr(0, i);
+			if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+bool EncoderProbeCache::save()
+{
+	if (path.empty() || !dirty)
+		return true;
+
+	auto slash = path.find_last_of('/');
+	if (slash != std::string::npos && !create_directories(path.substr(0, slash)))
+	{
+		LOGW("Failed to create directory for encoder probe cache %s.\n", path.c_str());
+		return false;
+	}
+
+	// Write to a temporary and rename, so a process killed mid-write does not leave a truncated cache.
+	std::string tmp_path = path + ".tmp";
+	FILE *file = fopen(tmp_path.c_str(), "w");
+	if (!file)
+	{
+		LOGW("Failed to open encoder probe cache %s for writing.\n", tmp_path.c_str());
+		return false;
+	}
+
+	fprintf(file, "%s\ndriver %lu\n", CacheMagic, static_cast<unsigned long>(driver_version));
+	for (auto &entry : entries)
+	{
+		if (entry.second.result == Result::Supported)
+		{
+			fprintf(file, "supported %s\n", entry.first.c_str());
+		}
+		else if (entry.second.result == Result::Unsupported)
+		{
+			fprintf(file, "unsupported %u %lld %s\n", entry.second.failures,
+			        static_cast<long long>(entry.second.failure_time), entry.first.c_str());
+		}
+	}
+
+	bool ok = fclose(file) == 0;
+	if (!ok || rename(tmp_path.c_str(), path.c_str()) < 0)
+	{
+		LOGW("Failed to write encoder probe cache %s.\n", path.c_str());
+		unlink(tmp_path.c_str());
+		return false;
+	}
+
+	dirty = false;
+	return true;
+}
+
+static int64_t get_retry_delay(unsigned failures)
+{
+	int64_t delay = EncoderProbeCache::BaseRetrySeconds;
+	for (unsigned i = 1; i < failures && delay < EncoderProbeCache::MaxRetrySeconds; i++)
+		delay *= 2;
+	return std::min<int64_t>(delay, EncoderProbeCache::MaxRetrySeconds);
+}
+
+EncoderProbeCache::Result EncoderProbeCache::get(const std::string &key, int64_t now) const
+{
+	auto itr = entries.find(key);
+	if (itr == entries.end())
+		return Result::Unknown;
+
+	auto &entry = itr->second;
+	// Also retry if the clock went backwards, since the failure time cannot be trusted then.
+	if (entry.result == Result::Unsupported &&
+	    (now >= entry.failure_time + get_retry_delay(entry.failures) || now < entry.failure_time))
+		return Result::Unknown;
+
+	return entry.result;
+}
+
+void EncoderProbeCache::set(const std::string &key, Result result, int64_t now)
+{
+	auto &entry = entries[key];
+
+	if (result == Result::Unsupported)
+	{
+		entry.failures = entry.result == Result::Unsupported ? entry.failures + 1 : 1;
+		entry.failure_time = now;
+	}
+	else
+	{
+		entry.failures = 0;
+		entry.failure_time = 0;
+	}
+
+	entry.result = result;
+	dirty = true;
+}
+
+std::vector<unsigned> EncoderProbeCache::get_probe_order(const std::vector<std::string> &keys, int64_t now) const
+{
+	std::vector<unsigned> order;
+	order.reserve(keys.size());
+
+	for (unsigned i = 0; i < keys.size(); i++)
+		if (get(keys[i], now) != Result::Unsupported)
+			order.push_back(i);
+
+	for (unsigned i = 0; i < keys.size(); i++)
+		if (get(keys[i], now) == Result::Unsupported)
+			order.push_back(i);
+
+	return order;
+}
+}
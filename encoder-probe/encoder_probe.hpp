@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace PyroFling
+{
+// Remembers which encoder configurations initialized on a GPU, so startup can go straight to one which works.
+// Failed hardware encoder initialization can take seconds, e.g. when FFmpeg loads a driver stack which is not there.
+// The cache is one file per GPU, keyed by device UUID. Entries are only valid for the driver version they
+// were recorded with, since a driver update can add or remove encoder support.
+// Initialization can also fail for transient reasons, e.g. when all encode sessions are taken,
+// so a failure is only trusted for a while. The retry delay grows with every consecutive failure.
+class EncoderProbeCache
+{
+public:
+	enum class Result { Unknown, Supported, Unsupported };
+
+	// First retry after a failure, doubled for every consecutive failure up to the maximum.
+	enum { BaseRetrySeconds = 60 * 60, MaxRetrySeconds = 7 * 24 * 60 * 60 };
+
+	// Returns the default directory, $XDG_CACHE_HOME/pyrofling or ~/.cache/pyrofling, or empty if neither is set.
+	static std::string get_default_directory();
+
+	// A missing or stale cache file is not an error, it just starts out empty.
+	void load(const std::string &directory, const uint8_t (&device_uuid)[16], uint32_t driver_version);
+	bool save();
+
+	// Times are in seconds since the epoch. A failure which is due for a retry is reported as Unknown.
+	Result get(const std::string &key, int64_t now) const;
+	void set(const std::string &key, Result result, int64_t now);
+
+	// Returns indices into keys in the order they should be probed.
+	// Known failures go last, so they are only retried if nothing else works.
+	std::vector<unsigned> get_probe_order(const std::vector<std::string> &keys, int64_t now) const;
+
+	// Describes one probed configuration, e.g. "h264_nvenc format 3 1920x1080".
+	static std::string make_key(const char *encoder, unsigned format, unsigned width, unsigned height);
+
+private:
+	struct Entry
+	{
+		Result result = Result::Unknown;
+		// Consecutive failures, and when the last one happened.
+		unsigned failures = 0;
+		int64_t failure_time = 0;
+	};
+
+	std::string path;
+	uint32_t driver_version = 0;
+	std::unordered_map<std::string, Entry> entries;
+	bool dirty = false;
+};
+}
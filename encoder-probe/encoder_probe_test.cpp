@@ -0,0 +1,113 @@
+#include "encoder_probe.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace PyroFling;
+
+static bool check(const char *name, bool ok)
+{
+	fprintf(stderr, "%s: %s\n", name, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+int main()
+{
+	char dir_template[] = "/tmp/pyrofling-encoder-probe-XXXXXX";
+	if (!mkdtemp(dir_template))
+		return EXIT_FAILURE;
+	std::string dir = std::string(dir_template) + "/nested/cache";
+
+	const uint8_t uuid[16] = { 0xde, 0xad, 0xbe, 0xef };
+	const int64_t now = 1000000;
+	bool success = true;
+
+	auto hw = EncoderProbeCache::make_key("h264_nvenc", 3, 1920, 1080);
+	auto vaapi = EncoderProbeCache::make_key("h264_vaapi", 3, 1920, 1080);
+	auto sw = EncoderProbeCache::make_key("libx264", 0, 1920, 1080);
+	const std::vector<std::string> keys = { hw, vaapi, sw };
+
+	{
+		EncoderProbeCache cache;
+		cache.load(dir, uuid, 1);
+		success = check("empty", cache.get(hw, now) == EncoderProbeCache::Result::Unknown) && success;
+
+		cache.set(hw, EncoderProbeCache::Result::Unsupported, now);
+		cache.set(sw, EncoderProbeCache::Result::Supported, now);
+		success = check("save", cache.save()) && success;
+	}
+
+	{
+		// Results survive a restart with the same driver.
+		EncoderProbeCache cache;
+		cache.load(dir, uuid, 1);
+		success = check("load", cache.get(hw, now) == EncoderProbeCache::Result::Unsupported &&
+		                        cache.get(vaapi, now) == EncoderProbeCache::Result::Unknown &&
+		                        cache.get(sw, now) == EncoderProbeCache::Result::Supported) && success;
+
+		// Known failures are moved last instead of dropped, so they are retried if nothing else works.
+		auto order = cache.get_probe_order(keys, now);
+		success = check("skip", order == std::vector<unsigned>{ 1, 2, 0 }) && success;
+	}
+
+	{
+		// A failure is retried after a while, and the delay grows with consecutive failures.
+		EncoderProbeCache cache;
+		cache.load(dir, uuid, 1);
+		int64_t retry = now + EncoderProbeCache::BaseRetrySeconds;
+		success = check("expiry", cache.get(hw, retry - 1) == EncoderProbeCache::Result::Unsupported &&
+		                          cache.get(hw, retry) == EncoderProbeCache::Result::Unknown) && success;
+
+		cache.set(hw, EncoderProbeCache::Result::Unsupported, retry);
+		int64_t second_retry = retry + 2 * EncoderProbeCache::BaseRetrySeconds;
+		success = check("backoff", cache.get(hw, second_retry - 1) == EncoderProbeCache::Result::Unsupported &&
+		                           cache.get(hw, second_retry) == EncoderProbeCache::Result::Unknown) && success;
+
+		// The delay is capped, so a host which had many failures still tries again eventually.
+		for (unsigned i = 0; i < 64; i++)
+			cache.set(hw, EncoderProbeCache::Result::Unsupported, now);
+		success = check("backoff-cap",
+		                cache.get(hw, now + EncoderProbeCache::MaxRetrySeconds) ==
+		                EncoderProbeCache::Result::Unknown) && success;
+
+		// Success clears the failure history.
+		cache.set(hw, EncoderProbeCache::Result::Supported, now);
+		cache.set(hw, EncoderProbeCache::Result::Unsupported, now);
+		success = check("reset", cache.get(hw, now + EncoderProbeCache::BaseRetrySeconds) ==
+		                         EncoderProbeCache::Result::Unknown) && success;
+		success = check("resave", cache.save()) && success;
+	}
+
+	{
+		// A driver update invalidates everything.
+		EncoderProbeCache cache;
+		cache.load(dir, uuid, 2);
+		success = check("stale", cache.get(hw, now) == EncoderProbeCache::Result::Unknown &&
+		                         cache.get(sw, now) == EncoderProbeCache::Result::Unknown) && success;
+	}
+
+	{
+		// Other GPUs have their own file.
+		const uint8_t other_uuid[16] = { 0x12 };
+		EncoderProbeCache cache;
+		cache.load(dir, other_uuid, 1);
+		success = check("other-gpu", cache.get(sw, now) == EncoderProbeCache::Result::Unknown) && success;
+	}
+
+	{
+		// Without a directory, nothing is stored.
+		EncoderProbeCache cache;
+		cache.load("", uuid, 1);
+		cache.set(hw, EncoderProbeCache::Result::Unsupported, now);
+		success = check("disabled", cache.save()) && success;
+	}
+
+	unlink((dir + "/encoders-deadbeef000000000000000000000000.txt").c_str());
+	rmdir(dir.c_str());
+	rmdir((std::string(dir_template) + "/nested").c_str());
+	rmdir(dir_template);
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,79 @@
+#include "frame_latency.hpp"
+#include <algorithm>
+
+namespace PyroFling
+{
+void FrameLatencyTracker::add_sample(LatencyStage stage, uint64_t delta_ns)
+{
+	auto s = unsigned(stage);
+	samples[s][write_index[s]] = uint32_t(std::min<uint64_t>(delta_ns, UINT32_MAX));
+	write_index[s] = (write_index[s] + 1) % WindowSize;
+	num_samples[s] = std::min<unsigned>(num_samples[s] + 1, WindowSize);
+}
+
+void FrameLatencyTracker::add_frame(const FrameTimestamps &ts)
+{
+	std::lock_guard<std::mutex> holder{lock};
+
+	uint64_t first_ns = 0;
+	uint64_t last_ns = 0;
+
+	for (unsigned i = 0; i < unsigned(LatencyStage::Count); i++)
+	{
+		uint64_t t = ts.ns[i];
+		if (!t)
+			continue;
+
+		// Stages can complete out of order, e.g. with immediate encode
+		// a frame may be latched before its fence is observed. Skip those.
+		if (last_ns && t >= last_ns)
+			add_sample(LatencyStage(i), t - last_ns);
+
+		if (!first_ns)
+			first_ns = t;
+		last_ns = std::max(last_ns, t);
+	}
+
+	if (first_ns && last_ns > first_ns)
+		add_sample(LatencyStage::Present, last_ns - first_ns);
+}
+
+LatencyPercentiles FrameLatencyTracker::get_percentiles(LatencyStage stage)
+{
+	uint32_t sorted[WindowSize];
+	unsigned count;
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		count = num_samples[unsigned(stage)];
+		std::copy(samples[unsigned(stage)], samples[unsigned(stage)] + count, sorted);
+	}
+
+	LatencyPercentiles result = {};
+	result.num_samples = count;
+	if (!count)
+		return result;
+
+	std::sort(sorted, sorted + count);
+	result.p50_ns = sorted[(count - 1) * 50 / 100];
+	result.p90_ns = sorted[(count - 1) * 90 / 100];
+	result.p99_ns = sorted[(count - 1) * 99 / 100];
+	result.max_ns = sorted[count - 1];
+	return result;
+}
+
+const char *FrameLatencyTracker::get_stage_name(LatencyStage stage)
+{
+	switch (stage)
+	{
+	case LatencyStage::Present: return "Total";
+	case LatencyStage::GPUDone: return "GPU";
+	case LatencyStage::Ready: return "Notify";
+	case LatencyStage::Latch: return "Latch";
+	case LatencyStage::Convert: return "Convert";
+	case LatencyStage::Encoded: return "Encode";
+	case LatencyStage::Sent: return "Send";
+	default: return "?";
+	}
+}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+
+namespace PyroFling
+{
+// Points in time a frame passes through on its way from a client present to the network.
+enum class LatencyStage : unsigned
+{
+	Present, // Present message received from client.
+	GPUDone, // Present fence signalled, including cross-device readback if any.
+	Ready, // Image marked ready on the dispatcher thread.
+	Latch, // Image latched for encoding.
+	Convert, // YCbCr conversion submitted.
+	Encoded, // First video packet out of the encoder.
+	Sent, // Last video packet handed off to the network or muxer.
+	Count
+};
+
+struct FrameTimestamps
+{
+	uint64_t frame_id = 0;
+	// 0 means the stage was not observed for this frame, e.g. the idle background has no present.
+	uint64_t ns[unsigned(LatencyStage::Count)] = {};
+
+	void mark(LatencyStage stage, uint64_t time_ns)
+	{
+		ns[unsigned(stage)] = time_ns;
+	}
+
+	uint64_t get(LatencyStage stage) const
+	{
+		return ns[unsigned(stage)];
+	}
+};
+
+struct LatencyPercentiles
+{
+	uint64_t p50_ns;
+	uint64_t p90_ns;
+	uint64_t p99_ns;
+	uint64_t max_ns;
+	unsigned num_samples;
+};
+
+// Aggregates per-stage latencies over a sliding window of frames.
+// Frames may be added and queried from different threads.
+class FrameLatencyTracker
+{
+public:
+	enum { WindowSize = 1024 };
+
+	void add_frame(const FrameTimestamps &ts);
+
+	// For a stage N, reports the time spent from the previous observed stage until N.
+	// For LatencyStage::Present, reports the total time from the first until the last observed stage.
+	LatencyPercentiles get_percentiles(LatencyStage stage);
+
+	static const char *get_stage_name(LatencyStage stage);
+
+private:
+	std::mutex lock;
+	uint32_t samples[unsigned(LatencyStage::Count)][WindowSize] = {};
+	unsigned num_samples[unsigned(LatencyStage::Count)] = {};
+	unsigned write_index[unsigned(LatencyStage::Count)] = {};
+
+	void add_sample(LatencyStage stage, uint64_t delta_ns);
+};
+}
@@ -0,0 +1,64 @@
+/* Copyright (c) 2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace PyroFling
+{
+namespace Fuzz
+{
+// Splits fuzzer input into a sequence of chunks, each prefixed with a 16-bit little-endian length.
+// This lets a single input describe a sequence of datagrams or partial stream reads.
+class ChunkReader
+{
+public:
+	ChunkReader(const uint8_t *data_, size_t size_)
+		: data(data_), size(size_)
+	{
+	}
+
+	bool next(const uint8_t *&chunk, size_t &chunk_size)
+	{
+		if (offset + sizeof(uint16_t) > size)
+			return false;
+
+		uint16_t len;
+		memcpy(&len, data + offset, sizeof(len));
+		offset += sizeof(len);
+
+		chunk = data + offset;
+		chunk_size = len < size - offset ? len : size - offset;
+		offset += chunk_size;
+		return true;
+	}
+
+private:
+	const uint8_t *data;
+	size_t size;
+	size_t offset = 0;
+};
+}
+}
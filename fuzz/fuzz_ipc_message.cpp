@@ -0,0 +1,90 @@
+/* Copyright (c) 2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Fuzzes decoding of IPC messages as received by the Dispatcher and Client.
+// The first byte selects how many file handles are attached to the message.
+
+#include "messages.hpp"
+#include <vector>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+using namespace PyroFling;
+
+static std::vector<FileHandle> create_dummy_fds(unsigned count)
+{
+	std::vector<FileHandle> fds;
+	for (unsigned i = 0; i < count; i++)
+		fds.emplace_back(eventfd(0, EFD_CLOEXEC));
+	return fds;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (size < 1)
+		return 0;
+
+	unsigned num_fds = data[0] & 3;
+	data++;
+	size--;
+
+	parse_message_buffer(data, size, create_dummy_fds(num_fds));
+
+	// Also go through the real socket path, which deals with SCM_RIGHTS and truncation.
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+		return 0;
+
+	FileHandle sender{sv[0]};
+	FileHandle receiver{sv[1]};
+
+	auto fds = create_dummy_fds(num_fds);
+	std::vector<int> native_fds;
+	for (auto &fd : fds)
+		native_fds.push_back(fd.get_native_handle());
+
+	iovec iov = {};
+	iov.iov_base = const_cast<uint8_t *>(data);
+	iov.iov_len = size;
+
+	alignas(struct cmsghdr) char cmsg_buf[CMSG_SPACE(sizeof(int) * 4)];
+	msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (num_fds)
+	{
+		msg.msg_control = cmsg_buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+		auto *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+		memcpy(CMSG_DATA(cmsg), native_fds.data(), sizeof(int) * num_fds);
+	}
+
+	if (::sendmsg(sender.get_native_handle(), &msg, MSG_NOSIGNAL | MSG_DONTWAIT) >= 0)
+		parse_message(receiver);
+
+	return 0;
+}
@@ -0,0 +1,53 @@
+/* Copyright (c) 2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Fuzzes packet reconstruction in PyroStreamClient, i.e. datagrams received from the server.
+// Each chunk is a datagram.
+
+#include "fuzz_common.hpp"
+#include "pyro_client.hpp"
+#include <memory>
+
+using namespace PyroFling;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	std::unique_ptr<PyroStreamClient> client{new PyroStreamClient};
+	// Negotiate audio redundancy, so redundant audio subpackets are reconstructed rather than ignored.
+	pyro_codec_parameters codec = {};
+	codec.audio_protection = PYRO_AUDIO_PROTECTION_REDUNDANCY;
+	client->set_offline_codec_parameters(codec);
+
+	Fuzz::ChunkReader reader{data, size};
+	const uint8_t *chunk;
+	size_t chunk_size;
+
+	// Keep feeding data after errors to reach deeper states.
+	while (reader.next(chunk, chunk_size))
+	{
+		client->process_datagram(chunk, chunk_size);
+		if (client->has_completed_packet())
+			client->release_completed_packet();
+	}
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+/* Copyright (c) 2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Fuzzes UDP datagrams received by the pyro server, i.e. PyroStreamServer::handle_udp_datagram().
+// Each chunk is a datagram. The first byte of a chunk selects which remote address sent it.
+// The connection has been kicked with all stream types, and is bound to the first remote address,
+// so that every message type is reachable.
+
+#include "fuzz_common.hpp"
+#include "pyro_server.hpp"
+#include "listener.hpp"
+#include <string>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+using namespace PyroFling;
+
+namespace
+{
+struct Context
+{
+	Context()
+		: socket_path("/tmp/pyrofling-fuzz-" + std::to_string(getpid()))
+		, dispatcher(socket_path.c_str(), nullptr)
+	{
+		for (unsigned i = 0; i < 2; i++)
+		{
+			sockaddr_in addr = {};
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons(uint16_t(9000 + i));
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			memcpy(&remotes[i].addr, &addr, sizeof(addr));
+			remotes[i].addr_size = sizeof(addr);
+		}
+
+		pyro_codec_parameters codec = {};
+		codec.video_codec = PYRO_VIDEO_CODEC_H264;
+		server.set_codec_parameters(codec);
+
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+			return;
+		server_fd = FileHandle{sv[0]};
+		client_fd = FileHandle{sv[1]};
+
+		Handler *handler = nullptr;
+		if (!server.register_tcp_handler(dispatcher, server_fd, remotes[0], handler))
+			return;
+
+		// The first connection is always given cookie 1001.
+		struct
+		{
+			pyro_message_type type;
+			uint64_t cookie;
+		} cookie_msg = { PYRO_MESSAGE_COOKIE, 1001 };
+		server.handle_udp_datagram(dispatcher, remotes[0], &cookie_msg, sizeof(cookie_msg));
+
+		struct
+		{
+			pyro_message_type type;
+			pyro_kick_state_flags flags;
+		} kick_msg = { PYRO_MESSAGE_KICK,
+		               PYRO_KICK_STATE_VIDEO_BIT | PYRO_KICK_STATE_AUDIO_BIT | PYRO_KICK_STATE_GAMEPAD_BIT };
+		if (::send(client_fd.get_native_handle(), &kick_msg, sizeof(kick_msg), MSG_NOSIGNAL) == sizeof(kick_msg))
+			handler->handle(server_fd, 0);
+	}
+
+	std::string socket_path;
+	Dispatcher dispatcher;
+	PyroStreamServer server;
+	RemoteAddress remotes[2];
+	FileHandle server_fd, client_fd;
+};
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	// Intentionally never destroyed, the dispatcher may still reference handlers at exit.
+	static Context &ctx = *new Context;
+
+	Fuzz::ChunkReader reader{data, size};
+	const uint8_t *chunk;
+	size_t chunk_size;
+
+	while (reader.next(chunk, chunk_size))
+	{
+		if (chunk_size == 0)
+			continue;
+		auto &remote = ctx.remotes[chunk[0] & 1];
+		ctx.server.handle_udp_datagram(ctx.dispatcher, remote, chunk + 1, unsigned(chunk_size - 1));
+	}
+
+	// Gamepad state is latched by the main loop normally.
+	ctx.server.get_updated_gamepad_state();
+	int phase_offset_us;
+	ctx.server.get_phase_offset_us(phase_offset_us);
+	ctx.server.should_force_idr();
+
+	return 0;
+}
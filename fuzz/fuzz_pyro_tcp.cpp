@@ -0,0 +1,116 @@
+/* Copyright (c) 2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Fuzzes the TCP control stream parser in PyroStreamConnection::handle().
+// Input is split into chunks, each chunk arriving as a separate read on the stream.
+
+#include "fuzz_common.hpp"
+#include "pyro_server.hpp"
+#include "listener.hpp"
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace PyroFling;
+
+namespace
+{
+// Always readable, so Dispatcher::iterate() never blocks and can be used to flush cancellations.
+struct NopHandler : Handler
+{
+	using Handler::Handler;
+	bool handle(const FileHandle &, uint32_t) override { return true; }
+	void release_id(uint32_t) override {}
+};
+
+struct Context
+{
+	Context()
+		: socket_path("/tmp/pyrofling-fuzz-" + std::to_string(getpid()))
+		, dispatcher(socket_path.c_str(), nullptr)
+		, nop(dispatcher)
+	{
+		FileHandle event{eventfd(1, EFD_CLOEXEC)};
+		dispatcher.add_connection(std::move(event), &nop, 0, Dispatcher::ConnectionType::Input);
+
+		pyro_codec_parameters codec = {};
+		codec.video_codec = PYRO_VIDEO_CODEC_H264;
+		server.set_codec_parameters(codec);
+	}
+
+	std::string socket_path;
+	Dispatcher dispatcher;
+	NopHandler nop;
+	PyroStreamServer server;
+};
+}
+
+static void drain(const FileHandle &fd)
+{
+	uint8_t buffer[4096];
+	while (::recv(fd.get_native_handle(), buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+		continue;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	// Intentionally never destroyed, the dispatcher may still reference handlers at exit.
+	static Context &ctx = *new Context;
+
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+		return 0;
+
+	FileHandle server_fd{sv[0]};
+	FileHandle client_fd{sv[1]};
+
+	RemoteAddress remote = {};
+	Handler *handler = nullptr;
+	if (!ctx.server.register_tcp_handler(ctx.dispatcher, server_fd, remote, handler))
+		return 0;
+
+	Fuzz::ChunkReader reader{data, size};
+	const uint8_t *chunk;
+	size_t chunk_size;
+
+	while (reader.next(chunk, chunk_size))
+	{
+		if (chunk_size == 0)
+			continue;
+		if (::send(client_fd.get_native_handle(), chunk, chunk_size, MSG_NOSIGNAL | MSG_DONTWAIT) <= 0)
+			break;
+		bool alive = handler->handle(server_fd, 0);
+		drain(client_fd);
+		if (!alive)
+			break;
+	}
+
+	// Tear down the same way the dispatcher would on hangup.
+	ctx.dispatcher.cancel_connection(handler, 1);
+	handler->release_id(0);
+	ctx.dispatcher.iterate();
+
+	return 0;
+}
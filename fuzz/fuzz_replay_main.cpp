@@ -0,0 +1,99 @@
+/* Copyright (c) 2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Replays a corpus through a fuzz target without libFuzzer.
+// Arguments can be files or directories of files, e.g. a libFuzzer corpus or crash artifacts.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <dirent.h>
+#include <sys/stat.h>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static bool replay_file(const std::string &path)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
+	{
+		fprintf(stderr, "Failed to open %s.\n", path.c_str());
+		return false;
+	}
+
+	std::vector<uint8_t> buffer;
+	uint8_t block[64 * 1024];
+	size_t ret;
+	while ((ret = fread(block, 1, sizeof(block), file)) != 0)
+		buffer.insert(buffer.end(), block, block + ret);
+	fclose(file);
+
+	LLVMFuzzerTestOneInput(buffer.data(), buffer.size());
+	return true;
+}
+
+static unsigned replay_path(const std::string &path)
+{
+	struct stat s = {};
+	if (stat(path.c_str(), &s) < 0)
+	{
+		fprintf(stderr, "Failed to stat %s.\n", path.c_str());
+		return 0;
+	}
+
+	if (!S_ISDIR(s.st_mode))
+		return replay_file(path) ? 1 : 0;
+
+	DIR *dir = opendir(path.c_str());
+	if (!dir)
+		return 0;
+
+	unsigned count = 0;
+	while (auto *entry = readdir(dir))
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+		count += replay_path(path + "/" + entry->d_name);
+	}
+
+	closedir(dir);
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <file or directory>...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	unsigned count = 0;
+	for (int i = 1; i < argc; i++)
+		count += replay_path(argv[i]);
+
+	fprintf(stderr, "Replayed %u inputs.\n", count);
+	return EXIT_SUCCESS;
+}
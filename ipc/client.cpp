@@ -24,8 +24,15 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 #include <stdexcept>
+#include <algorithm>
+#include <chrono>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
 
 namespace PyroFling
@@ -49,6 +56,27 @@ Client::Client(const char *name)
 	{
 		throw std::runtime_error("Failed to connect.");
 	}
+
+	wake_fd = FileHandle(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+	shutdown_fd = FileHandle(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+	if (!wake_fd || !shutdown_fd)
+		throw std::runtime_error("Failed to create eventfd.");
+
+	// The reader thread should never steal signals from the application.
+	sigset_t mask, old_mask;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+	reader = std::thread(&Client::reader_loop, this);
+	pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+}
+
+Client::~Client()
+{
+	const uint64_t count = 1;
+	if (::write(shutdown_fd.get_native_handle(), &count, sizeof(count)) < 0)
+		fprintf(stderr, "Failed to signal eventfd.\n");
+	if (reader.joinable())
+		reader.join();
 }
 
 const FileHandle &Client::get_file_handle() const
@@ -59,7 +87,39 @@ const FileHandle &Client::get_file_handle() const
 void Client::set_serial_handler(uint64_t serial, SerialHandler func)
 {
 	assert(serial != 0);
-	handlers[serial] = std::move(func);
+	auto &slot = handler_slots[serial % NumHandlerSlots];
+
+	// Slots holding handlers for serials which have already been replied to can be recycled.
+	if (slot.serial == 0 || slot.serial == serial || slot.serial <= received_replies)
+	{
+		slot.serial = serial;
+		slot.func = std::move(func);
+	}
+	else
+		overflow_handlers[serial] = std::move(func);
+}
+
+bool Client::take_serial_handler(uint64_t serial, SerialHandler &func)
+{
+	auto &slot = handler_slots[serial % NumHandlerSlots];
+	if (slot.serial == serial)
+	{
+		func = std::move(slot.func);
+		slot.func = {};
+		slot.serial = 0;
+		return true;
+	}
+
+	if (overflow_handlers.empty())
+		return false;
+
+	auto itr = overflow_handlers.find(serial);
+	if (itr == overflow_handlers.end())
+		return false;
+
+	func = std::move(itr->second);
+	overflow_handlers.erase(itr);
+	return true;
 }
 
 void Client::set_default_serial_handler(SerialHandler func)
@@ -72,113 +132,311 @@ void Client::set_event_handler(SerialHandler func)
 	event_handler = std::move(func);
 }
 
+bool Client::flush_pending_writes_locked()
+{
+	while (!write_queue.empty())
+	{
+		auto &write = write_queue.front();
+		auto ret = try_send_message(fd, write.type, write.serial,
+		                            write.payload.data(), write.payload.size(),
+		                            write.fds.data(), write.fds.size());
+
+		if (ret == SendResult::WouldBlock)
+			break;
+
+		if (ret == SendResult::Error)
+		{
+			fprintf(stderr, "Failed to flush queued message.\n");
+			write_error = true;
+			write_queue.clear();
+			break;
+		}
+
+		write_queue.pop_front();
+	}
+
+	return !write_error;
+}
+
+bool Client::flush_pending_writes()
+{
+	std::lock_guard<std::mutex> holder{write_lock};
+	return flush_pending_writes_locked();
+}
+
+bool Client::has_pending_writes()
+{
+	std::lock_guard<std::mutex> holder{write_lock};
+	return !write_queue.empty();
+}
+
+size_t Client::get_pending_write_count()
+{
+	std::lock_guard<std::mutex> holder{write_lock};
+	return write_queue.size();
+}
+
+bool Client::is_congested()
+{
+	return has_pending_writes();
+}
+
 uint64_t Client::send_message_raw(MessageType type, const void *payload, size_t payload_size,
                                   const FileHandle *fling_fds, size_t fling_fds_count)
 {
-	struct pollfd pfd = {};
-	pfd.fd = fd.get_native_handle();
-	pfd.events = POLLOUT;
+	if (payload_size > MaxMessagePayloadSize || fling_fds_count > MaxMessageFileHandles)
+		return 0;
+
+	std::lock_guard<std::mutex> holder{write_lock};
+
+	// Anything already queued must go out first to keep serials in order.
+	if (!flush_pending_writes_locked())
+		return 0;
+
+	uint64_t serial = send_serial + 1;
 
-	if (::poll(&pfd, 1, 1000) <= 0 || (pfd.revents & POLLOUT) == 0)
+	if (write_queue.empty())
+	{
+		auto ret = try_send_message(fd, type, serial, payload, payload_size, fling_fds, fling_fds_count);
+		if (ret == SendResult::OK)
+		{
+			send_serial = serial;
+			return serial;
+		}
+		else if (ret == SendResult::Error)
+		{
+			write_error = true;
+			return 0;
+		}
+	}
+
+	// Never block the caller. Whoever is polling the connection will flush this later.
+	if (write_queue.size() >= MaxPendingWrites)
 	{
 		fprintf(stderr, "Connection is congested, server is likely hung.\n");
 		return 0;
 	}
 
-	if (send_message(fd, type, send_serial + 1, payload, payload_size, fling_fds, fling_fds_count))
+	PendingWrite write;
+	write.type = type;
+	write.serial = serial;
+	if (payload_size)
 	{
-		send_serial += 1;
-		return send_serial;
+		auto *bytes = static_cast<const uint8_t *>(payload);
+		write.payload.assign(bytes, bytes + payload_size);
 	}
-	else
-		return 0;
+
+	write.fds.reserve(fling_fds_count);
+	for (size_t i = 0; i < fling_fds_count; i++)
+	{
+		write.fds.push_back(fling_fds[i].dup());
+		if (!write.fds.back())
+			return 0;
+	}
+
+	write_queue.push_back(std::move(write));
+	send_serial = serial;
+
+	// If a thread is blocking in wait_reply(), make sure it starts polling for POLLOUT.
+	if (write_queue.size() == 1)
+	{
+		const uint64_t count = 1;
+		if (::write(wake_fd.get_native_handle(), &count, sizeof(count)) < 0)
+			fprintf(stderr, "Failed to signal eventfd.\n");
+	}
+
+	return serial;
 }
 
-int Client::wait_reply(std::unique_lock<std::mutex> &lock, int timeout_ms)
+void Client::signal_waiters_locked(uint64_t serial)
 {
-	uint64_t current_count = process_count;
-	bool self_is_socket_master = false;
+	const uint64_t count = 1;
+	for (auto *waiter : waiters)
+	{
+		if (waiter->serial == 0 || (serial != 0 && waiter->serial <= serial))
+			if (::write(waiter->event.get_native_handle(), &count, sizeof(count)) < 0)
+				fprintf(stderr, "Failed to signal eventfd.\n");
+	}
+}
 
-	while (current_count == process_count && !socket_master_error && !self_is_socket_master)
+bool Client::reader_iteration()
+{
+	struct pollfd pfds[3] = {};
+	pfds[0].fd = fd.get_native_handle();
+	pfds[0].events = POLLIN;
+	if (has_pending_writes())
+		pfds[0].events |= POLLOUT;
+	pfds[1].fd = wake_fd.get_native_handle();
+	pfds[1].events = POLLIN;
+	pfds[2].fd = shutdown_fd.get_native_handle();
+	pfds[2].events = POLLIN;
+
+	if (::poll(pfds, 3, -1) < 0)
+		return errno == EINTR;
+
+	if ((pfds[2].revents & POLLIN) != 0)
+		return false;
+
+	if ((pfds[1].revents & POLLIN) != 0)
 	{
-		if (!has_socket_master)
-		{
-			self_is_socket_master = true;
-			has_socket_master = true;
-			struct pollfd pfd = {};
-			int ret;
-			lock.unlock();
-			{
-				pfd.fd = fd.get_native_handle();
-				pfd.events = POLLIN;
+		uint64_t count;
+		if (::read(wake_fd.get_native_handle(), &count, sizeof(count)) < 0 && errno != EAGAIN)
+			return false;
+	}
 
-				// While blocking, we don't want to hold the mutex.
-				// Any new thread that takes the lock will observe that we have a bus master, and it will defer itself
-				// to the condition variable path.
-				ret = ::poll(&pfd, 1, timeout_ms);
-			}
-			lock.lock();
+	if ((pfds[0].revents & POLLOUT) != 0 && !flush_pending_writes())
+		return false;
 
-			if (ret < 0)
-				socket_master_error = true;
+	if ((pfds[0].revents & POLLIN) != 0)
+	{
+		auto msg = parse_message(fd);
+		if (!msg)
+			return false;
 
-			if (ret <= 0 || (pfd.revents & POLLIN) == 0)
-				break;
+		uint64_t serial = msg->get_serial();
+		std::lock_guard<std::mutex> holder{inbox_lock};
+		inbox.push_back(std::move(msg));
+		signal_waiters_locked(serial);
+	}
+	else if ((pfds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) != 0)
+		return false;
 
-			ret = process() ? 1 : -1;
-			if (ret == 1)
-				process_count++;
-			else
-				socket_master_error = true;
+	return true;
+}
+
+void Client::reader_loop()
+{
+	while (reader_iteration())
+	{
+	}
+
+	// Either the connection failed or we're shutting down. Either way, nothing more will arrive.
+	std::lock_guard<std::mutex> holder{inbox_lock};
+	reader_error = true;
+	signal_waiters_locked(UINT64_MAX);
+}
+
+int Client::dispatch_received()
+{
+	while (!dispatch_error)
+	{
+		std::unique_ptr<Message> msg;
+		{
+			std::lock_guard<std::mutex> holder{inbox_lock};
+			if (inbox.empty())
+				return reader_error ? -1 : 0;
+			msg = std::move(inbox.front());
+			inbox.pop_front();
 		}
+
+		if (process(*msg))
+			process_count++;
 		else
+			dispatch_error = true;
+	}
+
+	return -1;
+}
+
+int Client::wait_internal(std::unique_lock<std::mutex> &lock, int timeout_ms, uint64_t serial)
+{
+	uint64_t current_count = process_count;
+	auto start_time = std::chrono::steady_clock::now();
+
+	for (;;)
+	{
+		int ret = dispatch_received();
+		if (current_count != process_count)
+			return 1;
+		else if (ret < 0)
+			return -1;
+
+		int remaining_ms = timeout_ms;
+		if (timeout_ms > 0)
+		{
+			auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+					std::chrono::steady_clock::now() - start_time).count();
+			remaining_ms = elapsed_ms >= timeout_ms ? 0 : int(timeout_ms - elapsed_ms);
+		}
+
+		if (remaining_ms == 0)
+			return 0;
+
+		Waiter waiter;
+		waiter.serial = serial;
+
 		{
-			if (timeout_ms >= 0)
+			std::lock_guard<std::mutex> holder{inbox_lock};
+
+			// Registering under the inbox lock guarantees we cannot miss a wakeup.
+			if (!inbox.empty() || reader_error)
+				continue;
+
+			if (waiter_event_pool.empty())
 			{
-				if (read_cond.wait_for(lock, std::chrono::milliseconds(timeout_ms)) == std::cv_status::timeout)
-					break;
+				waiter.event = FileHandle(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+				if (!waiter.event)
+					return -1;
 			}
 			else
-				read_cond.wait(lock);
+			{
+				waiter.event = std::move(waiter_event_pool.back());
+				waiter_event_pool.pop_back();
+			}
+
+			waiters.push_back(&waiter);
 		}
-	}
 
-	int ret;
-	if (current_count != process_count)
-		ret = 1;
-	else if (socket_master_error)
-		ret = -1;
-	else
-		ret = 0;
+		struct pollfd pfd = {};
+		pfd.fd = waiter.event.get_native_handle();
+		pfd.events = POLLIN;
 
-	if (self_is_socket_master)
-	{
-		// Wake up a new thread to become bus master.
-		has_socket_master = false;
+		// While blocking, we don't want to hold the mutex.
+		lock.unlock();
+		int poll_ret = ::poll(&pfd, 1, remaining_ms);
+		lock.lock();
 
-		if (ret != 0)
-			read_cond.notify_all();
-		else
-			read_cond.notify_one();
+		{
+			std::lock_guard<std::mutex> holder{inbox_lock};
+			auto itr = std::find(waiters.begin(), waiters.end(), &waiter);
+			assert(itr != waiters.end());
+			*itr = waiters.back();
+			waiters.pop_back();
+
+			uint64_t count;
+			if (::read(waiter.event.get_native_handle(), &count, sizeof(count)) < 0 && errno != EAGAIN)
+				poll_ret = -1;
+
+			if (poll_ret >= 0)
+				waiter_event_pool.push_back(std::move(waiter.event));
+		}
+
+		if (poll_ret < 0 && errno != EINTR)
+			return -1;
 	}
+}
 
-	return ret;
+int Client::wait_reply(std::unique_lock<std::mutex> &lock, int timeout_ms)
+{
+	return wait_internal(lock, timeout_ms, 0);
 }
 
 bool Client::roundtrip(std::unique_lock<std::mutex> &lock)
 {
-	while (received_replies < send_serial)
-		if (wait_reply(lock) <= 0)
-			return false;
+	uint64_t serial;
+	{
+		std::lock_guard<std::mutex> holder{write_lock};
+		serial = send_serial;
+	}
 
-	return true;
+	return wait_reply_for_serial(lock, serial);
 }
 
 bool Client::wait_reply_for_serial(std::unique_lock<std::mutex> &lock, uint64_t serial)
 {
 	while (received_replies < serial)
 	{
-		if (wait_reply(lock) <= 0)
+		if (wait_internal(lock, -1, serial) <= 0)
 			return false;
 	}
 
@@ -201,52 +459,47 @@ MessageType Client::wait_plain_reply_for_serial(std::unique_lock<std::mutex> &lo
 	return type;
 }
 
-bool Client::process()
+bool Client::process(Message &msg)
 {
-	auto msg = parse_message(fd);
-	if (!msg)
-		return false;
-
 	// Serial 0 is for out of band async events that server will notify us out of band.
-	if (msg->get_serial() == 0)
+	if (msg.get_serial() == 0)
 	{
-		if ((uint32_t(msg->get_type()) & MessageEventFlag) == 0)
+		if ((uint32_t(msg.get_type()) & MessageEventFlag) == 0)
 		{
-			fprintf(stderr, "Unexpected message type #%x, event flag not set.\n", uint32_t(msg->get_type()));
+			fprintf(stderr, "Unexpected message type #%x, event flag not set.\n", uint32_t(msg.get_type()));
 			return false;
 		}
 
-		if (event_handler && !event_handler(*msg))
+		if (event_handler && !event_handler(msg))
 			return false;
 
 		return true;
 	}
 
-	if ((uint32_t(msg->get_type()) & MessageEventFlag) != 0)
+	if ((uint32_t(msg.get_type()) & MessageEventFlag) != 0)
 	{
-		fprintf(stderr, "Unexpected message type #%x, event flag is unexpectedly set.\n", uint32_t(msg->get_type()));
+		fprintf(stderr, "Unexpected message type #%x, event flag is unexpectedly set.\n", uint32_t(msg.get_type()));
 		return false;
 	}
 
 	// Otherwise, serial values must be replied in order, effectively RPC.
 
 	received_replies++;
-	if (msg->get_serial() != received_replies)
+	if (msg.get_serial() != received_replies)
 	{
 		fprintf(stderr, "Unexpected serial, expected %llu, got %llu.\n",
 		        static_cast<unsigned long long>(received_replies),
-		        static_cast<unsigned long long>(msg->get_serial()));
+		        static_cast<unsigned long long>(msg.get_serial()));
 		return false;
 	}
 
-	auto itr = handlers.find(msg->get_serial());
-	if (itr != handlers.end())
+	SerialHandler func;
+	if (take_serial_handler(msg.get_serial(), func))
 	{
-		if (itr->second && !itr->second(*msg))
+		if (func && !func(msg))
 			return false;
-		handlers.erase(itr);
 	}
-	else if (default_handler && !default_handler(*msg))
+	else if (default_handler && !default_handler(msg))
 		return false;
 
 	return true;
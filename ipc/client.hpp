@@ -29,7 +29,9 @@
 #include <functional>
 #include <unordered_map>
 #include <mutex>
-#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
 
 namespace PyroFling
 {
@@ -39,7 +41,14 @@ class Client
 {
 public:
 	explicit Client(const char *name);
+	~Client();
 
+	Client(const Client &) = delete;
+	void operator=(const Client &) = delete;
+
+	// Sending never blocks. If the socket is full, the message is queued and flushed
+	// opportunistically by later sends and the reader thread.
+	// If the queue is full, the connection is considered congested and 0 is returned.
 	uint64_t send_message_raw(MessageType type, const void *payload, size_t payload_size,
 	                          const FileHandle *fling_fds = nullptr, size_t fling_fds_count = 0);
 
@@ -62,8 +71,14 @@ public:
 
 	const FileHandle &get_file_handle() const;
 
-	// Cooperative reading of connection and event handling.
+	// Backpressure. Messages which could not be written to the socket yet.
+	size_t get_pending_write_count();
+	bool is_congested();
+	enum { MaxPendingWrites = 64 };
+
+	// A dedicated reader thread receives messages, but handlers are only called from these functions.
 	// Any thread calling these may call serial handlers and event handlers.
+	// All callers must use the same lock, which is held while handlers are called.
 	bool roundtrip(std::unique_lock<std::mutex> &lock);
 	int wait_reply(std::unique_lock<std::mutex> &lock, int timeout_ms = -1);
 	bool wait_reply_for_serial(std::unique_lock<std::mutex> &lock, uint64_t serial);
@@ -71,17 +86,67 @@ public:
 
 private:
 	FileHandle fd;
+	FileHandle wake_fd;
 	uint64_t send_serial = 0;
+
+	struct PendingWrite
+	{
+		MessageType type;
+		uint64_t serial;
+		std::vector<uint8_t> payload;
+		std::vector<FileHandle> fds;
+	};
+
+	// Guards send_serial and the write queue. Sending may happen concurrently with wait_reply().
+	std::mutex write_lock;
+	std::deque<PendingWrite> write_queue;
+	bool write_error = false;
+	bool flush_pending_writes_locked();
+	bool flush_pending_writes();
+	bool has_pending_writes();
+
+	// Everything below is guarded by the user lock passed to wait_reply().
 	uint64_t received_replies = 0;
-	std::unordered_map<uint64_t, SerialHandler> handlers;
+	uint64_t process_count = 0;
+	bool dispatch_error = false;
 	SerialHandler default_handler;
 	SerialHandler event_handler;
 
-	bool process();
+	// Serials are replied to in order, so a small direct-mapped table covers all in-flight requests.
+	// Colliding serials fall back to a hash map.
+	enum { NumHandlerSlots = 64 };
+	struct HandlerSlot
+	{
+		uint64_t serial = 0;
+		SerialHandler func;
+	};
+	HandlerSlot handler_slots[NumHandlerSlots];
+	std::unordered_map<uint64_t, SerialHandler> overflow_handlers;
+	bool take_serial_handler(uint64_t serial, SerialHandler &func);
 
-	std::condition_variable read_cond;
-	bool has_socket_master = false;
-	bool socket_master_error = false;
-	uint64_t process_count = 0;
+	bool process(Message &msg);
+	int dispatch_received();
+	int wait_internal(std::unique_lock<std::mutex> &lock, int timeout_ms, uint64_t serial);
+
+	// Every waiter sleeps on its own eventfd, so the reader only wakes up threads which care about a message.
+	// A waiter with serial 0 is woken up by any message.
+	struct Waiter
+	{
+		FileHandle event;
+		uint64_t serial;
+	};
+
+	// Guards everything the reader thread touches.
+	std::mutex inbox_lock;
+	std::deque<std::unique_ptr<Message>> inbox;
+	std::vector<Waiter *> waiters;
+	std::vector<FileHandle> waiter_event_pool;
+	bool reader_error = false;
+
+	FileHandle shutdown_fd;
+	std::thread reader;
+	void reader_loop();
+	bool reader_iteration();
+	void signal_waiters_locked(uint64_t serial);
 };
 }
\ No newline at end of file
@@ -0,0 +1,346 @@
+/* Copyright (c) 2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "client.hpp"
+#include "listener.hpp"
+#include "slot_map.hpp"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace PyroFling;
+
+// Churns many short-lived connections through the dispatcher.
+// Every handler owns a main connection (id 0) and an auxiliary eventfd (id 1).
+// When the main connection hangs up, the handler cancels its auxiliary connection,
+// and is deleted once both IDs have been released.
+
+static std::atomic_uint released_ids;
+static std::atomic_uint live_handlers;
+
+struct TestServer : HandlerFactoryInterface
+{
+	struct TestHandler : Handler
+	{
+		explicit TestHandler(Dispatcher &dispatcher_)
+			: Handler(dispatcher_)
+		{
+			live_handlers++;
+		}
+
+		~TestHandler() override
+		{
+			live_handlers--;
+		}
+
+		bool handle(const FileHandle &fd, uint32_t id) override
+		{
+			if (id != 0)
+				return true;
+
+			auto msg = parse_message(fd);
+			if (!msg)
+				return false;
+			return send_message(fd, MessageType::OK, msg->get_serial());
+		}
+
+		void release_id(uint32_t id) override
+		{
+			released_ids++;
+			if (id == 0)
+				dispatcher.cancel_connection(this, 1);
+			if (--active_ids == 0)
+				delete this;
+		}
+
+		unsigned active_ids = 1;
+	};
+
+	bool register_handler(Dispatcher &dispatcher, const FileHandle &fd, Handler *&handler) override
+	{
+		auto msg = parse_message(fd);
+		if (!msg)
+			return false;
+
+		if (!maybe_get<ClientHelloMessage>(*msg))
+			return false;
+
+		ServerHelloMessage::WireFormat hello = {};
+		if (!send_wire_message(fd, msg->get_serial(), hello))
+			return false;
+
+		auto *test_handler = new TestHandler{dispatcher};
+		if (dispatcher.add_connection(FileHandle{eventfd(0, EFD_CLOEXEC)}, test_handler, 1,
+		                              Dispatcher::ConnectionType::Input))
+		{
+			test_handler->active_ids++;
+		}
+
+		handler = test_handler;
+		return true;
+	}
+
+	bool register_tcp_handler(Dispatcher &, const FileHandle &, const RemoteAddress &,
+	                          Handler *&) override
+	{
+		return false;
+	}
+
+	void handle_udp_datagram(Dispatcher &, const RemoteAddress &, const void *, unsigned) override
+	{
+	}
+};
+
+static bool test_slot_map()
+{
+	struct Value
+	{
+		unsigned v;
+	};
+
+	SlotMap<Value> map;
+	std::vector<SlotMap<Value>::Handle> handles;
+
+	for (unsigned iter = 0; iter < 64; iter++)
+	{
+		for (unsigned i = 0; i < 1000; i++)
+			handles.push_back(map.insert(std::unique_ptr<Value>(new Value{i})));
+
+		// Remove every other handle, and make sure stale handles are rejected.
+		for (size_t i = 0; i < handles.size(); i += 2)
+		{
+			if (!map.remove(handles[i]))
+				return false;
+			if (map.get(handles[i]) || map.remove(handles[i]))
+				return false;
+		}
+
+		for (size_t i = 1; i < handles.size(); i += 2)
+		{
+			if (!map.get(handles[i]))
+				return false;
+			map.remove(handles[i]);
+		}
+
+		handles.clear();
+		if (map.size() != 0)
+			return false;
+	}
+
+	// Sentinel handles must never alias a live slot.
+	map.insert(std::unique_ptr<Value>(new Value{0}));
+	if (map.get(SlotMap<Value>::make_sentinel_handle(0)))
+		return false;
+
+	return true;
+}
+
+// A server which stops reading must never stall the client. Messages are queued instead,
+// and are flushed in order once the server starts reading again.
+static bool test_client_backpressure()
+{
+	const char *path = "/tmp/pyrofling-backpressure-test-socket";
+	unlink(path);
+
+	FileHandle listener{socket(AF_UNIX, SOCK_SEQPACKET, 0)};
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (bind(listener.get_native_handle(), reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0 ||
+	    listen(listener.get_native_handle(), 1) < 0)
+	{
+		fprintf(stderr, "Failed to create listener.\n");
+		return false;
+	}
+
+	Client client{path};
+	FileHandle server{accept(listener.get_native_handle(), nullptr, nullptr)};
+	unlink(path);
+	if (!server)
+		return false;
+
+	ClientHelloMessage::WireFormat hello = {};
+	hello.intent = ClientIntent::EchoStream;
+
+	auto start_time = std::chrono::steady_clock::now();
+	uint64_t last_serial = 0;
+	uint64_t serial;
+	while ((serial = client.send_wire_message(hello)) != 0)
+		last_serial = serial;
+	auto end_time = std::chrono::steady_clock::now();
+
+	auto stall_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
+	fprintf(stderr, "Sent %llu messages until congested, %u pending, %d ms.\n",
+	        static_cast<unsigned long long>(last_serial),
+	        unsigned(client.get_pending_write_count()), int(stall_ms));
+
+	if (!client.is_congested() || client.get_pending_write_count() != Client::MaxPendingWrites || stall_ms > 500)
+		return false;
+
+	bool in_order = true;
+	std::thread reader{[&]() {
+		for (uint64_t expected = 1; expected <= last_serial; expected++)
+		{
+			auto msg = parse_message(server);
+			if (!msg || msg->get_serial() != expected)
+			{
+				in_order = false;
+				break;
+			}
+		}
+	}};
+
+	std::mutex lock;
+	std::unique_lock<std::mutex> holder{lock};
+	while (client.get_pending_write_count() != 0)
+		if (client.wait_reply(holder, 10) < 0)
+			break;
+
+	reader.join();
+	return in_order && client.get_pending_write_count() == 0;
+}
+
+int main()
+{
+	if (!test_slot_map())
+	{
+		fprintf(stderr, "SlotMap test failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!test_client_backpressure())
+	{
+		fprintf(stderr, "Client backpressure test failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	const char *path = "/tmp/pyrofling-dispatcher-test-socket";
+	TestServer server;
+	Dispatcher dispatcher{path, nullptr};
+	dispatcher.set_handler_factory_interface(&server);
+
+	std::thread thr{[&]() {
+		while (dispatcher.iterate()) {}
+	}};
+
+	constexpr unsigned NumRounds = 100;
+	constexpr unsigned NumClientsPerRound = 50;
+	auto start_time = std::chrono::steady_clock::now();
+
+	for (unsigned round = 0; round < NumRounds; round++)
+	{
+		std::vector<std::unique_ptr<Client>> clients;
+		std::mutex lock;
+		std::unique_lock<std::mutex> holder{lock};
+
+		for (unsigned i = 0; i < NumClientsPerRound; i++)
+		{
+			clients.emplace_back(new Client{path});
+
+			ClientHelloMessage::WireFormat hello = {};
+			hello.intent = ClientIntent::EchoStream;
+			strncpy(hello.name, "DispatcherTest", sizeof(hello.name));
+			uint64_t serial = clients.back()->send_wire_message(hello);
+			if (clients.back()->wait_plain_reply_for_serial(holder, serial) != MessageType::ServerHello)
+			{
+				fprintf(stderr, "Failed to receive server hello.\n");
+				return EXIT_FAILURE;
+			}
+		}
+
+		// Hang up in scrambled order so removals hit arbitrary slots.
+		for (unsigned i = 0; i < NumClientsPerRound; i++)
+			std::swap(clients[i], clients[(i * 7 + round) % NumClientsPerRound]);
+		clients.clear();
+	}
+
+	// Several threads waiting on the same client must all see their own replies.
+	{
+		Client client{path};
+		std::mutex lock;
+		std::atomic_bool failed{false};
+		std::vector<std::thread> threads;
+
+		{
+			std::unique_lock<std::mutex> holder{lock};
+			ClientHelloMessage::WireFormat hello = {};
+			hello.intent = ClientIntent::EchoStream;
+			if (client.wait_plain_reply_for_serial(holder, client.send_wire_message(hello)) != MessageType::ServerHello)
+			{
+				fprintf(stderr, "Failed to receive server hello.\n");
+				return EXIT_FAILURE;
+			}
+		}
+
+		for (unsigned i = 0; i < 4; i++)
+		{
+			threads.emplace_back([&]() {
+				std::unique_lock<std::mutex> holder{lock};
+				for (unsigned j = 0; j < 500 && !failed; j++)
+				{
+					FileHandle dummy{eventfd(0, EFD_CLOEXEC)};
+					uint64_t serial = client.send_file_handle_message(MessageType::EchoPayload, dummy);
+					if (client.wait_plain_reply_for_serial(holder, serial) != MessageType::OK)
+						failed = true;
+				}
+			});
+		}
+
+		for (auto &t : threads)
+			t.join();
+
+		if (failed)
+		{
+			fprintf(stderr, "Concurrent waiters did not receive their replies.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	constexpr unsigned ExpectedReleases = (NumRounds * NumClientsPerRound + 1) * 2;
+	for (unsigned i = 0; i < 1000 && released_ids.load() != ExpectedReleases; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	auto end_time = std::chrono::steady_clock::now();
+
+	dispatcher.kill();
+	thr.join();
+
+	fprintf(stderr, "Released %u / %u IDs, %u live handlers, %.3f s.\n",
+	        released_ids.load(), ExpectedReleases, live_handlers.load(),
+	        std::chrono::duration<double>(end_time - start_time).count());
+
+	if (released_ids.load() != ExpectedReleases || live_handlers.load() != 0)
+	{
+		fprintf(stderr, "Dispatcher leaked connections.\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
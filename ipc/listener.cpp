@@ -176,22 +176,56 @@ void Dispatcher::set_handler_factory_interface(HandlerFactoryInterface *iface_)
 	iface = iface_;
 }
 
-void Dispatcher::cancel_connection(Handler *handler, uint32_t id)
+void Dispatcher::bind_handler(Connection &conn)
+{
+	if (conn.handler)
+		handler_to_connection[{ conn.handler, conn.id }] = conn.handle;
+}
+
+std::unique_ptr<Dispatcher::Connection> Dispatcher::remove_connection(ConnectionMap::Handle handle)
+{
+	auto conn = connections.remove(handle);
+	if (conn && conn->handler)
+	{
+		auto itr = handler_to_connection.find({ conn->handler, conn->id });
+		if (itr != handler_to_connection.end() && itr->second == handle)
+			handler_to_connection.erase(itr);
+	}
+	return conn;
+}
+
+bool Dispatcher::register_connection(std::unique_ptr<Connection> conn, uint32_t events)
 {
-	auto itr = std::find_if(connections.begin(), connections.end(), [handler, id](const std::unique_ptr<Connection> &conn) {
-		return handler == conn->handler && id == conn->id;
-	});
+	auto *c = conn.get();
+	c->handle = connections.insert(std::move(conn));
+
+	struct epoll_event ev = {};
+	ev.data.u64 = c->handle;
+	ev.events = events;
 
-	if (itr != connections.end())
+	if (epoll_ctl(pollfd.get_native_handle(), EPOLL_CTL_ADD, c->fd.get_native_handle(), &ev) == 0)
 	{
-		cancellations.push_back(std::move(*itr));
-		auto &last_elem = connections.back();
-		if (&last_elem != &*itr)
-			last_elem.swap(*itr);
-		connections.pop_back();
+		bind_handler(*c);
+		return true;
+	}
+	else
+	{
+		connections.remove(c->handle);
+		return false;
 	}
 }
 
+void Dispatcher::cancel_connection(Handler *handler, uint32_t id)
+{
+	auto itr = handler_to_connection.find({ handler, id });
+	if (itr == handler_to_connection.end())
+		return;
+
+	auto conn = remove_connection(itr->second);
+	if (conn)
+		cancellations.push_back(std::move(conn));
+}
+
 bool Dispatcher::add_connection(FileHandle fd, Handler *handler, uint32_t id, ConnectionType type)
 {
 	auto c = std::make_unique<Connection>();
@@ -199,22 +233,13 @@ bool Dispatcher::add_connection(FileHandle fd, Handler *handler, uint32_t id, Co
 	c->id = id;
 	c->handler = handler;
 
-	struct epoll_event ev = {};
-	ev.data.ptr = c.get();
-
+	uint32_t events = 0;
 	if (type != ConnectionType::Output)
-		ev.events |= EPOLLIN;
+		events |= EPOLLIN;
 	if (type != ConnectionType::Input)
-		ev.events |= EPOLLOUT;
+		events |= EPOLLOUT;
 
-	if (epoll_ctl(pollfd.get_native_handle(), EPOLL_CTL_ADD,
-	              c->fd.get_native_handle(), &ev) == 0)
-	{
-		connections.push_back(std::move(c));
-		return true;
-	}
-	else
-		return false;
+	return register_connection(std::move(c), events);
 }
 
 bool Dispatcher::iterate()
@@ -225,6 +250,7 @@ bool Dispatcher::iterate()
 	{
 		// Drop all connections immediately.
 		pollfd = {};
+		handler_to_connection.clear();
 		connections.clear();
 		cancellations.clear();
 	}
@@ -260,41 +286,47 @@ int Dispatcher::write_udp_datagrams(
 	msg.msg_name = const_cast<sockaddr_storage *>(&addr.addr);
 	msg.msg_namelen = addr.addr_size;
 
-	constexpr size_t StaticSubPackets = 1024;
-	mmsghdr mmsghdr_static[StaticSubPackets];
-	iovec iov_static[StaticSubPackets * 2];
-
-	std::vector<mmsghdr> mmsghdr_dynamic;
-	std::vector<iovec> iov_dynamic;
+	// sendmmsg does not take more than UIO_MAXIOV messages at a time, so large packets are sent in batches.
+	constexpr unsigned MaxSubPackets = 1024;
+	mmsghdr mmsgs[MaxSubPackets];
+	iovec iovs[MaxSubPackets * 2];
 
-	// Fallback to dynamically allocated as needed.
-	mmsghdr *mmgs = mmsghdr_static;
-	iovec *iovs = iov_static;
+	auto *header_bytes = static_cast<const uint8_t *>(headers);
+	int total_sent = 0;
 
-	if (num_sub_packets > StaticSubPackets)
+	while (num_sub_packets)
 	{
-		iov_dynamic.resize(num_sub_packets * 2);
-		mmsghdr_dynamic.resize(num_sub_packets);
+		unsigned count = std::min(num_sub_packets, MaxSubPackets);
 
-		iovs = iov_dynamic.data();
-		mmgs = mmsghdr_dynamic.data();
-	}
+		for (unsigned i = 0; i < count; i++)
+		{
+			mmsgs[i].msg_hdr = msg;
+			mmsgs[i].msg_len = 0;
 
-	for (unsigned i = 0; i < num_sub_packets; i++, iovs += 2)
-	{
-		mmgs[i].msg_hdr = msg;
-		mmgs[i].msg_len = 0;
+			iovs[2 * i + 0].iov_base = const_cast<uint8_t *>(header_bytes + header_size * i);
+			iovs[2 * i + 0].iov_len = header_size;
+			iovs[2 * i + 1].iov_base = const_cast<void *>(data[i]);
+			iovs[2 * i + 1].iov_len = sizes[i];
+
+			mmsgs[i].msg_hdr.msg_iov = &iovs[2 * i];
+			mmsgs[i].msg_hdr.msg_iovlen = 2;
+		}
+
+		int ret = int(::sendmmsg(udp_listener.get_file_handle().get_native_handle(), mmsgs, count, 0));
+		if (ret < 0)
+			return total_sent ? total_sent : ret;
 
-		iovs[0].iov_base = const_cast<uint8_t *>(static_cast<const uint8_t *>(headers) + header_size * i);
-		iovs[0].iov_len = header_size;
-		iovs[1].iov_base = const_cast<void *>(data[i]);
-		iovs[1].iov_len = sizes[i];
+		total_sent += ret;
+		if (unsigned(ret) < count)
+			break;
 
-		mmgs[i].msg_hdr.msg_iov = iovs;
-		mmgs[i].msg_hdr.msg_iovlen = 2;
+		header_bytes += header_size * count;
+		data += count;
+		sizes += count;
+		num_sub_packets -= count;
 	}
 
-	return int(::sendmmsg(udp_listener.get_file_handle().get_native_handle(), mmgs, num_sub_packets, 0));
+	return total_sent;
 }
 
 bool Dispatcher::iterate_inner()
@@ -310,7 +342,7 @@ bool Dispatcher::iterate_inner()
 	for (int i = 0; i < count; i++)
 	{
 		auto &e = events[i];
-		if (e.data.ptr == &udp_listener)
+		if (e.data.u64 == UDPListenerHandle)
 		{
 			// 64k is UDP limit.
 			uint8_t buffer[64 * 1024];
@@ -320,12 +352,12 @@ bool Dispatcher::iterate_inner()
 			if (ret > 0 && iface)
 				iface->handle_udp_datagram(*this, remote, buffer, ret);
 		}
-		else if (e.data.ptr == &listener || e.data.ptr == &tcp_listener)
+		else if (e.data.u64 == ListenerHandle || e.data.u64 == TCPListenerHandle)
 		{
 			TCPConnection tcp;
 			FileHandle domain;
 
-			if (e.data.ptr == &tcp_listener)
+			if (e.data.u64 == TCPListenerHandle)
 				tcp = accept_tcp_connection();
 			else
 				domain = accept_connection();
@@ -343,20 +375,16 @@ bool Dispatcher::iterate_inner()
 			}
 
 			if (c->fd)
-			{
-				struct epoll_event ev = {};
-				ev.data.ptr = c.get();
-				ev.events = EPOLLIN;
-				if (epoll_ctl(pollfd.get_native_handle(), EPOLL_CTL_ADD,
-				              c->fd.get_native_handle(), &ev) == 0)
-				{
-					connections.push_back(std::move(c));
-				}
-			}
+				register_connection(std::move(c), EPOLLIN);
 		}
 		else
 		{
-			auto *conn = static_cast<Connection *>(e.data.ptr);
+			// The connection may have been cancelled or hung up earlier in this batch.
+			auto handle = e.data.u64;
+			auto *conn = connections.get(handle);
+			if (!conn)
+				continue;
+
 			bool hangup = false;
 
 			if ((e.events & EPOLLHUP) != 0)
@@ -371,6 +399,8 @@ bool Dispatcher::iterate_inner()
 				else
 					ret = iface && iface->register_handler(*this, conn->fd, conn->handler);
 
+				bind_handler(*conn);
+
 				if (!ret)
 					hangup = true;
 			}
@@ -379,7 +409,9 @@ bool Dispatcher::iterate_inner()
 				hangup = true;
 			}
 
-			if (hangup)
+			// The handler may have cancelled itself while handling the event.
+			// In that case the cancellation path below takes care of cleanup.
+			if (hangup && connections.get(handle) == conn)
 			{
 				if (epoll_ctl(pollfd.get_native_handle(), EPOLL_CTL_DEL,
 				              conn->fd.get_native_handle(), nullptr) < 0)
@@ -388,12 +420,7 @@ bool Dispatcher::iterate_inner()
 				}
 
 				bool is_sentinel = conn->handler && conn->handler->is_sentinel_file_handle();
-
-				auto itr = std::find_if(connections.begin(), connections.end(),
-				                        [conn](const std::unique_ptr<Connection> &c)
-				                        { return c.get() == conn; });
-				if (itr != connections.end())
-					connections.erase(itr);
+				remove_connection(handle);
 
 				if (is_sentinel)
 					return false;
@@ -466,12 +493,8 @@ void Dispatcher::add_signalfd()
 	conn->fd = std::move(signal_handler);
 	conn->handler = new SignalHandler{*this};
 
-	struct epoll_event e = {};
-	e.data.ptr = conn.get();
-	e.events = EPOLLIN;
-	if (epoll_ctl(pollfd.get_native_handle(), EPOLL_CTL_ADD, conn->fd.get_native_handle(), &e) < 0)
+	if (!register_connection(std::move(conn), EPOLLIN))
 		throw std::runtime_error("Failed to add to epoll.");
-	connections.push_back(std::move(conn));
 }
 
 void Dispatcher::add_eventfd()
@@ -485,12 +508,8 @@ void Dispatcher::add_eventfd()
 	conn->handler = new SignalHandler{*this};
 	event_handle = &conn->fd;
 
-	struct epoll_event e = {};
-	e.data.ptr = conn.get();
-	e.events = EPOLLIN;
-	if (epoll_ctl(pollfd.get_native_handle(), EPOLL_CTL_ADD, conn->fd.get_native_handle(), &e) < 0)
+	if (!register_connection(std::move(conn), EPOLLIN))
 		throw std::runtime_error("Failed to add to epoll.");
-	connections.push_back(std::move(conn));
 }
 
 void Dispatcher::kill()
@@ -514,7 +533,7 @@ Dispatcher::Dispatcher(const char *name, const char *listen_port)
 	add_eventfd();
 
 	struct epoll_event e = {};
-	e.data.ptr = &listener;
+	e.data.u64 = ListenerHandle;
 	e.events = EPOLLIN;
 	if (epoll_ctl(pollfd.get_native_handle(), EPOLL_CTL_ADD, listener.get_file_handle().get_native_handle(), &e) < 0)
 		throw std::runtime_error("Failed to add to epoll.");
@@ -530,12 +549,12 @@ Dispatcher::Dispatcher(const char *name, const char *listen_port)
 		if (::listen(tcp_listener.get_file_handle().get_native_handle(), 4) < 0)
 			throw std::runtime_error("Failed to listen.");
 
-		e.data.ptr = &tcp_listener;
+		e.data.u64 = TCPListenerHandle;
 		e.events = EPOLLIN;
 		if (epoll_ctl(pollfd.get_native_handle(), EPOLL_CTL_ADD, tcp_listener.get_file_handle().get_native_handle(), &e) < 0)
 			throw std::runtime_error("Failed to add to epoll.");
 
-		e.data.ptr = &udp_listener;
+		e.data.u64 = UDPListenerHandle;
 		e.events = EPOLLIN;
 		if (epoll_ctl(pollfd.get_native_handle(), EPOLL_CTL_ADD, udp_listener.get_file_handle().get_native_handle(), &e) < 0)
 			throw std::runtime_error("Failed to add to epoll.");
@@ -23,9 +23,11 @@
 #pragma once
 
 #include "file_handle.hpp"
+#include "slot_map.hpp"
 #include <vector>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <stdint.h>
 #include <sys/socket.h>
 
@@ -145,6 +147,7 @@ private:
 		RemoteAddress remote;
 		uint32_t id = 0;
 		Handler *handler = nullptr;
+		uint64_t handle = 0;
 
 		Connection() = default;
 		void operator=(const Connection &) = delete;
@@ -156,8 +159,39 @@ private:
 		}
 	};
 
-	std::vector<std::unique_ptr<Connection>> connections;
+	using ConnectionMap = SlotMap<Connection>;
+	enum : ConnectionMap::Handle
+	{
+		ListenerHandle = ConnectionMap::make_sentinel_handle(0),
+		TCPListenerHandle = ConnectionMap::make_sentinel_handle(1),
+		UDPListenerHandle = ConnectionMap::make_sentinel_handle(2)
+	};
+
+	struct HandlerKey
+	{
+		Handler *handler;
+		uint32_t id;
+		bool operator==(const HandlerKey &other) const
+		{
+			return handler == other.handler && id == other.id;
+		}
+	};
+
+	struct HandlerKeyHasher
+	{
+		size_t operator()(const HandlerKey &key) const
+		{
+			return std::hash<const void *>()(key.handler) ^ (size_t(key.id) * 0x9e3779b97f4a7c15ull);
+		}
+	};
+
+	ConnectionMap connections;
+	std::unordered_map<HandlerKey, ConnectionMap::Handle, HandlerKeyHasher> handler_to_connection;
 	std::vector<std::unique_ptr<Connection>> cancellations;
+
+	bool register_connection(std::unique_ptr<Connection> conn, uint32_t events);
+	void bind_handler(Connection &conn);
+	std::unique_ptr<Connection> remove_connection(ConnectionMap::Handle handle);
 	bool iterate_inner();
 };
 }
@@ -28,6 +28,7 @@
 #include <sys/mman.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 #include <vector>
 
 namespace PyroFling
@@ -50,6 +51,7 @@ struct RawMessagePayload
 	alignas(max_align_t) uint8_t data[1024 - sizeof(msg)];
 };
 static_assert(sizeof(RawMessagePayload) == 1024, "Unexpected payload size.");
+static_assert(sizeof(RawMessagePayload::data) == MaxMessagePayloadSize, "Unexpected payload size.");
 
 MessageType Message::get_type() const
 {
@@ -66,22 +68,22 @@ uint64_t Message::get_serial() const
 	return serial;
 }
 
-static constexpr int MaxSockets = 16;
+static constexpr int MaxSockets = int(MaxMessageFileHandles);
 
-bool send_message(const FileHandle &fd,
-                  MessageType type, uint64_t serial,
-                  const void *payload, size_t payload_size,
-                  const FileHandle *fling_fds, size_t fling_fds_count)
+SendResult try_send_message(const FileHandle &fd,
+                            MessageType type, uint64_t serial,
+                            const void *payload, size_t payload_size,
+                            const FileHandle *fling_fds, size_t fling_fds_count)
 {
 	RawMessageHeader header = {};
 	iovec iovs[2] = {};
 	int iov_count = 0;
 
 	if (fling_fds_count > size_t(MaxSockets))
-		return false;
+		return SendResult::Error;
 
 	if (payload_size > sizeof(RawMessagePayload::data))
-		return false;
+		return SendResult::Error;
 
 	alignas(struct cmsghdr) char cmsg_buf[CMSG_SPACE(sizeof(int) * MaxSockets)];
 
@@ -119,12 +121,26 @@ bool send_message(const FileHandle &fd,
 			fds[i] = fling_fds[i].get_native_handle();
 	}
 
-	ssize_t ret = ::sendmsg(fd.get_native_handle(), &msg, MSG_NOSIGNAL);
+	ssize_t ret = ::sendmsg(fd.get_native_handle(), &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+	// SEQPACKET writes are atomic, so a full socket never results in a partial write.
+	if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return SendResult::WouldBlock;
+
+	return size_t(ret) == sizeof(header) + payload_size ? SendResult::OK : SendResult::Error;
+}
+
+bool send_message(const FileHandle &fd,
+                  MessageType type, uint64_t serial,
+                  const void *payload, size_t payload_size,
+                  const FileHandle *fling_fds, size_t fling_fds_count)
+{
+	auto ret = try_send_message(fd, type, serial, payload, payload_size, fling_fds, fling_fds_count);
 
-	if (ret == -1 && errno == EAGAIN)
+	if (ret == SendResult::WouldBlock)
 		fprintf(stderr, "Non-blocking write fail. Clogged pipes somewhere?\n");
 
-	return size_t(ret) == sizeof(header) + payload_size;
+	return ret == SendResult::OK;
 }
 
 bool send_message(const FileHandle &fd, MessageType type, uint64_t serial)
@@ -179,10 +195,27 @@ static inline std::unique_ptr<Message> create_single_file_handle_message(const R
 	return std::make_unique<T>(payload.msg.serial, std::move(handles.front()));
 }
 
+template <typename T>
+static inline bool validate_wire_format_size(const RawMessagePayload &payload)
+{
+	if (payload.msg.payload_len != sizeof(typename T::WireFormat))
+	{
+		fprintf(stderr, "Message type %u: expected wire format size %zu, got %zu.\n",
+		        unsigned(payload.msg.type),
+		        sizeof(typename T::WireFormat), size_t(payload.msg.payload_len));
+		return false;
+	}
+
+	return true;
+}
+
 template <typename T>
 static inline std::unique_ptr<Message> create_file_handles_wire_format_message(const RawMessagePayload &payload,
                                                                                std::vector<FileHandle> handles)
 {
+	if (!validate_wire_format_size<T>(payload))
+		return {};
+
 	return std::make_unique<T>(payload.msg.serial,
 	                           *reinterpret_cast<const typename T::WireFormat *>(payload.data),
 	                           std::move(handles));
@@ -192,6 +225,9 @@ template <typename T>
 static inline std::unique_ptr<Message> create_file_handle_wire_format_message(const RawMessagePayload &payload,
                                                                               std::vector<FileHandle> handles)
 {
+	if (!validate_wire_format_size<T>(payload))
+		return {};
+
 	if (handles.size() > 1)
 	{
 		fprintf(stderr, "Expected 0 or 1 file handle, got %zu.\n", handles.size());
@@ -210,13 +246,8 @@ static inline std::unique_ptr<Message> create_file_handle_wire_format_message(co
 template <typename T>
 static inline std::unique_ptr<Message> create_wire_format_message(const RawMessagePayload &payload)
 {
-	if (payload.msg.payload_len != sizeof(typename T::WireFormat))
-	{
-		fprintf(stderr, "Message type %u: expected wire format size %zu, got %zu.\n",
-		        unsigned(payload.msg.type),
-		        sizeof(typename T::WireFormat), size_t(payload.msg.payload_len));
+	if (!validate_wire_format_size<T>(payload))
 		return {};
-	}
 
 	return std::make_unique<T>(payload.msg.serial,
 							   *reinterpret_cast<const typename T::WireFormat *>(payload.data));
@@ -314,24 +345,39 @@ std::unique_ptr<Message> parse_message(const FileHandle &fd)
 		}
 	}
 
-	if (payload.msg.magic != Magic)
+	if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
 	{
-		fprintf(stderr, "Magic mismatch.\n");
+		fprintf(stderr, "Unexpected truncation.\n");
 		return {};
 	}
 
-	if (size_t(ret) != sizeof(payload.msg) + payload.msg.payload_len)
+	return parse_message_buffer(&payload, size_t(ret), std::move(received_fds));
+}
+
+std::unique_ptr<Message> parse_message_buffer(const void *data, size_t size, std::vector<FileHandle> fds)
+{
+	RawMessagePayload payload = {};
+
+	if (size < sizeof(payload.msg) || size > sizeof(payload))
 	{
 		fprintf(stderr, "Message length mismatch.\n");
 		return {};
 	}
 
-	if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+	memcpy(&payload, data, size);
+
+	if (payload.msg.magic != Magic)
 	{
-		fprintf(stderr, "Unexpected truncation.\n");
+		fprintf(stderr, "Magic mismatch.\n");
 		return {};
 	}
 
-	return decode_message(payload, received_fds);
+	if (size != sizeof(payload.msg) + payload.msg.payload_len)
+	{
+		fprintf(stderr, "Message length mismatch.\n");
+		return {};
+	}
+
+	return decode_message(payload, fds);
+}
 }
-}
\ No newline at end of file
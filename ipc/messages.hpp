@@ -335,6 +335,22 @@ WIRE_MESSAGE_BODY_IMPL(FrameComplete, 48);
 // Misc
 SINGLE_FILE_HANDLE_MESSAGE_BODY_IMPL(EchoPayload);
 
+static constexpr size_t MaxMessagePayloadSize = 1024 - 32;
+static constexpr size_t MaxMessageFileHandles = 16;
+
+enum class SendResult
+{
+	OK,
+	WouldBlock,
+	Error
+};
+
+// Never blocks. If the socket is full, nothing is written and WouldBlock is returned.
+SendResult try_send_message(const FileHandle &fd,
+                            MessageType type, uint64_t serial,
+                            const void *payload, size_t payload_size,
+                            const FileHandle *fling_fds, size_t fling_fds_count);
+
 bool send_message(const FileHandle &fd,
                   MessageType type, uint64_t serial,
                   const void *payload, size_t payload_size,
@@ -351,6 +367,8 @@ static inline bool send_wire_message(const FileHandle &fd, uint64_t serial, cons
 }
 
 std::unique_ptr<Message> parse_message(const FileHandle &fd);
+// Decodes a complete message as received from the socket. Any received file handles are passed in fds.
+std::unique_ptr<Message> parse_message_buffer(const void *data, size_t size, std::vector<FileHandle> fds);
 
 template <typename MessageT>
 static inline MessageT &get(Message &msg)
@@ -0,0 +1,116 @@
+/* Copyright (c) 2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace PyroFling
+{
+// Generational slot map. Insert, lookup and removal are O(1).
+// A handle encodes slot index in the lower 32 bits and the slot generation in the upper 32 bits.
+// Generation 0 is never handed out, so handles with generation 0 can be used as sentinels by the caller,
+// and a stale handle is rejected once its slot has been recycled.
+template <typename T>
+class SlotMap
+{
+public:
+	using Handle = uint64_t;
+
+	static constexpr Handle make_sentinel_handle(uint32_t index)
+	{
+		return Handle(index);
+	}
+
+	Handle insert(std::unique_ptr<T> value)
+	{
+		uint32_t index;
+		if (free_list.empty())
+		{
+			index = uint32_t(slots.size());
+			slots.emplace_back();
+		}
+		else
+		{
+			index = free_list.back();
+			free_list.pop_back();
+		}
+
+		auto &slot = slots[index];
+		slot.value = std::move(value);
+		count++;
+		return (Handle(slot.generation) << 32) | index;
+	}
+
+	T *get(Handle handle) const
+	{
+		auto index = uint32_t(handle);
+		auto generation = uint32_t(handle >> 32);
+		if (index >= slots.size() || slots[index].generation != generation)
+			return nullptr;
+		return slots[index].value.get();
+	}
+
+	std::unique_ptr<T> remove(Handle handle)
+	{
+		if (!get(handle))
+			return {};
+
+		auto index = uint32_t(handle);
+		auto &slot = slots[index];
+		auto value = std::move(slot.value);
+
+		// Invalidate any outstanding handles to this slot.
+		if (++slot.generation == 0)
+			slot.generation = 1;
+
+		free_list.push_back(index);
+		count--;
+		return value;
+	}
+
+	void clear()
+	{
+		slots.clear();
+		free_list.clear();
+		count = 0;
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+private:
+	struct Slot
+	{
+		std::unique_ptr<T> value;
+		uint32_t generation = 1;
+	};
+	std::vector<Slot> slots;
+	std::vector<uint32_t> free_list;
+	size_t count = 0;
+};
+}
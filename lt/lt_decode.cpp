@@ -60,7 +60,8 @@ void Decoder::begin_decode(uint32_t seed, void *data, size_t size,
 
 	reserve_indices(max_fec_blocks * output_blocks + num_u32_masks_per_output * output_blocks);
 	output_to_fec_mask = index_buffer.get();
-	memset(output_to_fec_mask, 0, num_u32_masks_per_output * output_blocks * sizeof(uint32_t));
+	if (num_u32_masks_per_output)
+		memset(output_to_fec_mask, 0, num_u32_masks_per_output * output_blocks * sizeof(uint32_t));
 	index_buffer_offset += num_u32_masks_per_output * output_blocks;
 
 	shuffler.seed(seed);
@@ -0,0 +1,266 @@
+#include "mux_output.hpp"
+#include "logging.hpp"
+#include <string.h>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavcodec/bsf.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/error.h>
+}
+
+namespace PyroFling
+{
+MuxOutput::~MuxOutput()
+{
+	if (header_written)
+		av_write_trailer(ctx);
+	if (ctx && ctx->pb && !(ctx->oformat->flags & AVFMT_NOFILE))
+		avio_closep(&ctx->pb);
+	avformat_free_context(ctx);
+	av_bsf_free(&extradata_bsf);
+	av_packet_free(&packet);
+}
+
+void MuxOutput::fail(const char *what, int err)
+{
+	char errbuf[AV_ERROR_MAX_STRING_SIZE] = {};
+	av_strerror(err, errbuf, sizeof(errbuf));
+	LOGE("Output \"%s\": %s failed: %s.\n", url.c_str(), what, errbuf);
+	failed = true;
+}
+
+bool MuxOutput::init(const char *url_, const char *format, bool walltime_to_pts_)
+{
+	url = url_;
+	walltime_to_pts = walltime_to_pts_;
+	avformat_network_init();
+
+	int ret = avformat_alloc_output_context2(&ctx, nullptr, format, url.c_str());
+	if (ret < 0 || !ctx)
+	{
+		fail("Creating muxer", ret);
+		return false;
+	}
+
+	packet = av_packet_alloc();
+	return packet != nullptr;
+}
+
+void MuxOutput::set_codec_parameters(const pyro_codec_parameters &codec)
+{
+	// Parameters are fixed for the lifetime of an encode session.
+	if (failed || video_stream)
+		return;
+
+	AVCodecID video_codec;
+	switch (codec.video_codec)
+	{
+	case PYRO_VIDEO_CODEC_H264: video_codec = AV_CODEC_ID_H264; break;
+	case PYRO_VIDEO_CODEC_H265: video_codec = AV_CODEC_ID_HEVC; break;
+	case PYRO_VIDEO_CODEC_AV1: video_codec = AV_CODEC_ID_AV1; break;
+	default:
+		LOGE("Output \"%s\": video codec cannot be muxed.\n", url.c_str());
+		failed = true;
+		return;
+	}
+
+	video_stream = avformat_new_stream(ctx, nullptr);
+	if (!video_stream)
+	{
+		failed = true;
+		return;
+	}
+
+	if (walltime_to_pts)
+	{
+		video_timebase_num = 1;
+		video_timebase_den = 1000000;
+	}
+	else
+	{
+		video_timebase_num = codec.frame_rate_den;
+		video_timebase_den = codec.frame_rate_num;
+	}
+
+	auto *par = video_stream->codecpar;
+	par->codec_type = AVMEDIA_TYPE_VIDEO;
+	par->codec_id = video_codec;
+	par->width = codec.width;
+	par->height = codec.height;
+	video_stream->time_base = { video_timebase_num, video_timebase_den };
+	video_stream->avg_frame_rate = { codec.frame_rate_num, codec.frame_rate_den };
+
+	const AVBitStreamFilter *filter = av_bsf_get_by_name("extract_extradata");
+	if (filter && av_bsf_alloc(filter, &extradata_bsf) >= 0)
+	{
+		avcodec_parameters_copy(extradata_bsf->par_in, par);
+		extradata_bsf->time_base_in = video_stream->time_base;
+		if (av_bsf_init(extradata_bsf) < 0)
+			av_bsf_free(&extradata_bsf);
+	}
+
+	AVCodecID audio_codec = AV_CODEC_ID_NONE;
+	switch (codec.audio_codec)
+	{
+	case PYRO_AUDIO_CODEC_OPUS: audio_codec = AV_CODEC_ID_OPUS; break;
+	case PYRO_AUDIO_CODEC_AAC: audio_codec = AV_CODEC_ID_AAC; break;
+	case PYRO_AUDIO_CODEC_RAW_S16LE: audio_codec = AV_CODEC_ID_PCM_S16LE; break;
+	default: break;
+	}
+
+	if (audio_codec == AV_CODEC_ID_NONE)
+		return;
+
+	if (avformat_query_codec(ctx->oformat, audio_codec, FF_COMPLIANCE_NORMAL) != 1)
+	{
+		LOGW("Output \"%s\": audio codec is not supported by the muxer, dropping audio.\n", url.c_str());
+		return;
+	}
+
+	audio_stream = avformat_new_stream(ctx, nullptr);
+	if (!audio_stream)
+		return;
+
+	if (walltime_to_pts)
+	{
+		audio_timebase_num = 1;
+		audio_timebase_den = 1000000;
+	}
+	else
+	{
+		audio_timebase_num = 1;
+		audio_timebase_den = int(codec.rate);
+	}
+
+	par = audio_stream->codecpar;
+	par->codec_type = AVMEDIA_TYPE_AUDIO;
+	par->codec_id = audio_codec;
+	par->sample_rate = int(codec.rate);
+	av_channel_layout_default(&par->ch_layout, int(codec.channels));
+	audio_stream->time_base = { audio_timebase_num, audio_timebase_den };
+
+	if (audio_codec == AV_CODEC_ID_AAC)
+	{
+		// Raw AAC needs an AudioSpecificConfig. The encoder only produces AAC-LC.
+		static const int rates[] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+		int rate_index = 0xf;
+		for (int i = 0; i < int(sizeof(rates) / sizeof(rates[0])); i++)
+			if (rates[i] == int(codec.rate))
+				rate_index = i;
+
+		if (rate_index != 0xf && codec.channels <= 7)
+		{
+			par->extradata = static_cast<uint8_t *>(av_mallocz(2 + AV_INPUT_BUFFER_PADDING_SIZE));
+			if (par->extradata)
+			{
+				constexpr int object_type_aac_lc = 2;
+				par->extradata[0] = uint8_t((object_type_aac_lc << 3) | (rate_index >> 1));
+				par->extradata[1] = uint8_t(((rate_index & 1) << 7) | (codec.channels << 3));
+				par->extradata_size = 2;
+			}
+		}
+	}
+}
+
+bool MuxOutput::write_header(const void *key_frame, size_t size)
+{
+	if (extradata_bsf)
+	{
+		int ret = av_new_packet(packet, int(size));
+		if (ret < 0)
+		{
+			fail("Allocating packet", ret);
+			return false;
+		}
+
+		memcpy(packet->data, key_frame, size);
+		packet->flags |= AV_PKT_FLAG_KEY;
+
+		if (av_bsf_send_packet(extradata_bsf, packet) >= 0)
+		{
+			while (av_bsf_receive_packet(extradata_bsf, packet) >= 0)
+			{
+				size_t extradata_size = 0;
+				auto *extradata = av_packet_get_side_data(packet, AV_PKT_DATA_NEW_EXTRADATA, &extradata_size);
+				auto *par = video_stream->codecpar;
+
+				if (extradata && extradata_size && !par->extradata)
+				{
+					par->extradata = static_cast<uint8_t *>(av_mallocz(extradata_size + AV_INPUT_BUFFER_PADDING_SIZE));
+					if (par->extradata)
+					{
+						memcpy(par->extradata, extradata, extradata_size);
+						par->extradata_size = int(extradata_size);
+					}
+				}
+
+				av_packet_unref(packet);
+			}
+		}
+
+		av_packet_unref(packet);
+	}
+
+	int ret;
+	if (!(ctx->oformat->flags & AVFMT_NOFILE) && (ret = avio_open(&ctx->pb, url.c_str(), AVIO_FLAG_WRITE)) < 0)
+	{
+		fail("Opening output", ret);
+		return false;
+	}
+
+	if ((ret = avformat_write_header(ctx, nullptr)) < 0)
+	{
+		fail("Writing header", ret);
+		return false;
+	}
+
+	header_written = true;
+	return true;
+}
+
+void MuxOutput::write_packet(AVStream *stream, int timebase_num, int timebase_den,
+                             int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame)
+{
+	// The packet is not reference counted, so the muxer makes its own copy if it needs one.
+	packet->data = static_cast<uint8_t *>(const_cast<void *>(data));
+	packet->size = int(size);
+	packet->pts = pts;
+	packet->dts = dts;
+	packet->stream_index = stream->index;
+	packet->flags = is_key_frame ? AV_PKT_FLAG_KEY : 0;
+	av_packet_rescale_ts(packet, { timebase_num, timebase_den }, stream->time_base);
+
+	int ret = av_interleaved_write_frame(ctx, packet);
+	av_packet_unref(packet);
+	if (ret < 0)
+		fail("Writing packet", ret);
+}
+
+void MuxOutput::write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame)
+{
+	if (failed || !video_stream)
+		return;
+
+	if (!header_written && (!is_key_frame || !write_header(data, size)))
+		return;
+
+	write_packet(video_stream, video_timebase_num, video_timebase_den, pts, dts, data, size, is_key_frame);
+}
+
+void MuxOutput::write_audio_packet(int64_t pts, int64_t dts, const void *data, size_t size)
+{
+	// Audio before the first video key frame is dropped, so the output starts in a decodable state.
+	if (failed || !audio_stream || !header_written)
+		return;
+
+	write_packet(audio_stream, audio_timebase_num, audio_timebase_den, pts, dts, data, size, true);
+}
+
+bool MuxOutput::should_force_idr()
+{
+	return false;
+}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "ffmpeg_encode.hpp"
+#include "pyro_protocol.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+struct AVFormatContext;
+struct AVStream;
+struct AVBSFContext;
+struct AVPacket;
+
+namespace PyroFling
+{
+// Muxes already encoded packets to a file or URL, e.g. an RTMP ingest,
+// so one encode can feed both pyro clients and a regular output.
+// Timestamps are expected in the units the encoder hands to MuxStreamCallback:
+// microseconds with wall time PTS, otherwise frames for video and samples for audio.
+class MuxOutput final : public Granite::MuxStreamCallback
+{
+public:
+	~MuxOutput() override;
+
+	// format may be null, in which case it is guessed from the URL.
+	bool init(const char *url, const char *format, bool walltime_to_pts);
+
+	void set_codec_parameters(const pyro_codec_parameters &codec) override;
+	void write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame) override;
+	void write_audio_packet(int64_t pts, int64_t dts, const void *data, size_t size) override;
+	bool should_force_idr() override;
+
+private:
+	std::string url;
+	bool walltime_to_pts = true;
+	AVFormatContext *ctx = nullptr;
+	AVStream *video_stream = nullptr;
+	AVStream *audio_stream = nullptr;
+	AVBSFContext *extradata_bsf = nullptr;
+	AVPacket *packet = nullptr;
+	int video_timebase_num = 1, video_timebase_den = 1;
+	int audio_timebase_num = 1, audio_timebase_den = 1;
+	bool header_written = false;
+	bool failed = false;
+
+	// Most muxers need SPS / PPS up front, which are only available in-band in the first key frame.
+	bool write_header(const void *key_frame, size_t size);
+	void write_packet(AVStream *stream, int timebase_num, int timebase_den,
+	                  int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame);
+	void fail(const char *what, int err);
+};
+}
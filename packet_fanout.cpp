@@ -0,0 +1,225 @@
+#include "packet_fanout.hpp"
+#include "logging.hpp"
+
+namespace PyroFling
+{
+PacketFanout::~PacketFanout()
+{
+	// Let every sink drain what is already queued, so files are complete.
+	for (auto &sink : sinks)
+	{
+		{
+			std::lock_guard<std::mutex> holder{sink->lock};
+			sink->shutdown = true;
+		}
+		sink->cond.notify_one();
+	}
+
+	for (auto &sink : sinks)
+	{
+		sink->thread.join();
+		if (sink->dropped_packets)
+		{
+			LOGW("Output \"%s\" dropped %llu packets.\n", sink->name.c_str(),
+			     static_cast<unsigned long long>(sink->dropped_packets));
+		}
+	}
+}
+
+void PacketFanout::add_sink(std::unique_ptr<Granite::MuxStreamCallback> callback, const std::string &name,
+                            size_t max_queued_bytes, bool block_on_overflow)
+{
+	std::unique_ptr<Sink> sink{new Sink};
+	sink->callback = std::move(callback);
+	sink->name = name;
+	sink->max_queued_bytes = max_queued_bytes;
+	sink->block_on_overflow = block_on_overflow;
+
+	auto *s = sink.get();
+	sink->thread = std::thread([s]() { sink_loop(*s); });
+	sinks.push_back(std::move(sink));
+}
+
+bool PacketFanout::empty() const
+{
+	return sinks.empty();
+}
+
+void PacketFanout::sink_loop(Sink &sink)
+{
+	for (;;)
+	{
+		Packet packet;
+
+		{
+			std::unique_lock<std::mutex> holder{sink.lock};
+			sink.cond.wait(holder, [&]() { return sink.shutdown || !sink.queue.empty(); });
+			if (sink.queue.empty())
+				return;
+
+			packet = std::move(sink.queue.front());
+			sink.queue.pop_front();
+			if (packet.data)
+				sink.queued_bytes -= packet.data->size();
+		}
+
+		if (sink.block_on_overflow)
+			sink.space_cond.notify_one();
+
+		switch (packet.type)
+		{
+		case PacketType::CodecParameters:
+			sink.callback->set_codec_parameters(packet.codec);
+			break;
+
+		case PacketType::Video:
+			sink.callback->write_video_packet(packet.pts, packet.dts,
+			                                  packet.data->data(), packet.data->size(),
+			                                  packet.is_key_frame);
+			break;
+
+		case PacketType::Audio:
+			sink.callback->write_audio_packet(packet.pts, packet.dts,
+			                                  packet.data->data(), packet.data->size());
+			break;
+		}
+	}
+}
+
+void PacketFanout::push(const Packet &packet)
+{
+	size_t size = packet.data ? packet.data->size() : 0;
+
+	for (auto &sink : sinks)
+	{
+		{
+			std::unique_lock<std::mutex> holder{sink->lock};
+
+			// A packet larger than the whole queue is still let through once the queue is empty.
+			if (sink->block_on_overflow)
+			{
+				sink->space_cond.wait(holder, [&]() {
+					return sink->queued_bytes == 0 || sink->queued_bytes + size <= sink->max_queued_bytes;
+				});
+			}
+
+			// Codec parameters are tiny and every sink needs them, so they are never dropped.
+			// A blocking sink never drops anything, it waited for space above.
+			if (packet.type == PacketType::Video && !sink->block_on_overflow)
+			{
+				if (sink->needs_key_frame && !packet.is_key_frame)
+				{
+					// Only ask for a key frame once the sink has caught up,
+					// so a sink which is always too slow does not force key frames on everyone.
+					if (!sink->requested_key_frame && sink->queued_bytes <= sink->max_queued_bytes / 2)
+					{
+						sink->requested_key_frame = true;
+						idr_request = true;
+					}
+
+					sink->dropped_packets++;
+					continue;
+				}
+
+				if (sink->queued_bytes + size > sink->max_queued_bytes)
+				{
+					if (!sink->needs_key_frame)
+						LOGW("Output \"%s\" cannot keep up, skipping to next key frame.\n", sink->name.c_str());
+					sink->needs_key_frame = true;
+					sink->dropped_packets++;
+					continue;
+				}
+
+				sink->needs_key_frame = false;
+				sink->requested_key_frame = false;
+			}
+			else if (packet.type == PacketType::Audio && !sink->block_on_overflow &&
+			         sink->queued_bytes + size > sink->max_queued_bytes)
+			{
+				sink->dropped_packets++;
+				continue;
+			}
+
+			sink->queue.push_back(packet);
+			sink->queued_bytes += size;
+		}
+
+		sink->cond.notify_one();
+	}
+}
+
+void PacketFanout::set_codec_parameters(const pyro_codec_parameters &codec)
+{
+	Packet packet = {};
+	packet.type = PacketType::CodecParameters;
+	packet.codec = codec;
+	push(packet);
+}
+
+void PacketFanout::write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame)
+{
+	if (sinks.empty())
+		return;
+	write_video_packet(pts, dts, packet_pool->copy(data, size), is_key_frame);
+}
+
+void PacketFanout::write_video_packet(int64_t pts, int64_t dts, const PacketBufferHandle &data, bool is_key_frame)
+{
+	if (sinks.empty())
+		return;
+
+	Packet packet = {};
+	packet.type = PacketType::Video;
+	packet.pts = pts;
+	packet.dts = dts;
+	packet.is_key_frame = is_key_frame;
+	packet.data = data;
+	push(packet);
+}
+
+void PacketFanout::write_audio_packet(int64_t pts, int64_t dts, const void *data, size_t size)
+{
+	if (sinks.empty())
+		return;
+	write_audio_packet(pts, dts, packet_pool->copy(data, size));
+}
+
+void PacketFanout::write_audio_packet(int64_t pts, int64_t dts, const PacketBufferHandle &data)
+{
+	if (sinks.empty())
+		return;
+
+	Packet packet = {};
+	packet.type = PacketType::Audio;
+	packet.pts = pts;
+	packet.dts = dts;
+	packet.data = data;
+	push(packet);
+}
+
+bool PacketFanout::should_force_idr()
+{
+	return idr_request.exchange(false);
+}
+
+bool PacketFanout::has_idr_request() const
+{
+	return idr_request.load();
+}
+
+bool PacketFanout::get_sink_stats(const std::string &name, SinkStats &stats)
+{
+	for (auto &sink : sinks)
+	{
+		if (sink->name == name)
+		{
+			std::lock_guard<std::mutex> holder{sink->lock};
+			stats.queued_bytes = sink->queued_bytes;
+			stats.dropped_packets = sink->dropped_packets;
+			return true;
+		}
+	}
+
+	return false;
+}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "ffmpeg_encode.hpp"
+#include "pyro_protocol.h"
+#include "packet_buffer.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PyroFling
+{
+// Delivers the packets of one encode session to any number of sinks.
+// Every sink has its own bounded queue and thread, so a slow sink only loses its own packets.
+// When a sink overflows, it drops video until the next key frame.
+// A key frame is requested once the sink has drained its queue.
+// A blocking sink stalls the writer instead, for outputs which must not lose anything.
+class PacketFanout
+{
+public:
+	enum { DefaultMaxQueuedBytes = 32 * 1024 * 1024 };
+
+	~PacketFanout();
+
+	// Sinks must be added before any packets are written.
+	void add_sink(std::unique_ptr<Granite::MuxStreamCallback> sink, const std::string &name,
+	              size_t max_queued_bytes = DefaultMaxQueuedBytes, bool block_on_overflow = false);
+	bool empty() const;
+
+	void set_codec_parameters(const pyro_codec_parameters &codec);
+	// Pointer variants copy the payload into a buffer from the fanout's own pool.
+	// Packets which are already in a buffer are queued by reference.
+	void write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame);
+	void write_video_packet(int64_t pts, int64_t dts, const PacketBufferHandle &packet, bool is_key_frame);
+	void write_audio_packet(int64_t pts, int64_t dts, const void *data, size_t size);
+	void write_audio_packet(int64_t pts, int64_t dts, const PacketBufferHandle &packet);
+
+	// True if any sink dropped video and needs a key frame to resume. Clears the request.
+	bool should_force_idr();
+	// Same, but without clearing the request.
+	bool has_idr_request() const;
+
+	struct SinkStats
+	{
+		size_t queued_bytes;
+		uint64_t dropped_packets;
+	};
+	// Returns false if there is no sink with this name.
+	bool get_sink_stats(const std::string &name, SinkStats &stats);
+
+private:
+	enum class PacketType { CodecParameters, Video, Audio };
+
+	// Payloads are shared between all sink queues.
+	struct Packet
+	{
+		PacketType type;
+		int64_t pts;
+		int64_t dts;
+		bool is_key_frame;
+		PacketBufferHandle data;
+		pyro_codec_parameters codec;
+	};
+
+	struct Sink
+	{
+		std::unique_ptr<Granite::MuxStreamCallback> callback;
+		std::string name;
+		size_t max_queued_bytes;
+		bool block_on_overflow;
+
+		std::mutex lock;
+		std::condition_variable cond;
+		std::condition_variable space_cond;
+		std::deque<Packet> queue;
+		size_t queued_bytes = 0;
+		bool needs_key_frame = false;
+		bool requested_key_frame = false;
+		bool shutdown = false;
+		uint64_t dropped_packets = 0;
+
+		std::thread thread;
+	};
+
+	std::vector<std::unique_ptr<Sink>> sinks;
+	std::atomic_bool idr_request{false};
+	Util::IntrusivePtr<PacketBufferPool> packet_pool = Util::make_handle<PacketBufferPool>();
+
+	void push(const Packet &packet);
+	static void sink_loop(Sink &sink);
+};
+}
@@ -48,6 +48,14 @@ typedef enum pyro_video_color_profile
 	PYRO_VIDEO_COLOR_MAX_INT = INT32_MAX
 } pyro_video_color;
 
+typedef enum pyro_audio_protection
+{
+	PYRO_AUDIO_PROTECTION_NONE = 0,
+	/* Every audio packet is sent again as FEC subpackets along with the next packet,
+	 * so a single lost packet can be reconstructed one packet later. */
+	PYRO_AUDIO_PROTECTION_REDUNDANCY = 1
+} pyro_audio_protection;
+
 struct pyro_codec_parameters
 {
 	pyro_video_codec_type video_codec;
@@ -57,7 +65,10 @@ struct pyro_codec_parameters
 	uint16_t frame_rate_den;
 	uint16_t width;
 	uint16_t height;
-	uint32_t channels;
+	uint16_t channels;
+	// pyro_audio_protection. Only set if requested with PYRO_KICK_STATE_AUDIO_REDUNDANCY_BIT.
+	// Older servers always leave it 0, since channels used to be 32-bit.
+	uint16_t audio_protection;
 	uint32_t rate;
 };
 
@@ -70,6 +81,16 @@ struct pyro_progress_report
 	uint64_t total_received_key_frames;
 };
 
+// Sent by client when a video packet was lost and the codec cannot recover on its own.
+// The sequence numbers bound the gap, so the server can tell if a key frame was already sent after it.
+struct pyro_loss_report
+{
+	// Last video packet received before the gap.
+	uint32_t last_good_video_seq;
+	// First video packet received after the gap.
+	uint32_t next_video_seq;
+};
+
 struct pyro_phase_offset
 {
 	// Tells server that ideally we should have received frame at
@@ -120,7 +141,9 @@ typedef enum pyro_kick_state_bits
 {
 	PYRO_KICK_STATE_VIDEO_BIT = 1 << 0,
 	PYRO_KICK_STATE_AUDIO_BIT = 1 << 1,
-	PYRO_KICK_STATE_GAMEPAD_BIT = 1 << 2
+	PYRO_KICK_STATE_GAMEPAD_BIT = 1 << 2,
+	// Client can reconstruct audio from redundant copies. Older servers ignore it.
+	PYRO_KICK_STATE_AUDIO_REDUNDANCY_BIT = 1 << 3
 } pyro_kick_state_bits;
 typedef uint32_t pyro_kick_state_flags;
 
@@ -152,6 +175,8 @@ typedef enum pyro_message_type
 	PYRO_MESSAGE_PHASE_OFFSET = PYRO_MAKE_MESSAGE_TYPE(8, sizeof(struct pyro_phase_offset)),
 	PYRO_MESSAGE_GAMEPAD_STATE = PYRO_MAKE_MESSAGE_TYPE(9, sizeof(struct pyro_gamepad_state)),
 	PYRO_MESSAGE_PING = PYRO_MAKE_MESSAGE_TYPE(10, sizeof(struct pyro_ping_state)),
+	// Returns nothing. Sent by client along with PROGRESS when video loss is detected.
+	PYRO_MESSAGE_LOSS_REPORT = PYRO_MAKE_MESSAGE_TYPE(11, sizeof(struct pyro_loss_report)),
 	PYRO_MESSAGE_MAX_INT = INT32_MAX,
 } pyro_message_type;
 
@@ -178,6 +203,8 @@ enum pyro_payload_flag_bits
 	// This is a FEC block.
 	// SUBPACKET_SEQ is not wrapped.
 	// Max FEC blocks is bounded to 1 << SUBPACKET_SEQ_BITS.
+	// For audio, this is a redundant copy of a subpacket of an earlier packet, with the original
+	// header otherwise intact. Clients which did not negotiate audio protection ignore these.
 	PYRO_PAYLOAD_PACKET_FEC_BIT = 1 << 2,
 
 	// Set on first subpacket within a packet. Not used for FEC.
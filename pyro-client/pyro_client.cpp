@@ -28,18 +28,35 @@ void ReconstructedPacket::prepare_decode(const pyro_payload_header &header)
 	{
 		current_header = header;
 		is_done = false;
+		is_error = false;
+
+		size_t num_blocks = (size_t(header.payload_size) + PYRO_MAX_PAYLOAD_SIZE - 1) / PYRO_MAX_PAYLOAD_SIZE;
+
+		// Set a reasonable upper bound. The server never sends more FEC blocks than data blocks,
+		// and XOR blocks cannot cover more data blocks than there are.
+		// FEC decoding state scales with data blocks * FEC blocks, so bound that as well.
+		// Anything else is a malformed header which must not be allowed to drive allocations.
+		if (num_blocks == 0 || num_blocks > MaxPayloadBlocks ||
+		    header.num_fec_blocks > num_blocks ||
+		    num_blocks * header.num_fec_blocks > MaxFECDecodeBlocks ||
+		    (header.num_fec_blocks &&
+		     (header.num_xor_blocks_even > num_blocks || header.num_xor_blocks_odd > num_blocks)))
+		{
+			// Keep a dummy buffer so that the packet is not considered reset.
+			buffer.resize(PYRO_MAX_PAYLOAD_SIZE);
+			fec_buffer.clear();
+			current_header.payload_size = 0;
+			is_error = true;
+		}
+		else
+		{
+			buffer.resize(num_blocks * PYRO_MAX_PAYLOAD_SIZE);
+			fec_buffer.resize(header.num_fec_blocks * PYRO_MAX_PAYLOAD_SIZE);
 
-		// Set a reasonable upper bound.
-		size_t buffer_size = (header.payload_size + PYRO_MAX_PAYLOAD_SIZE - 1) & ~(PYRO_MAX_PAYLOAD_SIZE - 1);
-		buffer_size = std::min<size_t>(buffer_size, 128 * 1024 * PYRO_MAX_PAYLOAD_SIZE);
-		buffer.resize(buffer_size);
-
-		// Bound by 16-bit FEC count.
-		fec_buffer.resize(header.num_fec_blocks * PYRO_MAX_PAYLOAD_SIZE);
-
-		decoder.set_block_size(PYRO_MAX_PAYLOAD_SIZE);
-		decoder.begin_decode(header.pts_lo, buffer.data(), buffer.size(), header.num_fec_blocks,
-		                     header.num_xor_blocks_even, header.num_xor_blocks_odd);
+			decoder.set_block_size(PYRO_MAX_PAYLOAD_SIZE);
+			decoder.begin_decode(header.pts_lo, buffer.data(), buffer.size(), header.num_fec_blocks,
+			                     header.num_xor_blocks_even, header.num_xor_blocks_odd);
+		}
 
 		subpacket_seq_accum = 0;
 		last_subpacket_raw_seq = 0;
@@ -119,6 +136,16 @@ void ReconstructedPacket::add_fec_data(uint32_t subseq, const void *data, size_t
 	}
 }
 
+void ReconstructedPacket::add_redundant_data(const void *data, size_t size)
+{
+	if (is_done || is_error)
+		return;
+
+	add_payload_data(data, size);
+	if (is_done)
+		fec_recovered = true;
+}
+
 bool PyroStreamClient::connect(const char *host, const char *port)
 {
 	if (!tcp.connect(PyroFling::Socket::Proto::TCP, host, port))
@@ -134,6 +161,10 @@ bool PyroStreamClient::connect(const char *host, const char *port)
 
 bool PyroStreamClient::handshake(pyro_kick_state_flags flags)
 {
+	// Lost audio cannot be repaired later like video, so always ask for redundancy.
+	if (flags & PYRO_KICK_STATE_AUDIO_BIT)
+		flags |= PYRO_KICK_STATE_AUDIO_REDUNDANCY_BIT;
+
 	pyro_message_type type = PYRO_MESSAGE_HELLO;
 	if (!tcp.write(&type, sizeof(type)))
 		return false;
@@ -190,6 +221,11 @@ const pyro_payload_header &PyroStreamClient::get_payload_header() const
 	return current->get_payload_header();
 }
 
+unsigned PyroStreamClient::get_num_lost_packets_before_current() const
+{
+	return current ? lost_packets_before_current : 0;
+}
+
 bool PyroStreamClient::send_target_phase_offset(int offset_us)
 {
 	pyro_message_type type = PYRO_MESSAGE_PHASE_OFFSET;
@@ -501,12 +537,20 @@ bool PyroStreamClient::iterate()
 		payload.size = udp.read_thread_packet(&payload, PYRO_MAX_UDP_DATAGRAM_SIZE);
 	}
 
-	register_received_packet_size(payload.size);
+	return process_datagram(&payload, payload.size);
+}
+
+bool PyroStreamClient::process_datagram(const void *data, size_t size)
+{
+	register_received_packet_size(size);
 
-	if (payload.size < sizeof(pyro_payload_header) || payload.size > PYRO_MAX_UDP_DATAGRAM_SIZE)
+	if (size < sizeof(pyro_payload_header) || size > PYRO_MAX_UDP_DATAGRAM_SIZE)
 		return false;
 
-	payload.size -= sizeof(pyro_payload_header);
+	Packet payload;
+	memcpy(&payload.header, data, sizeof(pyro_payload_header));
+	payload.size = size - sizeof(pyro_payload_header);
+	memcpy(payload.buffer, static_cast<const uint8_t *>(data) + sizeof(pyro_payload_header), payload.size);
 
 	write_debug_header(payload.header);
 
@@ -540,10 +584,18 @@ bool PyroStreamClient::iterate()
 	auto &last_completed_seq = is_audio ? last_completed_audio_seq : last_completed_video_seq;
 	auto &h = payload.header;
 
+	bool is_redundant = false;
 	if ((h.encoded & PYRO_PAYLOAD_PACKET_FEC_BIT) != 0 && is_audio)
 	{
-		LOG("  invalid fec\n");
-		return true;
+		if (codec.audio_protection != PYRO_AUDIO_PROTECTION_REDUNDANCY)
+		{
+			LOG("  invalid fec\n");
+			return true;
+		}
+
+		// A redundant copy of an earlier packet. If the original already arrived, it is dropped as an old packet.
+		h.encoded &= ~PYRO_PAYLOAD_PACKET_FEC_BIT;
+		is_redundant = true;
 	}
 
 	uint32_t packet_seq = pyro_payload_get_packet_seq(h.encoded);
@@ -587,6 +639,10 @@ bool PyroStreamClient::iterate()
 		uint32_t subpacket_seq = pyro_payload_get_subpacket_seq(h.encoded);
 		stream->add_fec_data(subpacket_seq, payload.buffer, payload.size);
 	}
+	else if (is_redundant)
+	{
+		stream->add_redundant_data(payload.buffer, payload.size);
+	}
 	else
 	{
 		stream->add_payload_data(payload.buffer, payload.size);
@@ -606,6 +662,7 @@ bool PyroStreamClient::iterate()
 
 		LOG("  complete seq %04x\n", packet_seq);
 
+		lost_packets_before_current = 0;
 		if (last_completed_seq != UINT32_MAX)
 		{
 			int delta = pyro_payload_get_packet_seq_delta(stream->packet_seq, last_completed_seq);
@@ -620,13 +677,21 @@ bool PyroStreamClient::iterate()
 			if (delta > 1)
 				LOG("  %d packet drops\n", delta - 1);
 
+			lost_packets_before_current = unsigned(delta - 1);
 			if (is_audio)
 				progress.total_dropped_audio_packets += delta - 1;
 			else
 				progress.total_dropped_video_packets += delta - 1;
 
-			if (!is_audio && delta > 1 && !video_codec_is_self_recovering(codec))
+			// If the packet completing the gap is a key frame, the decoder recovers by itself.
+			if (!is_audio && delta > 1 && !video_codec_is_self_recovering(codec) &&
+			    (h.encoded & PYRO_PAYLOAD_KEY_FRAME_BIT) == 0)
+			{
+				loss_report.last_good_video_seq = last_completed_seq;
+				loss_report.next_video_seq = stream->packet_seq;
+				pending_loss_report = true;
 				request_immediate_feedback = true;
+			}
 		}
 
 		last_completed_seq = stream->packet_seq;
@@ -673,11 +738,30 @@ void PyroStreamClient::register_received_packet_size(size_t size)
 
 bool PyroStreamClient::check_send_progress()
 {
+	if (offline)
+	{
+		request_immediate_feedback = false;
+		pending_loss_report = false;
+		return true;
+	}
+
 	auto current_time = std::chrono::steady_clock::now();
 	auto delta = current_time - last_progress_time;
 	if (std::chrono::duration_cast<std::chrono::milliseconds>(delta).count() >= 1000 || request_immediate_feedback)
 	{
 		last_progress_time = current_time;
+
+		// Loss report goes first, so the server knows not to act on the dropped count in the progress report.
+		if (pending_loss_report)
+		{
+			const pyro_message_type loss_type = PYRO_MESSAGE_LOSS_REPORT;
+			if (!tcp.write(&loss_type, sizeof(loss_type)))
+				return false;
+			if (!tcp.write(&loss_report, sizeof(loss_report)))
+				return false;
+			pending_loss_report = false;
+		}
+
 		const pyro_message_type type = PYRO_MESSAGE_PROGRESS;
 		if (!tcp.write(&type, sizeof(type)))
 			return false;
@@ -690,7 +774,23 @@ bool PyroStreamClient::check_send_progress()
 	return true;
 }
 
-bool PyroStreamClient::wait_next_packet()
+bool PyroStreamClient::has_completed_packet() const
+{
+	return current != nullptr;
+}
+
+void PyroStreamClient::set_offline_codec_parameters(const pyro_codec_parameters &codec_)
+{
+	codec = codec_;
+	offline = true;
+}
+
+const pyro_progress_report &PyroStreamClient::get_progress_report() const
+{
+	return progress;
+}
+
+void PyroStreamClient::release_completed_packet()
 {
 	ReconstructedPacket *clear_packet = nullptr;
 	if (current == &video[0])
@@ -708,6 +808,11 @@ bool PyroStreamClient::wait_next_packet()
 		clear_packet->reset();
 
 	current = nullptr;
+}
+
+bool PyroStreamClient::wait_next_packet()
+{
+	release_completed_packet();
 
 	while (!current)
 		if (!iterate())
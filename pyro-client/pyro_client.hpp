@@ -16,6 +16,8 @@ public:
 	void prepare_decode(const pyro_payload_header &header);
 	void add_payload_data(const void *data, size_t size);
 	void add_fec_data(uint32_t subseq, const void *data, size_t size);
+	// Same as add_payload_data, but counts as a recovery if it completes the packet.
+	void add_redundant_data(const void *data, size_t size);
 
 	void reset();
 	bool is_complete() const;
@@ -28,6 +30,7 @@ public:
 	uint32_t packet_seq = 0;
 
 private:
+	enum { MaxPayloadBlocks = 128 * 1024, MaxFECDecodeBlocks = 16 * 1024 * 1024 };
 	std::vector<uint8_t> buffer;
 	std::vector<uint8_t> fec_buffer;
 	HybridLT::Decoder decoder;
@@ -53,6 +56,9 @@ public:
 	const void *get_packet_data() const;
 	size_t get_packet_size() const;
 	const pyro_payload_header &get_payload_header() const;
+	// Packets of the same stream which were lost right before the current packet and could not be reconstructed.
+	// For audio, the decoder should conceal this many packets before decoding the current one.
+	unsigned get_num_lost_packets_before_current() const;
 
 	bool send_target_phase_offset(int offset_us);
 
@@ -69,6 +75,20 @@ public:
 
 	double get_estimated_incoming_bitrate() const;
 
+	// Feeds a raw UDP datagram (pyro_payload_header + payload) through packet reconstruction.
+	// Normally called internally by wait_next_packet(). Exposed for replay and fuzzing.
+	// Returns false if the stream should be considered broken.
+	bool process_datagram(const void *data, size_t size);
+
+	// Drives reconstruction without blocking when datagrams are fed with process_datagram().
+	// A completed packet stays current until it is released.
+	bool has_completed_packet() const;
+	void release_completed_packet();
+
+	// For replaying traces. Nothing is sent to the server, and codec parameters are provided by the caller.
+	void set_offline_codec_parameters(const pyro_codec_parameters &codec);
+	const pyro_progress_report &get_progress_report() const;
+
 private:
 	PyroFling::Socket tcp, udp;
 	pyro_kick_state_flags kick_flags = 0;
@@ -81,11 +101,15 @@ private:
 	uint32_t last_completed_video_seq = UINT32_MAX;
 	uint32_t last_completed_audio_seq = UINT32_MAX;
 	pyro_progress_report progress = {};
+	pyro_loss_report loss_report = {};
 	bool request_immediate_feedback = false;
+	bool pending_loss_report = false;
+	bool offline = false;
 
 	ReconstructedPacket video[2];
 	ReconstructedPacket audio[2];
 	const ReconstructedPacket *current = nullptr;
+	unsigned lost_packets_before_current = 0;
 	pyro_codec_parameters codec = {};
 
 	std::chrono::time_point<std::chrono::steady_clock> last_progress_time;
@@ -0,0 +1,122 @@
+#include "packet_buffer.hpp"
+#include <algorithm>
+#include <string.h>
+
+namespace PyroFling
+{
+PacketBuffer::PacketBuffer(Util::IntrusivePtr<PacketBufferPool> pool_, std::vector<uint8_t> storage_, size_t size)
+	: pool(std::move(pool_)), storage(std::move(storage_)), length(size)
+{
+}
+
+const uint8_t *PacketBuffer::data() const
+{
+	return storage.data();
+}
+
+size_t PacketBuffer::size() const
+{
+	return length;
+}
+
+uint8_t *PacketBuffer::mutable_data()
+{
+	return storage.data();
+}
+
+void PacketBuffer::set_size(size_t size)
+{
+	length = std::min(size, storage.size());
+}
+
+size_t PacketBuffer::get_capacity() const
+{
+	return storage.size();
+}
+
+void PacketBufferDeleter::operator()(PacketBuffer *buffer)
+{
+	// The pool may be released along with its last buffer, so keep it alive until recycling is done.
+	auto pool = std::move(buffer->pool);
+	pool->recycle(buffer);
+}
+
+PacketBufferPool::PacketBufferPool(unsigned max_free_buffers_)
+	: max_free_buffers(max_free_buffers_)
+{
+	free_storage.reserve(max_free_buffers);
+}
+
+PacketBufferPool::~PacketBufferPool()
+{
+	// Every buffer holds a reference to its pool, so none can be alive here.
+	buffers.clear();
+}
+
+static size_t round_up_capacity(size_t size)
+{
+	// Power of two buckets, so storage from one packet can be reused for a packet of similar size.
+	size_t capacity = 4 * 1024;
+	while (capacity < size)
+		capacity *= 2;
+	return capacity;
+}
+
+PacketBufferHandle PacketBufferPool::allocate(size_t size)
+{
+	std::vector<uint8_t> storage;
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+
+		// Best fit, so a rare huge key frame does not get used for tiny audio packets.
+		auto best = free_storage.end();
+		for (auto itr = free_storage.begin(); itr != free_storage.end(); ++itr)
+			if (itr->size() >= size && (best == free_storage.end() || itr->size() < best->size()))
+				best = itr;
+
+		if (best != free_storage.end())
+		{
+			std::swap(*best, free_storage.back());
+			storage = std::move(free_storage.back());
+			free_storage.pop_back();
+		}
+	}
+
+	if (storage.empty())
+		storage.resize(round_up_capacity(size));
+
+	return PacketBufferHandle(buffers.allocate(reference_from_this(), std::move(storage), size));
+}
+
+PacketBufferHandle PacketBufferPool::copy(const void *data, size_t size)
+{
+	auto buffer = allocate(size);
+	if (size)
+		memcpy(buffer->mutable_data(), data, size);
+	return buffer;
+}
+
+void PacketBufferPool::recycle(PacketBuffer *buffer)
+{
+	auto storage = std::move(buffer->storage);
+	buffers.free(buffer);
+
+	std::lock_guard<std::mutex> holder{lock};
+
+	// When full, evict the smallest storage, since large packets are the expensive ones to allocate.
+	if (free_storage.size() >= max_free_buffers)
+	{
+		auto smallest = std::min_element(free_storage.begin(), free_storage.end(),
+		                                 [](const std::vector<uint8_t> &a, const std::vector<uint8_t> &b) {
+			                                 return a.size() < b.size();
+		                                 });
+
+		if (smallest == free_storage.end() || smallest->size() >= storage.size())
+			return;
+		*smallest = std::move(storage);
+	}
+	else
+		free_storage.push_back(std::move(storage));
+}
+}
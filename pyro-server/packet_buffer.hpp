@@ -0,0 +1,69 @@
+#pragma once
+
+#include "intrusive.hpp"
+#include "object_pool.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <vector>
+
+namespace PyroFling
+{
+class PacketBuffer;
+class PacketBufferPool;
+
+struct PacketBufferDeleter
+{
+	void operator()(PacketBuffer *buffer);
+};
+
+// An encoded packet which is filled once and then shared read-only by everything which sends or stores it.
+// The last reference hands the storage back to the pool it came from, so steady state streaming does not allocate.
+class PacketBuffer : public Util::IntrusivePtrEnabled<PacketBuffer, PacketBufferDeleter, Util::MultiThreadCounter>
+{
+public:
+	const uint8_t *data() const;
+	size_t size() const;
+
+	// Only valid until the buffer is shared.
+	uint8_t *mutable_data();
+	void set_size(size_t size);
+	size_t get_capacity() const;
+
+private:
+	friend class Util::ObjectPool<PacketBuffer>;
+	friend class PacketBufferPool;
+	friend struct PacketBufferDeleter;
+
+	PacketBuffer(Util::IntrusivePtr<PacketBufferPool> pool, std::vector<uint8_t> storage, size_t size);
+
+	Util::IntrusivePtr<PacketBufferPool> pool;
+	std::vector<uint8_t> storage;
+	size_t length;
+};
+using PacketBufferHandle = Util::IntrusivePtr<PacketBuffer>;
+
+class PacketBufferPool : public Util::ThreadSafeIntrusivePtrEnabled<PacketBufferPool>
+{
+public:
+	// Idle storage kept around for reuse. Enough for a few frames in flight to a slow output.
+	enum { DefaultMaxFreeBuffers = 64 };
+
+	explicit PacketBufferPool(unsigned max_free_buffers = DefaultMaxFreeBuffers);
+	~PacketBufferPool();
+
+	// Contents are undefined. Fill through mutable_data() before sharing.
+	PacketBufferHandle allocate(size_t size);
+	PacketBufferHandle copy(const void *data, size_t size);
+
+private:
+	friend struct PacketBufferDeleter;
+
+	std::mutex lock;
+	Util::ThreadSafeObjectPool<PacketBuffer> buffers;
+	std::vector<std::vector<uint8_t>> free_storage;
+	unsigned max_free_buffers;
+
+	void recycle(PacketBuffer *buffer);
+};
+}
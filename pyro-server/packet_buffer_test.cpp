@@ -0,0 +1,88 @@
+#include "packet_buffer.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace PyroFling;
+
+static bool check(const char *name, bool ok)
+{
+	fprintf(stderr, "%s: %s\n", name, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+int main()
+{
+	bool success = true;
+
+	{
+		auto pool = Util::make_handle<PacketBufferPool>();
+		const uint8_t payload[] = { 1, 2, 3, 4, 5 };
+		auto packet = pool->copy(payload, sizeof(payload));
+		success = check("copy", packet->size() == sizeof(payload) &&
+		                        memcmp(packet->data(), payload, sizeof(payload)) == 0) && success;
+
+		// Storage comes back to the pool when the last reference goes away.
+		const uint8_t *storage = packet->data();
+		auto shared = packet;
+		packet.reset();
+		success = check("shared", shared->data() == storage) && success;
+		shared.reset();
+
+		auto reused = pool->allocate(100);
+		success = check("reuse", reused->data() == storage && reused->size() == 100) && success;
+	}
+
+	{
+		// Best fit, so small packets do not take the storage of a big key frame.
+		auto pool = Util::make_handle<PacketBufferPool>();
+		auto big = pool->allocate(256 * 1024);
+		auto small = pool->allocate(200);
+		const uint8_t *big_storage = big->data();
+		const uint8_t *small_storage = small->data();
+		big.reset();
+		small.reset();
+
+		auto a = pool->allocate(300);
+		auto b = pool->allocate(100 * 1024);
+		success = check("best-fit", a->data() == small_storage && b->data() == big_storage) && success;
+	}
+
+	{
+		// Buffers keep their pool alive, so they can outlive whoever created the pool.
+		auto pool = Util::make_handle<PacketBufferPool>();
+		auto packet = pool->allocate(1000);
+		pool.reset();
+		memset(packet->mutable_data(), 0xaa, packet->size());
+		packet.reset();
+		success = check("outlive-pool", true) && success;
+	}
+
+	{
+		// Released from several threads at once, like sink threads in the output fanout.
+		auto pool = Util::make_handle<PacketBufferPool>(8);
+		std::vector<std::thread> threads;
+		for (unsigned t = 0; t < 4; t++)
+		{
+			threads.emplace_back([pool, t]() {
+				for (unsigned i = 0; i < 10000; i++)
+				{
+					auto packet = pool->allocate(100 + ((i * 7919 + t) % 20000));
+					packet->mutable_data()[0] = uint8_t(i);
+					auto copy = packet;
+					packet.reset();
+					if (copy->data()[0] != uint8_t(i))
+						abort();
+				}
+			});
+		}
+
+		for (auto &thread : threads)
+			thread.join();
+		success = check("threads", true) && success;
+	}
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,104 @@
+#include "phase_controller.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdlib.h>
+
+namespace PyroFling
+{
+int reconcile_phase_offsets(PhaseOffsetPolicy policy, int *values, size_t count, int sum)
+{
+	if (!count)
+		return 0;
+
+	switch (policy)
+	{
+	case PhaseOffsetPolicy::Sum:
+		return sum;
+
+	case PhaseOffsetPolicy::Primary:
+		return values[0];
+
+	case PhaseOffsetPolicy::Median:
+	default:
+		std::nth_element(values, values + count / 2, values + count);
+		return values[count / 2];
+	}
+}
+
+PhaseController::PhaseController(uint64_t period_ns_, const Options &options_)
+	: options(options_), period_ns(period_ns_)
+{
+}
+
+PhaseController::PhaseController(uint64_t period_ns_)
+	: PhaseController(period_ns_, Options{})
+{
+}
+
+PhaseController::Output PhaseController::update(bool has_error, int error_us)
+{
+	Output output = {};
+	double max_adjust = options.max_period_adjust * double(period_ns);
+	double max_step = options.max_phase_step * double(period_ns);
+	ticks_since_unlock++;
+
+	if (!has_error)
+	{
+		// Without feedback, drift back towards the nominal period.
+		integrator_ns -= integrator_ns / 64.0;
+		output.period_adjust_ns = int64_t(integrator_ns);
+		return output;
+	}
+
+	double error_ns = double(error_us) * 1000.0;
+	integrator_ns = std::max(-max_adjust, std::min(max_adjust, integrator_ns + options.ki * error_ns));
+	output.period_adjust_ns = int64_t(integrator_ns);
+
+	if (unsigned(abs(error_us)) > options.deadband_us)
+		output.phase_step_ns = int64_t(std::max(-max_step, std::min(max_step, options.kp * error_ns)));
+
+	// Lock detection with hysteresis, so a single outlier does not drop lock.
+	if (unsigned(abs(error_us)) <= options.lock_threshold_us)
+	{
+		in_threshold_count++;
+		out_threshold_count = 0;
+	}
+	else
+	{
+		in_threshold_count = 0;
+		out_threshold_count++;
+	}
+
+	if (!locked && in_threshold_count >= options.lock_reports)
+	{
+		locked = true;
+		lock_in_ticks = ticks_since_unlock;
+		jitter_sq_us = double(error_us) * double(error_us);
+	}
+	else if (locked && out_threshold_count >= options.lock_reports / 4)
+	{
+		locked = false;
+		ticks_since_unlock = 0;
+	}
+
+	if (locked)
+		jitter_sq_us += (double(error_us) * double(error_us) - jitter_sq_us) / 64.0;
+
+	return output;
+}
+
+bool PhaseController::is_locked() const
+{
+	return locked;
+}
+
+uint64_t PhaseController::get_lock_in_ticks() const
+{
+	return locked ? lock_in_ticks : 0;
+}
+
+double PhaseController::get_jitter_us() const
+{
+	return std::sqrt(jitter_sq_us);
+}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace PyroFling
+{
+// How phase offsets from multiple clients in one tick are combined into one error.
+enum class PhaseOffsetPolicy
+{
+	Sum, // Legacy behavior. Every message counts.
+	Median, // Median of the per-client averages.
+	Primary // Only the first client which reported a phase offset steers the heartbeat.
+};
+
+// values holds one averaged offset per client, in order of when the clients first reported.
+// The array may be reordered.
+int reconcile_phase_offsets(PhaseOffsetPolicy policy, int *values, size_t count, int sum);
+
+// PI controller which steers the server heartbeat so that clients receive frames at their preferred phase.
+// The error is the phase offset requested by clients in microseconds.
+// Positive means frames should arrive later, so the heartbeat slows down.
+// The proportional term shifts the next tick directly, and the integral term adjusts the period,
+// which absorbs any clock rate difference between server and client.
+class PhaseController
+{
+public:
+	struct Options
+	{
+		// Fraction of the error corrected per tick by shifting the next tick.
+		double kp = 0.05;
+		// Fraction of the error accumulated into the period per tick.
+		double ki = 0.002;
+		// Errors below this only feed the integrator, to avoid chasing jitter.
+		unsigned deadband_us = 200;
+		// Clamps relative to the nominal period.
+		double max_period_adjust = 0.01;
+		double max_phase_step = 0.01;
+		// Locked once the error stays below the threshold for this many consecutive reports.
+		unsigned lock_threshold_us = 1000;
+		unsigned lock_reports = 60;
+	};
+
+	explicit PhaseController(uint64_t period_ns, const Options &options);
+	explicit PhaseController(uint64_t period_ns);
+
+	struct Output
+	{
+		// Delay of the next tick relative to the current schedule.
+		int64_t phase_step_ns;
+		// Offset of the period relative to the nominal period.
+		int64_t period_adjust_ns;
+	};
+
+	// Called once per tick. If no client reported an error this tick, has_error is false.
+	Output update(bool has_error, int error_us);
+
+	bool is_locked() const;
+	// Number of ticks it took to lock, counted from start or from when lock was last lost.
+	uint64_t get_lock_in_ticks() const;
+	// RMS of the error while locked, in microseconds.
+	double get_jitter_us() const;
+
+private:
+	Options options;
+	uint64_t period_ns;
+	double integrator_ns = 0.0;
+
+	bool locked = false;
+	unsigned in_threshold_count = 0;
+	unsigned out_threshold_count = 0;
+	uint64_t ticks_since_unlock = 0;
+	uint64_t lock_in_ticks = 0;
+	double jitter_sq_us = 0.0;
+};
+}
@@ -0,0 +1,155 @@
+#include "phase_controller.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <random>
+#include <deque>
+#include <vector>
+
+using namespace PyroFling;
+
+// Simulates clients which display at a slightly different rate than the server heartbeat.
+// Every frame arrives after a fixed latency plus jitter, and the client reports how far away the arrival
+// was from its preferred phase, relative to its own vsync. Reports reach the server a few ticks late.
+struct SimulatedClient
+{
+	double period_ns;
+	double vsync_offset_ns;
+	double preferred_phase_ns;
+	double latency_ns;
+	double jitter_ns;
+	unsigned report_delay_ticks;
+	std::deque<int> pending_reports;
+
+	int measure(double arrival_ns, std::mt19937 &rnd)
+	{
+		std::normal_distribution<double> dist(0.0, jitter_ns);
+		arrival_ns += latency_ns + dist(rnd);
+
+		double phase = arrival_ns - vsync_offset_ns - preferred_phase_ns;
+		double wrapped = phase - period_ns * std::floor(phase / period_ns + 0.5);
+		return int(-wrapped / 1000.0);
+	}
+};
+
+struct SimulationResult
+{
+	bool locked;
+	uint64_t lock_in_ticks;
+	double jitter_us;
+	double mean_abs_error_us;
+};
+
+static SimulationResult run_simulation(std::vector<SimulatedClient> clients, PhaseOffsetPolicy policy,
+                                       unsigned num_ticks, uint64_t seed)
+{
+	const uint64_t period_ns = 1000000000ull / 60;
+	PhaseController controller{period_ns};
+	std::mt19937 rnd(seed);
+
+	double tick_ns = 0.0;
+	double period_adjust_ns = 0.0;
+	double total_abs_error = 0.0;
+	unsigned num_errors = 0;
+
+	for (unsigned tick = 0; tick < num_ticks; tick++)
+	{
+		int values[16];
+		size_t count = 0;
+		int sum = 0;
+
+		for (auto &client : clients)
+		{
+			client.pending_reports.push_back(client.measure(tick_ns, rnd));
+			if (client.pending_reports.size() > client.report_delay_ticks)
+			{
+				int report = client.pending_reports.front();
+				client.pending_reports.pop_front();
+				values[count++] = report;
+				sum += report;
+			}
+		}
+
+		int error_us = reconcile_phase_offsets(policy, values, count, sum);
+		auto output = controller.update(count != 0, error_us);
+
+		// Measure steady state over the last quarter.
+		if (tick >= num_ticks * 3 / 4 && count)
+		{
+			total_abs_error += std::abs(double(error_us));
+			num_errors++;
+		}
+
+		period_adjust_ns = double(output.period_adjust_ns);
+		tick_ns += double(period_ns) + period_adjust_ns + double(output.phase_step_ns);
+	}
+
+	SimulationResult result = {};
+	result.locked = controller.is_locked();
+	result.lock_in_ticks = controller.get_lock_in_ticks();
+	result.jitter_us = controller.get_jitter_us();
+	result.mean_abs_error_us = num_errors ? total_abs_error / num_errors : 0.0;
+	return result;
+}
+
+static bool check(const char *tag, const SimulationResult &result,
+                  uint64_t max_lock_in_ticks, double max_jitter_us, double max_error_us)
+{
+	fprintf(stderr, "%s: locked %d after %llu ticks, jitter %.1f us, mean error %.1f us.\n",
+	        tag, int(result.locked), static_cast<unsigned long long>(result.lock_in_ticks),
+	        result.jitter_us, result.mean_abs_error_us);
+
+	if (!result.locked || result.lock_in_ticks > max_lock_in_ticks ||
+	    result.jitter_us > max_jitter_us || result.mean_abs_error_us > max_error_us)
+	{
+		fprintf(stderr, "%s: failed.\n", tag);
+		return false;
+	}
+
+	return true;
+}
+
+int main()
+{
+	const double period_ns = 1e9 / 60.0;
+	bool success = true;
+
+	// One client, 0.3% slower display clock, 4 ticks of feedback delay, 300 us jitter.
+	{
+		SimulatedClient client = { period_ns * 1.003, 5e6, 0.0, 20e6, 300e3, 4, {} };
+		success = check("single", run_simulation({ client }, PhaseOffsetPolicy::Median, 3600, 1),
+		                600, 500.0, 400.0) && success;
+	}
+
+	// Faster clock with a larger phase error at start.
+	{
+		SimulatedClient client = { period_ns * 0.997, 12e6, 2e6, 35e6, 300e3, 6, {} };
+		success = check("fast-clock", run_simulation({ client }, PhaseOffsetPolicy::Median, 3600, 2),
+		                600, 500.0, 400.0) && success;
+	}
+
+	// Three clients sharing the same display clock, one of which has a constant bias.
+	// The median ignores the outlier, while a sum would overshoot.
+	{
+		SimulatedClient a = { period_ns * 1.002, 5e6, 0.0, 20e6, 300e3, 4, {} };
+		SimulatedClient b = a;
+		b.latency_ns += 200e3;
+		SimulatedClient c = a;
+		c.preferred_phase_ns = 4e6;
+		success = check("median", run_simulation({ a, b, c }, PhaseOffsetPolicy::Median, 3600, 3),
+		                600, 500.0, 400.0) && success;
+		success = check("primary", run_simulation({ a, b, c }, PhaseOffsetPolicy::Primary, 3600, 4),
+		                600, 500.0, 400.0) && success;
+	}
+
+	{
+		int values[] = { 100, -50, 4000, 20, 10 };
+		if (reconcile_phase_offsets(PhaseOffsetPolicy::Median, values, 5, 0) != 20)
+		{
+			fprintf(stderr, "Median reconciliation failed.\n");
+			success = false;
+		}
+	}
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
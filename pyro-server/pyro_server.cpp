@@ -22,6 +22,11 @@ PyroStreamConnection::PyroStreamConnection(
 	packet_seq_video = cookie & ((1 << PYRO_PAYLOAD_PACKET_SEQ_BITS) - 1);
 	packet_seq_audio = (~cookie) & ((1 << PYRO_PAYLOAD_PACKET_SEQ_BITS) - 1);
 
+	// Enough for a typical frame. A huge key frame grows this once.
+	subpacket_headers.reserve(256);
+	subpacket_data.reserve(256);
+	subpacket_sizes.reserve(256);
+
 	timer_fd = PyroFling::FileHandle(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC));
 	add_reference();
 	dispatcher.add_connection(timer_fd.dup(), this, 1, PyroFling::Dispatcher::ConnectionType::Input);
@@ -38,6 +43,9 @@ PyroStreamConnection::PyroStreamConnection(
 
 	needs_key_frame.store(false, std::memory_order_relaxed);
 	has_pending_video_packet_loss.store(false, std::memory_order_relaxed);
+	has_loss_report.store(false, std::memory_order_relaxed);
+	pending_loss_next_video_seq.store(UINT32_MAX, std::memory_order_relaxed);
+	target_rendition.store(0, std::memory_order_relaxed);
 }
 
 bool PyroStreamConnection::requires_idr()
@@ -45,11 +53,100 @@ bool PyroStreamConnection::requires_idr()
 	return (kick_flags & PYRO_KICK_STATE_VIDEO_BIT) != 0 && needs_key_frame.load(std::memory_order_relaxed);
 }
 
+bool PyroStreamConnection::supports_loss_report() const
+{
+	return has_loss_report.load(std::memory_order_relaxed);
+}
+
+bool PyroStreamConnection::get_and_clear_pending_loss_repair()
+{
+	uint32_t next_seq = pending_loss_next_video_seq.exchange(UINT32_MAX, std::memory_order_relaxed);
+	if (next_seq == UINT32_MAX || (kick_flags & PYRO_KICK_STATE_VIDEO_BIT) == 0)
+		return false;
+
+	// If the key frame is too old, the sequence delta is ambiguous.
+	if (video_packets_since_key_frame > (PYRO_PAYLOAD_PACKET_SEQ_MASK >> 1))
+		return true;
+
+	// A key frame sent after the gap is already repairing it, so don't spend another one.
+	return pyro_payload_get_packet_seq_delta(last_key_frame_video_seq, next_seq) < 0;
+}
+
+void PyroStreamConnection::set_num_renditions(unsigned num)
+{
+	rendition_selector.set_num_renditions(num);
+	target_rendition.store(rendition_selector.get_rendition(), std::memory_order_relaxed);
+}
+
+unsigned PyroStreamConnection::get_current_rendition() const
+{
+	return current_rendition;
+}
+
+bool PyroStreamConnection::get_and_clear_pending_rendition_switch(unsigned rendition)
+{
+	unsigned target = target_rendition.load(std::memory_order_relaxed);
+
+	// If the client changed its mind before the switch completed, a later switch needs a new key frame.
+	if (target == current_rendition)
+		requested_rendition = current_rendition;
+
+	if (target != rendition || target == current_rendition || target == requested_rendition)
+		return false;
+
+	requested_rendition = target;
+	return true;
+}
+
+bool PyroStreamConnection::has_pending_key_frame_request(bool idr_on_packet_loss) const
+{
+	if ((kick_flags & PYRO_KICK_STATE_VIDEO_BIT) == 0)
+		return false;
+
+	if (needs_key_frame.load(std::memory_order_relaxed))
+		return true;
+
+	unsigned target = target_rendition.load(std::memory_order_relaxed);
+	if (target != current_rendition && target != requested_rendition)
+		return true;
+
+	if (!idr_on_packet_loss)
+		return false;
+
+	// Might already be repaired by a key frame in flight, but then an extra encode is harmless.
+	return pending_loss_next_video_seq.load(std::memory_order_relaxed) != UINT32_MAX ||
+	       (has_pending_video_packet_loss.load(std::memory_order_relaxed) && !supports_loss_report());
+}
+
 void PyroStreamConnection::set_forward_error_correction(bool enable)
 {
 	fec = enable;
 }
 
+void PyroStreamConnection::set_trace_writer(TraceWriter *trace_)
+{
+	trace = trace_;
+}
+
+bool PyroStreamConnection::send_control_message(const PyroFling::FileHandle &fd, pyro_message_type type,
+                                                const void *payload, size_t size)
+{
+	if (trace)
+		trace->write_record(TraceRecordType::TCP, cookie, &type, sizeof(type), payload, size);
+
+	if (!send_stream_message(fd, &type, sizeof(type)))
+		return false;
+	if (size && !send_stream_message(fd, payload, size))
+		return false;
+	return true;
+}
+
+void PyroStreamConnection::trace_datagram(const pyro_payload_header &header, const void *data, size_t size)
+{
+	if (trace)
+		trace->write_record(TraceRecordType::UDP, cookie, &header, sizeof(header), data, size);
+}
+
 bool PyroStreamConnection::get_and_clear_pending_video_packet_loss()
 {
 	return has_pending_video_packet_loss.exchange(false, std::memory_order_relaxed);
@@ -86,10 +183,7 @@ bool PyroStreamConnection::handle(const PyroFling::FileHandle &fd, uint32_t id)
 		case PYRO_MESSAGE_HELLO:
 		{
 			printf("HELLO for %s @ %s\n", remote_addr.c_str(), remote_port.c_str());
-			const pyro_message_type type = PYRO_MESSAGE_COOKIE;
-			if (!send_stream_message(fd, &type, sizeof(type)))
-				return false;
-			if (!send_stream_message(fd, &cookie, sizeof(cookie)))
+			if (!send_control_message(fd, PYRO_MESSAGE_COOKIE, &cookie, sizeof(cookie)))
 				return false;
 			break;
 		}
@@ -98,21 +192,24 @@ bool PyroStreamConnection::handle(const PyroFling::FileHandle &fd, uint32_t id)
 		{
 			memcpy(&kick_flags, tcp.split.payload, sizeof(kick_flags));
 
+			// Still need to consume the message, or we would reprocess it forever.
 			if (kicked)
 			{
 				printf("REDUNDANT KICK for %s @ %s\n", remote_addr.c_str(), remote_port.c_str());
-				return true;
+				break;
 			}
 
 			auto codec = server.get_codec_parameters();
 
+			// Audio packets are small compared to video, so redundancy is always granted when asked for.
+			audio_redundancy = (kick_flags & PYRO_KICK_STATE_AUDIO_REDUNDANCY_BIT) != 0 &&
+			                   codec.audio_codec != PYRO_AUDIO_CODEC_NONE;
+			codec.audio_protection = audio_redundancy ? PYRO_AUDIO_PROTECTION_REDUNDANCY : PYRO_AUDIO_PROTECTION_NONE;
+
 			if (udp_remote && codec.video_codec != PYRO_VIDEO_CODEC_NONE)
 			{
 				printf("KICK -> OK for %s @ %s\n", remote_addr.c_str(), remote_port.c_str());
-				const pyro_message_type type = PYRO_MESSAGE_CODEC_PARAMETERS;
-				if (!send_stream_message(fd, &type, sizeof(type)))
-					return false;
-				if (!send_stream_message(fd, &codec, sizeof(codec)))
+				if (!send_control_message(fd, PYRO_MESSAGE_CODEC_PARAMETERS, &codec, sizeof(codec)))
 					return false;
 				kicked = true;
 				needs_key_frame.store(true, std::memory_order_relaxed);
@@ -120,15 +217,13 @@ bool PyroStreamConnection::handle(const PyroFling::FileHandle &fd, uint32_t id)
 			else if (udp_remote)
 			{
 				printf("KICK -> AGAIN for %s @ %s\n", remote_addr.c_str(), remote_port.c_str());
-				const pyro_message_type type = PYRO_MESSAGE_AGAIN;
-				if (!send_stream_message(fd, &type, sizeof(type)))
+				if (!send_control_message(fd, PYRO_MESSAGE_AGAIN, nullptr, 0))
 					return false;
 			}
 			else
 			{
 				printf("KICK -> NAK for %s @ %s\n", remote_addr.c_str(), remote_port.c_str());
-				const pyro_message_type type = PYRO_MESSAGE_NAK;
-				if (!send_stream_message(fd, &type, sizeof(type)))
+				if (!send_control_message(fd, PYRO_MESSAGE_NAK, nullptr, 0))
 					return false;
 			}
 
@@ -166,13 +261,30 @@ bool PyroStreamConnection::handle(const PyroFling::FileHandle &fd, uint32_t id)
 			if (total_dropped_video_packets != progress.total_dropped_video_packets)
 				has_pending_video_packet_loss.store(true, std::memory_order_relaxed);
 			total_dropped_video_packets = progress.total_dropped_video_packets;
+
+			unsigned rendition = rendition_selector.update(progress);
+			if (rendition != target_rendition.load(std::memory_order_relaxed))
+			{
+				printf("RENDITION for %s @ %s: switching to %u.\n",
+				       remote_addr.c_str(), remote_port.c_str(), rendition);
+				target_rendition.store(rendition, std::memory_order_relaxed);
+			}
+			break;
+		}
+
+		case PYRO_MESSAGE_LOSS_REPORT:
+		{
+			pyro_loss_report report;
+			memcpy(&report, tcp.split.payload, sizeof(report));
+			has_loss_report.store(true, std::memory_order_relaxed);
+			pending_loss_next_video_seq.store(report.next_video_seq & PYRO_PAYLOAD_PACKET_SEQ_MASK,
+			                                  std::memory_order_relaxed);
 			break;
 		}
 
 		default:
 		{
-			const pyro_message_type type = PYRO_MESSAGE_NAK;
-			if (!send_stream_message(fd, &type, sizeof(type)))
+			if (!send_control_message(fd, PYRO_MESSAGE_NAK, nullptr, 0))
 				return false;
 			break;
 		}
@@ -193,17 +305,17 @@ void PyroStreamConnection::release_id(uint32_t id)
 	release_reference();
 }
 
-void PyroStreamConnection::write_packet(int64_t pts, int64_t dts,
+bool PyroStreamConnection::write_packet(int64_t pts, int64_t dts,
                                         const void *data_, size_t size,
                                         bool is_audio, bool is_key_frame)
 {
 	if (!udp_remote || !kicked)
-		return;
+		return false;
 
 	if (is_audio && (kick_flags & PYRO_KICK_STATE_AUDIO_BIT) == 0)
-		return;
+		return false;
 	if (!is_audio && (kick_flags & PYRO_KICK_STATE_VIDEO_BIT) == 0)
-		return;
+		return false;
 
 	auto &seq = is_audio ? packet_seq_audio : packet_seq_video;
 
@@ -237,31 +349,48 @@ void PyroStreamConnection::write_packet(int64_t pts, int64_t dts,
 		header.num_fec_blocks = num_fec_blocks;
 	}
 
-	uint32_t subseq = 0;
+	subpacket_headers.clear();
+	subpacket_data.clear();
+	subpacket_sizes.clear();
 
-	Util::SmallVector<pyro_payload_header, 1024> headers;
-	Util::SmallVector<const void *, 1024> data_ptrs;
-	Util::SmallVector<unsigned, 1024> data_sizes;
+	auto split_subpackets = [&](pyro_payload_header subheader, const uint8_t *payload, size_t payload_size) {
+		uint32_t subseq = 0;
+		for (size_t i = 0; i < payload_size; i += PYRO_MAX_PAYLOAD_SIZE)
+		{
+			subheader.encoded &= ~PYRO_PAYLOAD_PACKET_BEGIN_BIT;
+			if (i == 0)
+				subheader.encoded |= PYRO_PAYLOAD_PACKET_BEGIN_BIT;
 
-	auto *data = static_cast<const uint8_t *>(data_);
-	for (size_t i = 0; i < size; i += PYRO_MAX_PAYLOAD_SIZE)
-	{
-		header.encoded &= ~PYRO_PAYLOAD_PACKET_BEGIN_BIT;
-		if (i == 0)
-			header.encoded |= PYRO_PAYLOAD_PACKET_BEGIN_BIT;
+			subheader.encoded &= ~(PYRO_PAYLOAD_SUBPACKET_SEQ_MASK << PYRO_PAYLOAD_SUBPACKET_SEQ_OFFSET);
+			subheader.encoded |= subseq << PYRO_PAYLOAD_SUBPACKET_SEQ_OFFSET;
 
-		header.encoded &= ~(PYRO_PAYLOAD_SUBPACKET_SEQ_MASK << PYRO_PAYLOAD_SUBPACKET_SEQ_OFFSET);
-		header.encoded |= subseq << PYRO_PAYLOAD_SUBPACKET_SEQ_OFFSET;
+			subpacket_headers.push_back(subheader);
+			subpacket_data.push_back(payload + i);
+			subpacket_sizes.push_back(std::min<unsigned>(PYRO_MAX_PAYLOAD_SIZE, payload_size - i));
 
-		headers.push_back(header);
-		data_ptrs.push_back(data + i);
-		data_sizes.push_back(std::min<unsigned>(PYRO_MAX_PAYLOAD_SIZE, size - i));
+			subseq = (subseq + 1) & PYRO_PAYLOAD_SUBPACKET_SEQ_MASK;
+		}
+	};
 
-		subseq = (subseq + 1) & PYRO_PAYLOAD_SUBPACKET_SEQ_MASK;
+	// The copy of the previous packet goes first. If the previous packet was lost,
+	// the client can complete it before the current packet makes it obsolete.
+	// Sending it one packet later also spreads the two copies apart in time, which helps with bursty loss.
+	if (is_audio && audio_redundancy && last_audio_packet)
+	{
+		auto redundant_header = last_audio_header;
+		redundant_header.encoded |= PYRO_PAYLOAD_PACKET_FEC_BIT;
+		split_subpackets(redundant_header, last_audio_packet->data(), last_audio_packet->size());
 	}
 
-	if (dispatcher.write_udp_datagrams(udp_remote, headers.size(), sizeof(pyro_payload_header),
-	                                   headers.data(), data_ptrs.data(), data_sizes.data()) < 0)
+	auto *data = static_cast<const uint8_t *>(data_);
+	split_subpackets(header, data, size);
+
+	for (size_t i = 0; i < subpacket_headers.size(); i++)
+		trace_datagram(subpacket_headers[i], subpacket_data[i], subpacket_sizes[i]);
+
+	if (dispatcher.write_udp_datagrams(udp_remote, subpacket_headers.size(), sizeof(pyro_payload_header),
+	                                   subpacket_headers.data(), subpacket_data.data(),
+	                                   subpacket_sizes.data()) < 0)
 	{
 		fprintf(stderr, "Error writing UDP datagram. Congested buffers?\n");
 	}
@@ -284,6 +413,7 @@ void PyroStreamConnection::write_packet(int64_t pts, int64_t dts,
 
 			header.encoded &= ~(PYRO_PAYLOAD_SUBPACKET_SEQ_MASK << PYRO_PAYLOAD_SUBPACKET_SEQ_OFFSET);
 			header.encoded |= i << PYRO_PAYLOAD_SUBPACKET_SEQ_OFFSET;
+			trace_datagram(header, xor_data, sizeof(xor_data));
 
 			if (dispatcher.write_udp_datagram(
 					udp_remote, &header, sizeof(header),
@@ -294,18 +424,43 @@ void PyroStreamConnection::write_packet(int64_t pts, int64_t dts,
 		}
 	}
 
+	if (is_audio && audio_redundancy)
+		last_audio_header = header;
+
+	if (!is_audio)
+	{
+		if (is_key_frame)
+		{
+			last_key_frame_video_seq = seq;
+			video_packets_since_key_frame = 0;
+		}
+		else if (video_packets_since_key_frame != UINT32_MAX)
+			video_packets_since_key_frame++;
+	}
+
 	seq = (seq + 1) & PYRO_PAYLOAD_PACKET_SEQ_MASK;
+	return true;
 }
 
-void PyroStreamConnection::write_video_packet(int64_t pts, int64_t dts,
+void PyroStreamConnection::write_video_packet(unsigned rendition, int64_t pts, int64_t dts,
                                               const void *data, size_t size, bool is_key_frame)
 {
+	// Sequence numbers continue across a switch, so the client just sees a key frame.
+	if (rendition != current_rendition)
+	{
+		if (!is_key_frame || rendition != target_rendition.load(std::memory_order_relaxed))
+			return;
+		current_rendition = rendition;
+	}
+
 	write_packet(pts, dts, data, size, false, is_key_frame);
 }
 
-void PyroStreamConnection::write_audio_packet(int64_t pts, int64_t dts, const void *data, size_t size)
+void PyroStreamConnection::write_audio_packet(int64_t pts, int64_t dts, const PacketBufferHandle &packet)
 {
-	write_packet(pts, dts, data, size, true, false);
+	// Holding a reference is enough, audio buffers are never written to after they are shared.
+	if (write_packet(pts, dts, packet->data(), packet->size(), true, false) && audio_redundancy)
+		last_audio_packet = packet;
 }
 
 void PyroStreamConnection::handle_udp_datagram(
@@ -350,7 +505,7 @@ void PyroStreamConnection::handle_udp_datagram(
 		{
 			pyro_phase_offset phase = {};
 			memcpy(&phase, msg, sizeof(phase));
-			server.set_phase_offset(phase.ideal_phase_offset_us);
+			server.set_phase_offset(this, phase.ideal_phase_offset_us);
 		}
 		break;
 	}
@@ -389,6 +544,7 @@ void PyroStreamConnection::handle_udp_datagram(
 			pyro_payload_header header = {};
 			header.encoded |= PYRO_PAYLOAD_KEY_FRAME_BIT | PYRO_PAYLOAD_STREAM_TYPE_BIT;
 			header.encoded |= state.seq << PYRO_PAYLOAD_PACKET_SEQ_OFFSET;
+			trace_datagram(header, &ext, sizeof(ext));
 			dispatcher_.write_udp_datagram(udp_remote, &header, sizeof(header), &ext, sizeof(ext));
 		}
 		break;
@@ -418,24 +574,41 @@ bool PyroStreamServer::register_tcp_handler(PyroFling::Dispatcher &dispatcher, c
 	auto conn = Util::make_handle<PyroStreamConnection>(dispatcher, *this, remote, ++cookie);
 	conn->add_reference();
 	conn->set_forward_error_correction(fec);
+	conn->set_num_renditions(num_renditions);
+	if (trace.is_open())
+		conn->set_trace_writer(&trace);
 	handler = conn.get();
 	std::lock_guard<std::mutex> holder{lock};
 	connections.push_back(std::move(conn));
 	return true;
 }
 
-void PyroStreamServer::write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame)
+void PyroStreamServer::set_num_renditions(unsigned count)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	num_renditions = std::max(1u, std::min<unsigned>(count, MaxRenditions));
+	for (auto &conn : connections)
+		conn->set_num_renditions(num_renditions);
+}
+
+void PyroStreamServer::write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame,
+                                          unsigned rendition)
 {
 	std::lock_guard<std::mutex> holder{lock};
 	for (auto &conn : connections)
-		conn->write_video_packet(pts, dts, data, size, is_key_frame);
+		conn->write_video_packet(rendition, pts, dts, data, size, is_key_frame);
 }
 
 void PyroStreamServer::write_audio_packet(int64_t pts, int64_t dts, const void *data, size_t size)
+{
+	write_audio_packet(pts, dts, packet_pool->copy(data, size));
+}
+
+void PyroStreamServer::write_audio_packet(int64_t pts, int64_t dts, const PacketBufferHandle &packet)
 {
 	std::lock_guard<std::mutex> holder{lock};
 	for (auto &conn : connections)
-		conn->write_audio_packet(pts, dts, data, size);
+		conn->write_audio_packet(pts, dts, packet);
 }
 
 void PyroStreamServer::handle_udp_datagram(PyroFling::Dispatcher &dispatcher, const PyroFling::RemoteAddress &remote,
@@ -454,20 +627,44 @@ void PyroStreamServer::release_connection(PyroStreamConnection *conn)
 	                        });
 	if (itr != connections.end())
 		connections.erase(itr);
+
+	auto report_itr = std::find_if(phase_reports.begin(), phase_reports.end(),
+	                               [conn](const PhaseReport &report) { return report.conn == conn; });
+	if (report_itr != phase_reports.end())
+		phase_reports.erase(report_itr);
 }
 
-bool PyroStreamServer::should_force_idr()
+bool PyroStreamServer::should_force_idr(unsigned rendition)
 {
-	// Rate limit forced IDR frames to avoid overwhelming the encoder and bandwidth.
-	if (idr_counter++ < 60)
+	std::lock_guard<std::mutex> holder{lock};
+	if (rendition >= num_renditions)
 		return false;
 
+	// Rate limit forced IDR frames to avoid overwhelming the encoder and bandwidth.
+	// Loss reports are exact, so they bypass the rate limit. A key frame in flight already suppresses repeats.
+	// Rendition switches are rare and already paced by the rendition selector.
+	auto &idr_counter = idr_counters[rendition];
+	bool rate_limited = idr_counter++ < 60;
 	bool requires_idr = false;
 
-	std::lock_guard<std::mutex> holder{lock};
 	for (auto &conn : connections)
 	{
-		bool has_pending_packet_loss = conn->get_and_clear_pending_video_packet_loss();
+		if (conn->get_and_clear_pending_rendition_switch(rendition))
+			requires_idr = true;
+
+		// Loss only concerns the rendition the client is decoding.
+		if (conn->get_current_rendition() != rendition)
+			continue;
+
+		if (idr_on_packet_loss && conn->get_and_clear_pending_loss_repair())
+			requires_idr = true;
+
+		if (rate_limited)
+			continue;
+
+		// Older clients only report a dropped packet count.
+		bool has_pending_packet_loss = conn->get_and_clear_pending_video_packet_loss() &&
+		                               !conn->supports_loss_report();
 		if ((has_pending_packet_loss && idr_on_packet_loss) || conn->requires_idr())
 			requires_idr = true;
 	}
@@ -477,19 +674,64 @@ bool PyroStreamServer::should_force_idr()
 	return requires_idr;
 }
 
-PyroStreamServer::PyroStreamServer()
+bool PyroStreamServer::has_pending_idr()
 {
-	phase_offset_us.store(0, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> holder{lock};
+	for (auto &conn : connections)
+		if (conn->has_pending_key_frame_request(idr_on_packet_loss))
+			return true;
+	return false;
 }
 
-void PyroStreamServer::set_phase_offset(int phase_offset_us_)
+void PyroStreamServer::set_phase_offset(PyroStreamConnection *conn, int phase_offset_us)
 {
-	phase_offset_us.fetch_add(phase_offset_us_, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> holder{lock};
+	auto itr = std::find_if(phase_reports.begin(), phase_reports.end(),
+	                        [conn](const PhaseReport &report) { return report.conn == conn; });
+
+	if (itr == phase_reports.end())
+	{
+		phase_reports.push_back({ conn, 0, 0 });
+		itr = phase_reports.end() - 1;
+	}
+
+	itr->sum_us += phase_offset_us;
+	itr->count++;
 }
 
-int PyroStreamServer::get_phase_offset_us() const
+bool PyroStreamServer::get_phase_offset_us(int &phase_offset_us)
 {
-	return phase_offset_us.exchange(0, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> holder{lock};
+	Util::SmallVector<int, 16> values;
+	int64_t sum = 0;
+
+	// Primary only listens to the first client.
+	if (phase_offset_policy == PhaseOffsetPolicy::Primary && !phase_reports.empty() && !phase_reports.front().count)
+		return false;
+
+	for (auto &report : phase_reports)
+	{
+		if (!report.count)
+			continue;
+
+		values.push_back(int(report.sum_us / int64_t(report.count)));
+		sum += report.sum_us;
+		report.sum_us = 0;
+		report.count = 0;
+	}
+
+	if (values.empty())
+		return false;
+
+	sum = std::max<int64_t>(INT32_MIN, std::min<int64_t>(INT32_MAX, sum));
+	phase_offset_us = reconcile_phase_offsets(phase_offset_policy, values.data(), values.size(), int(sum));
+	return true;
+}
+
+void PyroStreamServer::set_phase_offset_policy(PhaseOffsetPolicy policy)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	phase_offset_policy = policy;
 }
 
 const pyro_gamepad_state *PyroStreamServer::get_updated_gamepad_state()
@@ -509,6 +751,11 @@ void PyroStreamServer::set_idr_on_packet_loss(bool enable)
 	idr_on_packet_loss = enable;
 }
 
+bool PyroStreamServer::open_trace(const char *path)
+{
+	return trace.open(path);
+}
+
 void PyroStreamServer::reset_gamepad_ownership()
 {
 	current_gamepad_remote = {};
@@ -3,6 +3,10 @@
 #include "listener.hpp"
 #include "intrusive.hpp"
 #include "lt_encode.hpp"
+#include "pyro_trace.hpp"
+#include "phase_controller.hpp"
+#include "rendition_selector.hpp"
+#include "packet_buffer.hpp"
 #include <atomic>
 #include <mutex>
 
@@ -17,7 +21,7 @@ public:
 	virtual void release_connection(PyroStreamConnection *conn) = 0;
 	virtual pyro_codec_parameters get_codec_parameters() = 0;
 	virtual int64_t sample_reference_pts() = 0;
-	virtual void set_phase_offset(int phase_us) = 0;
+	virtual void set_phase_offset(PyroStreamConnection *conn, int phase_us) = 0;
 	virtual void set_gamepad_state(const RemoteAddress &remote, const pyro_gamepad_state &state) = 0;
 	virtual void reset_gamepad_ownership() = 0;
 };
@@ -31,17 +35,32 @@ public:
 	bool handle(const PyroFling::FileHandle &fd, uint32_t id) override;
 	void release_id(uint32_t id) override;
 
-	void write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame);
-	void write_audio_packet(int64_t pts, int64_t dts, const void *data, size_t size);
+	// Packets from other renditions than the current one are ignored,
+	// except for a key frame from the target rendition, which completes a switch.
+	void write_video_packet(unsigned rendition, int64_t pts, int64_t dts,
+	                        const void *data, size_t size, bool is_key_frame);
+	// The packet is kept alive if it needs to be sent again for audio redundancy.
+	void write_audio_packet(int64_t pts, int64_t dts, const PacketBufferHandle &packet);
 
 	void handle_udp_datagram(PyroFling::Dispatcher &dispatcher,
 	                         const PyroFling::RemoteAddress &remote,
 	                         const void *msg, size_t size);
 
 	bool requires_idr();
+	// Returns true if a reported loss is not covered by a key frame sent after it.
+	bool get_and_clear_pending_loss_repair();
+	bool supports_loss_report() const;
 	void set_forward_error_correction(bool enable);
+	void set_trace_writer(TraceWriter *trace);
 	bool get_and_clear_pending_video_packet_loss();
 
+	void set_num_renditions(unsigned num);
+	unsigned get_current_rendition() const;
+	// Returns true once per switch, when the connection starts waiting for a key frame from the target rendition.
+	bool get_and_clear_pending_rendition_switch(unsigned rendition);
+	// True if the next encode would be forced to a key frame for this connection. Does not clear anything.
+	bool has_pending_key_frame_request(bool idr_on_packet_loss) const;
+
 private:
 	PyroStreamConnectionServerInterface &server;
 	PyroFling::RemoteAddress tcp_remote;
@@ -51,14 +70,34 @@ private:
 	std::string remote_addr, remote_port;
 	std::atomic<bool> needs_key_frame;
 	std::atomic<bool> has_pending_video_packet_loss;
+	std::atomic<bool> has_loss_report;
+	std::atomic<uint32_t> pending_loss_next_video_seq;
 	HybridLT::Encoder encoder;
 	uint64_t total_dropped_video_packets = 0;
+	RenditionSelector rendition_selector;
+	std::atomic<unsigned> target_rendition;
+	// Guarded by the server lock.
+	unsigned current_rendition = 0;
+	unsigned requested_rendition = 0;
 
 	uint64_t cookie;
 	uint32_t packet_seq_video = 0;
 	uint32_t packet_seq_audio = 0;
+	// Only touched by the encoder thread.
+	uint32_t last_key_frame_video_seq = 0;
+	uint32_t video_packets_since_key_frame = UINT32_MAX;
 	pyro_kick_state_flags kick_flags = 0;
 	bool fec = false;
+	bool audio_redundancy = false;
+	// Sent again along with the next audio packet if the client negotiated audio redundancy.
+	PacketBufferHandle last_audio_packet;
+	pyro_payload_header last_audio_header = {};
+	// Subpacket headers and payload pointers for one sendmmsg batch.
+	// Reused for every packet, so packetization does not allocate once capacity has grown to the largest frame.
+	std::vector<pyro_payload_header> subpacket_headers;
+	std::vector<const void *> subpacket_data;
+	std::vector<unsigned> subpacket_sizes;
+	TraceWriter *trace = nullptr;
 
 	union
 	{
@@ -74,13 +113,15 @@ private:
 	uint16_t last_gamepad_seq = 0;
 	bool kicked = false;
 	bool valid_gamepad_seq = false;
-	void write_packet(int64_t pts, int64_t dts, const void *data_, size_t size, bool is_audio, bool is_key_frame);
+	bool write_packet(int64_t pts, int64_t dts, const void *data_, size_t size, bool is_audio, bool is_key_frame);
+	bool send_control_message(const PyroFling::FileHandle &fd, pyro_message_type type,
+	                          const void *payload, size_t size);
+	void trace_datagram(const pyro_payload_header &header, const void *data, size_t size);
 };
 
 class PyroStreamServer final : public PyroStreamConnectionServerInterface
 {
 public:
-	PyroStreamServer();
 	void set_codec_parameters(const pyro_codec_parameters &codec_);
 	pyro_codec_parameters get_codec_parameters() override;
 
@@ -88,15 +129,31 @@ public:
 	                          const PyroFling::RemoteAddress &remote,
 	                          PyroFling::Handler *&handler);
 
-	void write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame);
+	enum { MaxRenditions = 8 };
+
+	// With simulcast, every rendition is encoded separately from the same frame,
+	// and each client receives one of them. Rendition 0 has the highest quality.
+	// The renditions share codec parameters, so clients can switch between them at any key frame.
+	void set_num_renditions(unsigned count);
+	void write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame,
+	                        unsigned rendition = 0);
+	// Payloads are borrowed for the duration of the call and go straight into the socket without copies.
+	// Audio which is already in a packet buffer can be shared with the connections as is,
+	// the pointer variant copies it into a buffer from the server's pool.
 	void write_audio_packet(int64_t pts, int64_t dts, const void *data, size_t size);
+	void write_audio_packet(int64_t pts, int64_t dts, const PacketBufferHandle &packet);
 	void handle_udp_datagram(PyroFling::Dispatcher &dispatcher, const PyroFling::RemoteAddress &remote,
 	                         const void *msg, unsigned size);
 	void release_connection(PyroStreamConnection *conn) override;
 	void reset_gamepad_ownership() override;
-	bool should_force_idr();
-	void set_phase_offset(int phase_offset_us) override;
-	int get_phase_offset_us() const;
+	bool should_force_idr(unsigned rendition = 0);
+	// True if any client waits for a key frame. Unlike should_force_idr(), nothing is cleared or rate limited.
+	bool has_pending_idr();
+	void set_phase_offset(PyroStreamConnection *conn, int phase_offset_us) override;
+	// Combines phase offsets reported by clients since the last call.
+	// Returns false if no relevant client reported anything.
+	bool get_phase_offset_us(int &phase_offset_us);
+	void set_phase_offset_policy(PhaseOffsetPolicy policy);
 	void set_gamepad_state(const RemoteAddress &remote, const pyro_gamepad_state &state) override;
 	int64_t sample_reference_pts() override;
 
@@ -105,6 +162,9 @@ public:
 	void set_forward_error_correction(bool enable);
 	void set_idr_on_packet_loss(bool enable);
 
+	// Records all outgoing traffic to a trace which can be replayed with pyrofling-replay.
+	bool open_trace(const char *path);
+
 	int consume_bitrate_change_request();
 
 private:
@@ -112,8 +172,18 @@ private:
 	std::mutex lock;
 	std::vector<Util::IntrusivePtr<PyroStreamConnection>> connections;
 	pyro_codec_parameters codec = {};
-	uint64_t idr_counter = 0;
-	mutable std::atomic<int> phase_offset_us = {};
+	uint64_t idr_counters[MaxRenditions] = {};
+	unsigned num_renditions = 1;
+
+	// Ordered by when a client first reported a phase offset.
+	struct PhaseReport
+	{
+		PyroStreamConnection *conn;
+		int64_t sum_us;
+		unsigned count;
+	};
+	std::vector<PhaseReport> phase_reports;
+	PhaseOffsetPolicy phase_offset_policy = PhaseOffsetPolicy::Median;
 	std::atomic<int> bitrate_change_request = {};
 
 	// Current owner of virtual device. Super crude system, but hey :)
@@ -122,5 +192,7 @@ private:
 	bool new_gamepad_state = false;
 	bool fec = false;
 	bool idr_on_packet_loss = false;
+	TraceWriter trace;
+	Util::IntrusivePtr<PacketBufferPool> packet_pool = Util::make_handle<PacketBufferPool>();
 };
 }
\ No newline at end of file
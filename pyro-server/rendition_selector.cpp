@@ -0,0 +1,96 @@
+#include "rendition_selector.hpp"
+#include <algorithm>
+
+namespace PyroFling
+{
+RenditionSelector::RenditionSelector(const Options &options_)
+	: options(options_)
+{
+}
+
+RenditionSelector::RenditionSelector()
+	: RenditionSelector(Options())
+{
+}
+
+void RenditionSelector::set_num_renditions(unsigned count)
+{
+	num_renditions = std::max(count, 1u);
+	rendition = std::min(rendition, num_renditions - 1);
+}
+
+unsigned RenditionSelector::get_rendition() const
+{
+	return rendition;
+}
+
+unsigned RenditionSelector::update(const pyro_progress_report &report)
+{
+	// Counters only go backwards if the client restarted its stream, so start over from there.
+	if (!has_report || report.total_received_packets < last_report.total_received_packets ||
+	    report.total_dropped_video_packets < last_report.total_dropped_video_packets ||
+	    report.total_dropped_audio_packets < last_report.total_dropped_audio_packets)
+	{
+		last_report = report;
+		has_report = true;
+		return rendition;
+	}
+
+	uint64_t received = report.total_received_packets - last_report.total_received_packets;
+	uint64_t dropped = (report.total_dropped_video_packets - last_report.total_dropped_video_packets) +
+	                   (report.total_dropped_audio_packets - last_report.total_dropped_audio_packets);
+	last_report = report;
+
+	// Nothing is streaming, so there is nothing to judge.
+	if (received + dropped == 0)
+		return rendition;
+
+	if (++reports_since_change <= options.settle_reports)
+		return rendition;
+
+	double loss_ratio = double(dropped) / double(received + dropped);
+
+	if (loss_ratio > options.step_down_loss_ratio)
+	{
+		clean_reports = 0;
+
+		if (probing)
+		{
+			step_up_backoff = std::min(step_up_backoff * 2, options.max_step_up_backoff);
+			probing = false;
+		}
+
+		if (rendition + 1 < num_renditions)
+		{
+			rendition++;
+			reports_since_change = 0;
+		}
+	}
+	else if (dropped == 0)
+	{
+		clean_reports++;
+
+		// Surviving a full interval on the higher rendition means the client has the bandwidth for it.
+		if (probing && clean_reports >= options.step_up_clean_reports)
+		{
+			probing = false;
+			step_up_backoff = 1;
+		}
+
+		if (rendition > 0 && clean_reports >= options.step_up_clean_reports * step_up_backoff)
+		{
+			rendition--;
+			reports_since_change = 0;
+			clean_reports = 0;
+			probing = true;
+		}
+	}
+	else
+	{
+		// Some loss, but not enough to give up quality.
+		clean_reports = 0;
+	}
+
+	return rendition;
+}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "pyro_protocol.h"
+#include <stdint.h>
+
+namespace PyroFling
+{
+// Picks which simulcast rendition a client should receive, based on its progress reports.
+// Rendition 0 is the highest quality, higher indices have lower bitrates.
+// Progress reports only carry packet counts, so loss is the only signal of available bandwidth.
+// A client steps down as soon as loss exceeds a threshold, and steps up again after a stretch without loss.
+// If stepping up leads to loss right away, the next attempt waits longer, so a client at its
+// bandwidth limit does not flip between renditions.
+class RenditionSelector
+{
+public:
+	struct Options
+	{
+		// Fraction of packets lost between two reports which makes the client step down.
+		double step_down_loss_ratio = 0.02;
+		// Consecutive reports without loss before stepping up.
+		unsigned step_up_clean_reports = 10;
+		// The clean report requirement doubles for every failed step up, up to this factor.
+		unsigned max_step_up_backoff = 16;
+		// Reports ignored after a change, since they partially cover the previous rendition.
+		unsigned settle_reports = 1;
+	};
+
+	RenditionSelector();
+	explicit RenditionSelector(const Options &options);
+
+	void set_num_renditions(unsigned count);
+
+	// Takes the cumulative counters from a progress report and returns the rendition to use.
+	unsigned update(const pyro_progress_report &report);
+	unsigned get_rendition() const;
+
+private:
+	Options options;
+	pyro_progress_report last_report = {};
+	bool has_report = false;
+	unsigned num_renditions = 1;
+	unsigned rendition = 0;
+	unsigned clean_reports = 0;
+	unsigned reports_since_change = 0;
+	unsigned step_up_backoff = 1;
+	bool probing = false;
+};
+}
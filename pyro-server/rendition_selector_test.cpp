@@ -0,0 +1,105 @@
+#include "rendition_selector.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+
+using namespace PyroFling;
+
+// Simulates a client on a link which can sustain a fixed bitrate.
+// Everything sent above the capacity is lost, plus some random background loss.
+struct SimulatedLink
+{
+	double capacity_kbits;
+	double background_loss;
+};
+
+struct SimulationResult
+{
+	unsigned reports_at_rendition[8];
+	unsigned num_reports;
+	unsigned num_switches;
+	double delivered_ratio;
+};
+
+static SimulationResult run_simulation(const double *rendition_kbits, unsigned num_renditions,
+                                       const SimulatedLink &link, unsigned num_reports, uint64_t seed)
+{
+	RenditionSelector selector;
+	selector.set_num_renditions(num_renditions);
+	std::mt19937 rnd(seed);
+	std::uniform_real_distribution<double> dist(0.0, 1.0);
+
+	pyro_progress_report report = {};
+	SimulationResult result = {};
+	uint64_t total_sent = 0;
+	unsigned rendition = selector.update(report);
+
+	for (unsigned i = 0; i < num_reports; i++)
+	{
+		// Roughly one packet per kbit, which is enough resolution for the loss ratio.
+		double bitrate = rendition_kbits[rendition];
+		auto sent = uint64_t(bitrate);
+		double loss = link.background_loss;
+		if (bitrate > link.capacity_kbits)
+			loss += (bitrate - link.capacity_kbits) / bitrate;
+
+		uint64_t dropped = 0;
+		for (uint64_t j = 0; j < sent; j++)
+			if (dist(rnd) < loss)
+				dropped++;
+
+		total_sent += sent;
+		report.total_received_packets += sent - dropped;
+		report.total_dropped_video_packets += dropped;
+
+		unsigned next = selector.update(report);
+		if (next != rendition)
+			result.num_switches++;
+		rendition = next;
+		result.reports_at_rendition[rendition]++;
+	}
+
+	result.num_reports = num_reports;
+	result.delivered_ratio = double(report.total_received_packets) / double(total_sent);
+	return result;
+}
+
+// Most of the time must be spent on the expected rendition. Occasional attempts to step up are fine.
+static bool check(const char *name, const SimulationResult &result,
+                  unsigned expected_rendition, unsigned max_switches, double min_delivered_ratio)
+{
+	double share = double(result.reports_at_rendition[expected_rendition]) / double(result.num_reports);
+	bool ok = share >= 0.9 &&
+	          result.num_switches <= max_switches &&
+	          result.delivered_ratio >= min_delivered_ratio;
+
+	fprintf(stderr, "%s: %s, %.1f %% at rendition %u, %u switches, %.2f %% delivered.\n",
+	        name, ok ? "OK" : "FAIL", 100.0 * share, expected_rendition,
+	        result.num_switches, 100.0 * result.delivered_ratio);
+
+	return ok;
+}
+
+int main()
+{
+	const double renditions[] = { 8000.0, 3000.0, 1000.0 };
+	bool success = true;
+
+	// LAN, stays at the top.
+	success = check("lan", run_simulation(renditions, 3, { 100000.0, 0.0 }, 600, 1), 0, 0, 1.0) && success;
+
+	// Wi-Fi with a bit of background loss below the threshold. Must not be pushed down by noise.
+	success = check("noisy", run_simulation(renditions, 3, { 20000.0, 0.002 }, 600, 2), 0, 0, 0.99) && success;
+
+	// Link between the two upper renditions. Settles on the middle one, and the backoff keeps
+	// the number of failed attempts to step up low.
+	success = check("constrained", run_simulation(renditions, 3, { 5000.0, 0.0 }, 600, 3), 1, 16, 0.97) && success;
+
+	// Very weak link ends up at the bottom.
+	success = check("weak", run_simulation(renditions, 3, { 1500.0, 0.0 }, 600, 4), 2, 16, 0.94) && success;
+
+	// A single rendition never moves.
+	success = check("single", run_simulation(renditions, 1, { 1500.0, 0.0 }, 100, 5), 0, 0, 0.0) && success;
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
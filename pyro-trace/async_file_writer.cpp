@@ -0,0 +1,282 @@
+#include "async_file_writer.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+#include <errno.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace PyroFling
+{
+// Partial batches are flushed at this interval, so a stalled producer does not leave data in memory for long.
+static constexpr unsigned flush_interval_ms = 100;
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+	close();
+}
+
+bool AsyncFileWriter::open(const char *path, const Options &options_)
+{
+	close();
+
+	options = options_;
+	options.batch_size = std::max<size_t>(options.batch_size, DirectIOAlignment);
+	options.batch_size = (options.batch_size + DirectIOAlignment - 1) & ~size_t(DirectIOAlignment - 1);
+	options.ring_size = std::max(options.ring_size, options.batch_size);
+
+#ifdef __linux__
+	if (options.direct_io)
+	{
+		int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+		if (fd >= 0)
+		{
+			file.reset(fdopen(fd, "wb"));
+			if (!file)
+				::close(fd);
+		}
+		else
+		{
+			fprintf(stderr, "O_DIRECT is not supported for \"%s\", using buffered writes.\n", path);
+			options.direct_io = false;
+		}
+	}
+#else
+	options.direct_io = false;
+#endif
+
+	if (!file)
+		file.reset(fopen(path, "wb"));
+
+	if (!file)
+	{
+		fprintf(stderr, "Failed to open \"%s\" for writing.\n", path);
+		return false;
+	}
+
+	// Batches are already large, so let them go straight to the kernel.
+	setvbuf(file.get(), nullptr, _IONBF, 0);
+
+	ring.resize(options.ring_size);
+	batch_storage.resize(options.batch_size + DirectIOAlignment);
+	auto addr = reinterpret_cast<uintptr_t>(batch_storage.data());
+	batch = batch_storage.data() + (((addr + DirectIOAlignment - 1) & ~uintptr_t(DirectIOAlignment - 1)) - addr);
+	batch_fill = 0;
+
+	read_count = 0;
+	write_count = 0;
+	closing = false;
+	stats = {};
+	opened = true;
+
+	thread = std::thread(&AsyncFileWriter::thread_loop, this);
+	return true;
+}
+
+bool AsyncFileWriter::is_open() const
+{
+	return opened;
+}
+
+void AsyncFileWriter::close()
+{
+	if (!opened)
+		return;
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		closing = true;
+	}
+
+	data_cond.notify_one();
+	space_cond.notify_all();
+	thread.join();
+
+	file.reset();
+	ring.clear();
+	ring.shrink_to_fit();
+	batch_storage.clear();
+	batch_storage.shrink_to_fit();
+	batch = nullptr;
+	opened = false;
+}
+
+size_t AsyncFileWriter::get_queued_bytes() const
+{
+	return size_t(write_count - read_count);
+}
+
+bool AsyncFileWriter::write(const void * const *chunks, const size_t *sizes, unsigned count)
+{
+	size_t total = 0;
+	for (unsigned i = 0; i < count; i++)
+		total += sizes[i];
+
+	std::unique_lock<std::mutex> holder{lock};
+	if (!opened || closing || stats.failed)
+		return false;
+
+	if (options.policy == OverflowPolicy::Block && total <= ring.size())
+	{
+		space_cond.wait(holder, [&]() {
+			return closing || stats.failed || ring.size() - get_queued_bytes() >= total;
+		});
+
+		if (closing || stats.failed)
+			return false;
+	}
+
+	if (ring.size() - get_queued_bytes() < total)
+	{
+		stats.dropped_writes++;
+		stats.dropped_bytes += total;
+		return false;
+	}
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto *data = static_cast<const uint8_t *>(chunks[i]);
+		size_t size = sizes[i];
+
+		while (size)
+		{
+			size_t offset = size_t(write_count % ring.size());
+			size_t to_copy = std::min(size, ring.size() - offset);
+			memcpy(ring.data() + offset, data, to_copy);
+			write_count += to_copy;
+			data += to_copy;
+			size -= to_copy;
+		}
+	}
+
+	size_t queued = get_queued_bytes();
+	stats.max_queued_bytes = std::max(stats.max_queued_bytes, queued);
+	if (queued >= options.batch_size)
+		data_cond.notify_one();
+
+	return true;
+}
+
+bool AsyncFileWriter::write(const void *data, size_t size)
+{
+	return write(&data, &size, 1);
+}
+
+AsyncFileWriter::Stats AsyncFileWriter::get_stats()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	auto ret = stats;
+	ret.queued_bytes = get_queued_bytes();
+	return ret;
+}
+
+bool AsyncFileWriter::write_batch(size_t size, bool final)
+{
+	auto start_ns = Util::get_current_time_nsecs();
+	bool ok;
+
+#ifdef __linux__
+	if (options.direct_io)
+	{
+		int fd = fileno(file.get());
+
+		// The tail of the file cannot be padded, so the last write has to go through the page cache.
+		if (final && (size & (DirectIOAlignment - 1)) != 0)
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+
+		ok = true;
+		for (size_t offset = 0; offset < size && ok; )
+		{
+			ssize_t ret = ::write(fd, batch + offset, size - offset);
+			if (ret > 0)
+				offset += size_t(ret);
+			else if (ret < 0 && errno == EINTR)
+				continue;
+			else
+				ok = false;
+		}
+	}
+	else
+#endif
+	{
+		ok = fwrite(batch, 1, size, file.get()) == size;
+	}
+
+	auto write_ns = uint64_t(Util::get_current_time_nsecs() - start_ns);
+
+	std::lock_guard<std::mutex> holder{lock};
+	stats.num_batches++;
+	stats.total_write_ns += write_ns;
+	stats.max_write_ns = std::max(stats.max_write_ns, write_ns);
+
+	if (ok)
+	{
+		stats.written_bytes += size;
+	}
+	else
+	{
+		stats.failed = true;
+		space_cond.notify_all();
+	}
+
+	return ok;
+}
+
+void AsyncFileWriter::thread_loop()
+{
+	for (;;)
+	{
+		std::unique_lock<std::mutex> holder{lock};
+		data_cond.wait_for(holder, std::chrono::milliseconds(flush_interval_ms), [this]() {
+			return closing || get_queued_bytes() >= options.batch_size;
+		});
+
+		bool final = closing;
+		size_t to_copy = std::min(get_queued_bytes(), options.batch_size - batch_fill);
+		uint64_t copy_offset = read_count;
+		holder.unlock();
+
+		// Producers never write to the queued region, so it is safe to copy without the lock.
+		for (size_t copied = 0; copied < to_copy; )
+		{
+			size_t offset = size_t((copy_offset + copied) % ring.size());
+			size_t n = std::min(to_copy - copied, ring.size() - offset);
+			memcpy(batch + batch_fill + copied, ring.data() + offset, n);
+			copied += n;
+		}
+
+		if (to_copy)
+		{
+			holder.lock();
+			read_count += to_copy;
+			final = closing && get_queued_bytes() == 0;
+			holder.unlock();
+			space_cond.notify_all();
+			batch_fill += to_copy;
+		}
+
+		// With direct I/O, only whole blocks can be written until the end.
+		size_t write_size = batch_fill;
+		if (options.direct_io && !final)
+			write_size &= ~size_t(DirectIOAlignment - 1);
+
+		if (write_size)
+		{
+			if (!write_batch(write_size, final))
+			{
+				fprintf(stderr, "Failed to write file, further writes are discarded.\n");
+				return;
+			}
+
+			memmove(batch, batch + write_size, batch_fill - write_size);
+			batch_fill -= write_size;
+		}
+
+		if (final && !batch_fill)
+			return;
+	}
+}
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PyroFling
+{
+// Writes a file from a dedicated I/O thread, so producers never wait on the disk.
+// Writes are queued in a bounded ring buffer and flushed to the file in large batches.
+class AsyncFileWriter
+{
+public:
+	enum class OverflowPolicy
+	{
+		Drop, // A write which does not fit in the ring is discarded. Producers never wait.
+		Block // Producers wait for the I/O thread to make room.
+	};
+
+	struct Options
+	{
+		size_t ring_size = 64 * 1024 * 1024;
+		size_t batch_size = 1024 * 1024;
+		OverflowPolicy policy = OverflowPolicy::Drop;
+		// Bypass the page cache with O_DIRECT where supported.
+		bool direct_io = false;
+	};
+
+	struct Stats
+	{
+		uint64_t written_bytes;
+		uint64_t dropped_writes;
+		uint64_t dropped_bytes;
+		size_t queued_bytes;
+		size_t max_queued_bytes;
+		uint64_t num_batches;
+		uint64_t total_write_ns;
+		uint64_t max_write_ns;
+		bool failed;
+	};
+
+	AsyncFileWriter() = default;
+	~AsyncFileWriter();
+
+	AsyncFileWriter(const AsyncFileWriter &) = delete;
+	void operator=(const AsyncFileWriter &) = delete;
+
+	bool open(const char *path, const Options &options);
+	bool is_open() const;
+	// Flushes everything which is queued and closes the file.
+	void close();
+
+	// Thread-safe. Chunks are queued back to back, and either all of them are written or none.
+	// Returns false if the write was dropped or the file is broken.
+	bool write(const void * const *chunks, const size_t *sizes, unsigned count);
+	bool write(const void *data, size_t size);
+
+	Stats get_stats();
+
+private:
+	// O_DIRECT requires aligned buffers, offsets and sizes.
+	enum { DirectIOAlignment = 4096 };
+
+	struct FileDeleter { void operator()(FILE *fp) { if (fp) fclose(fp); }};
+	std::unique_ptr<FILE, FileDeleter> file;
+	Options options;
+	bool opened = false;
+
+	// Guards everything below. The ring region between read_count and write_count
+	// is owned by the I/O thread, so it can be copied out without holding the lock.
+	std::mutex lock;
+	std::condition_variable data_cond;
+	std::condition_variable space_cond;
+	std::vector<uint8_t> ring;
+	uint64_t read_count = 0;
+	uint64_t write_count = 0;
+	bool closing = false;
+	Stats stats = {};
+
+	// Only touched by the I/O thread.
+	std::vector<uint8_t> batch_storage;
+	uint8_t *batch = nullptr;
+	size_t batch_fill = 0;
+
+	std::thread thread;
+	void thread_loop();
+	bool write_batch(size_t size, bool final);
+	size_t get_queued_bytes() const;
+};
+}
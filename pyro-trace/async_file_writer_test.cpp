@@ -0,0 +1,175 @@
+#include "async_file_writer.hpp"
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace PyroFling;
+
+// Every record is a sequence number followed by a payload derived from it,
+// so the file can be verified without keeping track of which writes were dropped.
+struct RecordHeader
+{
+	uint32_t seq;
+	uint32_t size;
+};
+
+static void fill_payload(uint8_t *data, uint32_t seq, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++)
+		data[i] = uint8_t(seq * 31 + i);
+}
+
+static void write_records(AsyncFileWriter &writer, uint32_t first_seq, uint32_t count,
+                          uint64_t &accepted, uint64_t &accepted_bytes)
+{
+	std::vector<uint8_t> payload(64 * 1024);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		RecordHeader header = { first_seq + i, 1000 + (first_seq + i) * 7919 % 60000 };
+		fill_payload(payload.data(), header.seq, header.size);
+
+		const void *chunks[] = { &header, payload.data() };
+		const size_t sizes[] = { sizeof(header), header.size };
+		if (writer.write(chunks, sizes, 2))
+		{
+			accepted++;
+			accepted_bytes += sizeof(header) + header.size;
+		}
+	}
+}
+
+// Verifies that records are whole and that each producer's records are in order.
+static bool verify_file(const char *path, unsigned num_producers, uint32_t seq_stride,
+                        uint64_t expected_records)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	std::vector<int64_t> last_seq(num_producers, -1);
+	std::vector<uint8_t> payload(64 * 1024), expected(64 * 1024);
+	RecordHeader header;
+	uint64_t num_records = 0;
+	bool ok = true;
+
+	while (ok && fread(&header, sizeof(header), 1, file) == 1)
+	{
+		unsigned producer = header.seq / seq_stride;
+		if (producer >= num_producers || header.size > payload.size() ||
+		    int64_t(header.seq) <= last_seq[producer] ||
+		    fread(payload.data(), 1, header.size, file) != header.size)
+		{
+			ok = false;
+			break;
+		}
+
+		fill_payload(expected.data(), header.seq, header.size);
+		if (memcmp(payload.data(), expected.data(), header.size) != 0)
+			ok = false;
+
+		last_seq[producer] = header.seq;
+		num_records++;
+	}
+
+	fclose(file);
+
+	if (num_records != expected_records)
+	{
+		fprintf(stderr, "Expected %llu records, got %llu.\n",
+		        static_cast<unsigned long long>(expected_records),
+		        static_cast<unsigned long long>(num_records));
+		return false;
+	}
+
+	return ok;
+}
+
+static bool test_policy(const char *path, AsyncFileWriter::OverflowPolicy policy, bool direct_io)
+{
+	constexpr unsigned NumProducers = 4;
+	constexpr uint32_t NumRecords = 2000;
+
+	AsyncFileWriter::Options options;
+	options.policy = policy;
+	options.direct_io = direct_io;
+	// Small enough that producers regularly overrun the I/O thread.
+	options.ring_size = 256 * 1024;
+	options.batch_size = 64 * 1024;
+
+	AsyncFileWriter writer;
+	if (!writer.open(path, options))
+		return false;
+
+	uint64_t accepted[NumProducers] = {};
+	uint64_t accepted_bytes[NumProducers] = {};
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < NumProducers; i++)
+	{
+		threads.emplace_back([&, i]() {
+			write_records(writer, i * NumRecords, NumRecords, accepted[i], accepted_bytes[i]);
+		});
+	}
+
+	for (auto &t : threads)
+		t.join();
+
+	uint64_t total_accepted = 0;
+	uint64_t total_bytes = 0;
+	for (unsigned i = 0; i < NumProducers; i++)
+	{
+		total_accepted += accepted[i];
+		total_bytes += accepted_bytes[i];
+	}
+
+	auto before_close = writer.get_stats();
+	writer.close();
+
+	fprintf(stderr, "%s%s: accepted %llu / %u records, dropped %llu, peak queue %zu bytes.\n",
+	        policy == AsyncFileWriter::OverflowPolicy::Block ? "block" : "drop",
+	        direct_io ? " (direct)" : "",
+	        static_cast<unsigned long long>(total_accepted), NumProducers * NumRecords,
+	        static_cast<unsigned long long>(before_close.dropped_writes), before_close.max_queued_bytes);
+
+	if (before_close.max_queued_bytes > options.ring_size)
+		return false;
+	if (total_accepted + before_close.dropped_writes != NumProducers * NumRecords)
+		return false;
+	if (policy == AsyncFileWriter::OverflowPolicy::Block && total_accepted != NumProducers * NumRecords)
+		return false;
+
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+
+	if (uint64_t(size) != total_bytes)
+	{
+		fprintf(stderr, "File is %ld bytes, expected %llu.\n", size, static_cast<unsigned long long>(total_bytes));
+		return false;
+	}
+
+	return verify_file(path, NumProducers, NumRecords, total_accepted);
+}
+
+int main()
+{
+	const char *path = "/tmp/pyrofling-async-file-writer-test.bin";
+
+	bool ok = test_policy(path, AsyncFileWriter::OverflowPolicy::Block, false) &&
+	          test_policy(path, AsyncFileWriter::OverflowPolicy::Drop, false) &&
+	          test_policy(path, AsyncFileWriter::OverflowPolicy::Block, true);
+
+	unlink(path);
+
+	if (!ok)
+	{
+		fprintf(stderr, "Async file writer test failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
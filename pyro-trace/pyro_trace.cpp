@@ -0,0 +1,115 @@
+#include "pyro_trace.hpp"
+#include "timer.hpp"
+#include <string.h>
+
+namespace PyroFling
+{
+static const char trace_magic[8] = { 'P', 'Y', 'R', 'O', 'T', 'R', 'C', '\0' };
+static constexpr uint32_t trace_version = 1;
+
+// A generous upper bound. Anything larger is a corrupt file.
+static constexpr uint32_t max_record_size = 64 * 1024;
+
+bool TraceWriter::open(const char *path)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	if (!file.open(path, {}))
+	{
+		fprintf(stderr, "Failed to open trace file \"%s\".\n", path);
+		return false;
+	}
+
+	TraceFileHeader header = {};
+	memcpy(header.magic, trace_magic, sizeof(trace_magic));
+	header.version = trace_version;
+	header.record_header_size = sizeof(TraceRecordHeader);
+
+	if (!file.write(&header, sizeof(header)))
+	{
+		fprintf(stderr, "Failed to write trace header.\n");
+		file.close();
+		return false;
+	}
+
+	base_time_ns = Util::get_current_time_nsecs();
+	return true;
+}
+
+bool TraceWriter::is_open() const
+{
+	return file.is_open();
+}
+
+void TraceWriter::write_record(TraceRecordType type, uint64_t cookie,
+                               const void *header, size_t header_size,
+                               const void *data, size_t size)
+{
+	if (header_size + size > max_record_size)
+		return;
+
+	TraceRecordHeader record = {};
+	record.cookie = cookie;
+	record.size = uint32_t(header_size + size);
+	record.type = type;
+
+	std::lock_guard<std::mutex> holder{lock};
+	if (!file.is_open())
+		return;
+
+	record.timestamp_ns = Util::get_current_time_nsecs() - base_time_ns;
+
+	// Records are written whole or not at all, so a dropped record never corrupts the trace.
+	const void *chunks[] = { &record, header, data };
+	const size_t sizes[] = { sizeof(record), header_size, size };
+	file.write(chunks, sizes, 3);
+}
+
+bool TraceReader::open(const char *path)
+{
+	file.reset(fopen(path, "rb"));
+	if (!file)
+	{
+		fprintf(stderr, "Failed to open trace file \"%s\".\n", path);
+		return false;
+	}
+
+	TraceFileHeader header = {};
+	if (fread(&header, sizeof(header), 1, file.get()) != 1 ||
+	    memcmp(header.magic, trace_magic, sizeof(trace_magic)) != 0)
+	{
+		fprintf(stderr, "\"%s\" is not a pyro trace.\n", path);
+		file.reset();
+		return false;
+	}
+
+	if (header.version != trace_version || header.record_header_size != sizeof(TraceRecordHeader))
+	{
+		fprintf(stderr, "Unsupported trace version %u.\n", header.version);
+		file.reset();
+		return false;
+	}
+
+	return true;
+}
+
+bool TraceReader::read_record(TraceRecord &record)
+{
+	if (!file)
+		return false;
+
+	if (fread(&record.header, sizeof(record.header), 1, file.get()) != 1)
+		return false;
+
+	if (record.header.size > max_record_size)
+	{
+		fprintf(stderr, "Corrupt trace record of %u bytes.\n", record.header.size);
+		return false;
+	}
+
+	record.data.resize(record.header.size);
+	if (record.header.size && fread(record.data.data(), record.header.size, 1, file.get()) != 1)
+		return false;
+
+	return true;
+}
+}
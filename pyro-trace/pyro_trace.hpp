@@ -0,0 +1,82 @@
+#pragma once
+#include "pyro_protocol.h"
+#include "async_file_writer.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace PyroFling
+{
+// On-disk trace of the traffic a pyro server sends to its clients.
+// A file header is followed by records, each a TraceRecordHeader followed by size bytes of payload.
+// UDP records contain a full datagram (pyro_payload_header + payload).
+// TCP records contain a full control message (pyro_message_type + payload).
+// All fields are little-endian.
+
+enum class TraceRecordType : uint8_t
+{
+	UDP = 0,
+	TCP = 1
+};
+
+struct TraceFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t record_header_size;
+};
+
+struct TraceRecordHeader
+{
+	// Relative to when the trace was opened.
+	uint64_t timestamp_ns;
+	// Identifies the stream connection. Multiple clients can be interleaved in one trace.
+	uint64_t cookie;
+	uint32_t size;
+	TraceRecordType type;
+	uint8_t reserved[3];
+};
+
+static_assert(sizeof(TraceRecordHeader) == 24, "Unexpected trace record size.");
+
+// Records are written from a background thread. If the disk cannot keep up, records are dropped,
+// which shows up as packet loss when the trace is replayed.
+class TraceWriter
+{
+public:
+	bool open(const char *path);
+	bool is_open() const;
+
+	// Thread-safe. A record may be split in a header and body to avoid a copy.
+	void write_record(TraceRecordType type, uint64_t cookie,
+	                  const void *header, size_t header_size,
+	                  const void *data, size_t size);
+
+private:
+	// Keeps records in timestamp order.
+	std::mutex lock;
+	AsyncFileWriter file;
+	int64_t base_time_ns = 0;
+};
+
+struct TraceRecord
+{
+	TraceRecordHeader header;
+	std::vector<uint8_t> data;
+};
+
+class TraceReader
+{
+public:
+	bool open(const char *path);
+	// Returns false on end of trace or a corrupt record.
+	bool read_record(TraceRecord &record);
+
+private:
+	struct FileDeleter { void operator()(FILE *fp) { if (fp) fclose(fp); }};
+	std::unique_ptr<FILE, FileDeleter> file;
+};
+}
@@ -35,15 +35,31 @@
 #include "pyro_server.hpp"
 #include "virtual_gamepad.hpp"
 #include "timeline_trace_file.hpp"
+#include "frame_latency.hpp"
+#include "phase_controller.hpp"
+#include "async_file_writer.hpp"
+#include "packet_fanout.hpp"
+#include "drift_record_stream.hpp"
+#include "encode_pacer.hpp"
+#include "encode_reorder.hpp"
+#include "encoder_probe.hpp"
+#ifdef HAVE_MUX_OUTPUT
+#include "mux_output.hpp"
+#endif
 #include <stdexcept>
 #include <vector>
 #include <thread>
+#include <memory>
 #include <cmath>
+#include <stdlib.h>
+#include <time.h>
 
 #include <unistd.h>
 #include <sys/timerfd.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <algorithm>
+#include <functional>
 
 #ifdef HAVE_PIPEWIRE
 #include <pipewire/pipewire.h>
@@ -51,6 +67,7 @@
 #include <spa/param/video/format-utils.h>
 #include <spa/param/props.h>
 #include <spa/debug/format.h>
+#include <sys/stat.h>
 #endif
 
 using namespace PyroFling;
@@ -59,6 +76,33 @@ using namespace PyroFling;
 #ifdef HAVE_PIPEWIRE
 class SwapchainServer;
 
+// All formats are 32 bits per pixel and imported as a single plane.
+// YUV formats would need a YCbCr sampler in the encoder's RGB input path, so they are not offered.
+struct PipewireFormat
+{
+	spa_video_format spa_format;
+	VkFormat vk_format;
+};
+
+static const PipewireFormat pipewire_formats[] = {
+	{ SPA_VIDEO_FORMAT_BGRx, VK_FORMAT_B8G8R8A8_SRGB },
+	{ SPA_VIDEO_FORMAT_BGRA, VK_FORMAT_B8G8R8A8_SRGB },
+	{ SPA_VIDEO_FORMAT_RGBx, VK_FORMAT_R8G8B8A8_SRGB },
+	{ SPA_VIDEO_FORMAT_RGBA, VK_FORMAT_R8G8B8A8_SRGB },
+	{ SPA_VIDEO_FORMAT_xRGB_210LE, VK_FORMAT_A2R10G10B10_UNORM_PACK32 },
+	{ SPA_VIDEO_FORMAT_ARGB_210LE, VK_FORMAT_A2R10G10B10_UNORM_PACK32 },
+	{ SPA_VIDEO_FORMAT_xBGR_210LE, VK_FORMAT_A2B10G10R10_UNORM_PACK32 },
+	{ SPA_VIDEO_FORMAT_ABGR_210LE, VK_FORMAT_A2B10G10R10_UNORM_PACK32 },
+};
+
+static const PipewireFormat *find_pipewire_format(uint32_t spa_format)
+{
+	for (auto &fmt : pipewire_formats)
+		if (fmt.spa_format == spa_format)
+			return &fmt;
+	return nullptr;
+}
+
 class PipewireStream : public Handler
 {
 public:
@@ -80,13 +124,56 @@ public:
 
 	void send_encoding(const Vulkan::Image &img);
 
+	void remove_buffer(pw_buffer *buffer);
+
 private:
 	SwapchainServer &server;
 	Vulkan::Device &device;
 	pw_loop *loop = nullptr;
 	pw_stream *stream = nullptr;
 	spa_video_info_raw raw_video_info = {};
+	VkFormat vk_format = VK_FORMAT_UNDEFINED;
 	uint32_t stride = 0;
+
+	const spa_pod *build_enum_format(spa_pod_builder &b, const PipewireFormat &fmt,
+	                                 unsigned width, unsigned height, unsigned fps);
+
+	// PipeWire cycles through a small, fixed set of buffers, so keep the imported images around.
+	// The same DMA-BUF can be sent with different fds, so identify it by inode instead.
+	struct DmaBufKey
+	{
+		dev_t dev;
+		ino_t ino;
+		uint32_t offset;
+		uint32_t stride;
+		uint64_t modifier;
+		VkFormat format;
+		uint32_t width;
+		uint32_t height;
+
+		bool operator==(const DmaBufKey &other) const
+		{
+			return dev == other.dev && ino == other.ino &&
+			       offset == other.offset && stride == other.stride &&
+			       modifier == other.modifier && format == other.format &&
+			       width == other.width && height == other.height;
+		}
+	};
+
+	struct CachedImport
+	{
+		DmaBufKey key;
+		Vulkan::ImageHandle image;
+		uint64_t last_used;
+	};
+
+	// Must be at least the maximum buffer count we negotiate.
+	enum { MaxCachedImports = 64 };
+	std::vector<CachedImport> import_cache;
+	uint64_t import_timestamp = 0;
+
+	Vulkan::ImageHandle import_dmabuf(const spa_data &data);
+	void invalidate_import_cache();
 };
 
 static void on_stream_state_changed(void *data_, pw_stream_state old, pw_stream_state state, const char *error)
@@ -104,6 +191,11 @@ static void on_process(void *data_)
 	static_cast<PipewireStream *>(data_)->process();
 }
 
+static void on_remove_buffer(void *data_, pw_buffer *buffer)
+{
+	static_cast<PipewireStream *>(data_)->remove_buffer(buffer);
+}
+
 PipewireStream::PipewireStream(Dispatcher &dispatcher_, SwapchainServer &server_, Vulkan::Device &device_)
 	: Handler(dispatcher_), server(server_), device(device_)
 {
@@ -128,34 +220,9 @@ void PipewireStream::process()
 			continue;
 		}
 
-		auto info = Vulkan::ImageCreateInfo::immutable_2d_image(
-				raw_video_info.size.width,
-				raw_video_info.size.height,
-				VK_FORMAT_B8G8R8A8_SRGB);
-
-		info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
-		info.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
-		info.misc = Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT | Vulkan::IMAGE_MISC_EXTERNAL_MEMORY_BIT;
-		// Vulkan takes ownership of the fd, so dup it first.
-		info.external.handle = dup(int(buffer->datas[0].fd));
-		info.external.memory_handle_type = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
-
-		VkImageDrmFormatModifierExplicitCreateInfoEXT explicit_info =
-				{ VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_EXPLICIT_CREATE_INFO_EXT };
-		VkSubresourceLayout layout = {};
-		explicit_info.drmFormatModifier = raw_video_info.modifier;
-		explicit_info.drmFormatModifierPlaneCount = 1;
-		explicit_info.pPlaneLayouts = &layout;
-		layout.offset = buffer->datas[0].chunk->offset;
-		layout.rowPitch = buffer->datas[0].chunk->stride;
-		info.pnext = &explicit_info;
-
-		// TODO: memoize the imports? fstat + inodes is apparently a thing.
-		auto img = device.create_image(info);
+		auto img = import_dmabuf(buffer->datas[0]);
 		if (img)
 			send_encoding(*img);
-		else
-			LOGE("Failed to import DMABUF.\n");
 
 		// Pipewire relies on implicit sync supposedly,
 		// so after we have submitted conversion work, we're done.
@@ -163,6 +230,103 @@ void PipewireStream::process()
 	}
 }
 
+Vulkan::ImageHandle PipewireStream::import_dmabuf(const spa_data &data)
+{
+	struct stat st = {};
+	if (fstat(int(data.fd), &st) < 0)
+	{
+		LOGE("Failed to stat DMABUF.\n");
+		return {};
+	}
+
+	DmaBufKey key = {};
+	key.dev = st.st_dev;
+	key.ino = st.st_ino;
+	key.offset = data.chunk->offset;
+	key.stride = uint32_t(data.chunk->stride);
+	key.modifier = raw_video_info.modifier;
+	key.format = vk_format;
+	key.width = raw_video_info.size.width;
+	key.height = raw_video_info.size.height;
+
+	import_timestamp++;
+
+	for (auto &entry : import_cache)
+	{
+		if (entry.key == key)
+		{
+			entry.last_used = import_timestamp;
+			return entry.image;
+		}
+	}
+
+	auto info = Vulkan::ImageCreateInfo::immutable_2d_image(key.width, key.height, key.format);
+
+	info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	info.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+	info.misc = Vulkan::IMAGE_MISC_EXTERNAL_MEMORY_BIT;
+	if (Vulkan::format_is_srgb(key.format))
+		info.misc |= Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT;
+	// Vulkan takes ownership of the fd, so dup it first.
+	info.external.handle = dup(int(data.fd));
+	info.external.memory_handle_type = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
+
+	VkImageDrmFormatModifierExplicitCreateInfoEXT explicit_info =
+			{ VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_EXPLICIT_CREATE_INFO_EXT };
+	VkSubresourceLayout layout = {};
+	explicit_info.drmFormatModifier = key.modifier;
+	explicit_info.drmFormatModifierPlaneCount = 1;
+	explicit_info.pPlaneLayouts = &layout;
+	layout.offset = key.offset;
+	layout.rowPitch = key.stride;
+	info.pnext = &explicit_info;
+
+	auto img = device.create_image(info);
+	if (!img)
+	{
+		LOGE("Failed to import DMABUF.\n");
+		return {};
+	}
+
+	// Should not happen unless PipeWire keeps allocating new buffers without removing old ones.
+	if (import_cache.size() >= MaxCachedImports)
+	{
+		auto itr = std::min_element(import_cache.begin(), import_cache.end(),
+		                            [](const CachedImport &a, const CachedImport &b) {
+			                            return a.last_used < b.last_used;
+		                            });
+		import_cache.erase(itr);
+	}
+
+	import_cache.push_back({ key, img, import_timestamp });
+	return img;
+}
+
+void PipewireStream::invalidate_import_cache()
+{
+	// Images are only destroyed once the GPU is done with them.
+	import_cache.clear();
+}
+
+void PipewireStream::remove_buffer(pw_buffer *buffer)
+{
+	auto *spa = buffer->buffer;
+	if (spa->n_datas < 1)
+		return;
+
+	struct stat st = {};
+	if (fstat(int(spa->datas[0].fd), &st) < 0)
+	{
+		invalidate_import_cache();
+		return;
+	}
+
+	auto itr = std::remove_if(import_cache.begin(), import_cache.end(), [&](const CachedImport &entry) {
+		return entry.key.dev == st.st_dev && entry.key.ino == st.st_ino;
+	});
+	import_cache.erase(itr, import_cache.end());
+}
+
 void PipewireStream::stream_param_changed(uint32_t id, const spa_pod *param)
 {
 	uint8_t params_buffer[1024];
@@ -173,6 +337,9 @@ void PipewireStream::stream_param_changed(uint32_t id, const spa_pod *param)
 	if (param == nullptr || id != SPA_PARAM_Format)
 		return;
 
+	// Any format change means buffers will be reallocated.
+	invalidate_import_cache();
+
 	uint32_t media_type, media_subtype;
 	if (spa_format_parse(param, &media_type, &media_subtype) < 0)
 	{
@@ -189,13 +356,19 @@ void PipewireStream::stream_param_changed(uint32_t id, const spa_pod *param)
 	/* call a helper function to parse the format for us. */
 	spa_format_video_raw_parse(param, &raw_video_info);
 
-	if (raw_video_info.format != SPA_VIDEO_FORMAT_BGRx)
+	auto *fmt = find_pipewire_format(raw_video_info.format);
+	if (!fmt)
 	{
-		LOGE("Expected BGRx format.\n");
+		LOGE("Unexpected PipeWire format %u.\n", unsigned(raw_video_info.format));
 		pw_stream_set_error(stream, -EINVAL, "unknown pixel format");
 		return;
 	}
 
+	vk_format = fmt->vk_format;
+	LOGI("PipeWire format: %u (VkFormat %d), modifier 0x%llx.\n",
+	     unsigned(raw_video_info.format), int(vk_format),
+	     static_cast<unsigned long long>(raw_video_info.modifier));
+
 	if (raw_video_info.size.width == 0 || raw_video_info.size.height == 0)
 	{
 		pw_stream_set_error(stream, -EINVAL, "invalid size");
@@ -246,6 +419,59 @@ int PipewireStream::get_fd()
 	return pw_loop_get_fd(loop);
 }
 
+const spa_pod *PipewireStream::build_enum_format(spa_pod_builder &b, const PipewireFormat &fmt,
+                                                 unsigned width, unsigned height, unsigned fps)
+{
+	// Query which DRM format modifiers we can sample from.
+	VkFormatProperties3 props3 = { VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3 };
+	VkDrmFormatModifierPropertiesListEXT list = { VK_STRUCTURE_TYPE_DRM_FORMAT_MODIFIER_PROPERTIES_LIST_EXT };
+	props3.pNext = &list;
+	device.get_format_properties(fmt.vk_format, &props3);
+	std::vector<VkDrmFormatModifierPropertiesEXT> drm_props(list.drmFormatModifierCount);
+	list.pDrmFormatModifierProperties = drm_props.data();
+	device.get_format_properties(fmt.vk_format, &props3);
+
+	std::vector<uint64_t> modifiers;
+	for (auto &p : drm_props)
+		if ((p.drmFormatModifierTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) != 0)
+			modifiers.push_back(p.drmFormatModifier);
+
+	if (modifiers.empty())
+		return nullptr;
+
+	struct spa_pod_frame f[2];
+
+	spa_pod_builder_push_object(&b, &f[0], SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat);
+	spa_pod_builder_add(&b, SPA_FORMAT_mediaType, SPA_POD_Id(SPA_MEDIA_TYPE_video), 0);
+	spa_pod_builder_add(&b, SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw), 0);
+	spa_pod_builder_add(&b, SPA_FORMAT_VIDEO_format, SPA_POD_Id(fmt.spa_format), 0);
+
+	spa_pod_builder_prop(&b, SPA_FORMAT_VIDEO_modifier, SPA_POD_PROP_FLAG_MANDATORY | SPA_POD_PROP_FLAG_DONT_FIXATE);
+	spa_pod_builder_push_choice(&b, &f[1], SPA_CHOICE_Enum, 0);
+	{
+		// First value is the default.
+		spa_pod_builder_long(&b, int64_t(modifiers.front()));
+		for (auto modifier : modifiers)
+			spa_pod_builder_long(&b, int64_t(modifier));
+	}
+	spa_pod_builder_pop(&b, &f[1]);
+
+	spa_rectangle default_size = SPA_RECTANGLE(width, height);
+	spa_rectangle min_size = SPA_RECTANGLE(1, 1);
+	spa_rectangle max_size = SPA_RECTANGLE(65535, 65535);
+
+	spa_fraction default_fps = SPA_FRACTION(fps, 1);
+	spa_fraction lo_fps = SPA_FRACTION(0, 1);
+	spa_fraction hi_fps = SPA_FRACTION(fps, 1);
+
+	spa_pod_builder_add(&b, SPA_FORMAT_VIDEO_size,
+	                    SPA_POD_CHOICE_RANGE_Rectangle(&default_size, &min_size, &max_size), 0);
+	spa_pod_builder_add(&b, SPA_FORMAT_VIDEO_framerate,
+	                    SPA_POD_CHOICE_RANGE_Fraction(&default_fps, &lo_fps, &hi_fps), 0);
+
+	return static_cast<const spa_pod *>(spa_pod_builder_pop(&b, &f[0]));
+}
+
 bool PipewireStream::init(unsigned width, unsigned height, unsigned fps)
 {
 	if (!device.get_device_features().supports_drm_modifiers)
@@ -275,6 +501,7 @@ bool PipewireStream::init(unsigned width, unsigned height, unsigned fps)
 		.version = PW_VERSION_STREAM_EVENTS,
 		.state_changed = on_stream_state_changed,
 		.param_changed = on_stream_param_changed,
+		.remove_buffer = on_remove_buffer,
 		.process = on_process,
 	};
 
@@ -283,57 +510,26 @@ bool PipewireStream::init(unsigned width, unsigned height, unsigned fps)
 	if (!stream)
 		return false;
 
-	uint8_t buffer[1024];
-	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
-	const struct spa_pod *params = nullptr;
-	struct spa_pod_frame f[2];
+	// One EnumFormat per pixel format, since the supported modifiers depend on the format.
+	// The order is our preference.
+	std::vector<uint8_t> buffer(32 * 1024);
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer.data(), uint32_t(buffer.size()));
+	std::vector<const spa_pod *> params;
 
-	spa_pod_builder_push_object(&b, &f[0], SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat);
-	spa_pod_builder_add(&b, SPA_FORMAT_mediaType, SPA_POD_Id(SPA_MEDIA_TYPE_video), 0);
-	spa_pod_builder_add(&b, SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw), 0);
-	spa_pod_builder_add(&b, SPA_FORMAT_VIDEO_format, SPA_POD_Id(SPA_VIDEO_FORMAT_BGRx), 0);
+	for (auto &fmt : pipewire_formats)
+		if (auto *param = build_enum_format(b, fmt, width, height, fps))
+			params.push_back(param);
 
-	// Query which DRM format modifiers we can support for the default BGRA8 format.
-	VkFormatProperties3 props3 = { VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3 };
-	VkDrmFormatModifierPropertiesListEXT list = { VK_STRUCTURE_TYPE_DRM_FORMAT_MODIFIER_PROPERTIES_LIST_EXT };
-	props3.pNext = &list;
-	device.get_format_properties(VK_FORMAT_B8G8R8A8_SRGB, &props3);
-	std::vector<VkDrmFormatModifierPropertiesEXT> drm_props(list.drmFormatModifierCount);
-	list.pDrmFormatModifierProperties = drm_props.data();
-	device.get_format_properties(VK_FORMAT_B8G8R8A8_SRGB, &props3);
-	spa_pod_builder_prop(&b, SPA_FORMAT_VIDEO_modifier, SPA_POD_PROP_FLAG_MANDATORY | SPA_POD_PROP_FLAG_DONT_FIXATE);
-	spa_pod_builder_push_choice(&b, &f[1], SPA_CHOICE_Enum, 0);
+	if (params.empty())
 	{
-		for (auto &p : drm_props)
-		{
-			if (!(p.drmFormatModifierTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
-				continue;
-			spa_pod_builder_long(&b, int64_t(p.drmFormatModifier));
-			if (&p == &drm_props.front())
-				spa_pod_builder_long(&b, int64_t(p.drmFormatModifier));
-		}
+		LOGW("No PipeWire formats can be imported with DRM modifiers. Ignoring pipewire.\n");
+		return false;
 	}
-	spa_pod_builder_pop(&b, &f[1]);
-
-	spa_rectangle default_size = SPA_RECTANGLE(width, height);
-	spa_rectangle min_size = SPA_RECTANGLE(1, 1);
-	spa_rectangle max_size = SPA_RECTANGLE(65535, 65535);
-
-	spa_fraction default_fps = SPA_FRACTION(fps, 1);
-	spa_fraction lo_fps = SPA_FRACTION(0, 1);
-	spa_fraction hi_fps = SPA_FRACTION(fps, 1);
-
-	spa_pod_builder_add(&b, SPA_FORMAT_VIDEO_size,
-	                    SPA_POD_CHOICE_RANGE_Rectangle(&default_size, &min_size, &max_size), 0);
-	spa_pod_builder_add(&b, SPA_FORMAT_VIDEO_framerate,
-	                    SPA_POD_CHOICE_RANGE_Fraction(&default_fps, &lo_fps, &hi_fps), 0);
-
-	params = static_cast<spa_pod *>(spa_pod_builder_pop(&b, &f[0]));
 
 	if (pw_stream_connect(
 			stream, PW_DIRECTION_INPUT, PW_ID_ANY,
 			pw_stream_flags(PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS),
-			&params, 1))
+			params.data(), uint32_t(params.size())))
 	{
 		return false;
 	}
@@ -345,6 +541,7 @@ bool PipewireStream::init(unsigned width, unsigned height, unsigned fps)
 
 PipewireStream::~PipewireStream()
 {
+	invalidate_import_cache();
 	if (stream)
 		pw_stream_destroy(stream);
 	if (loop)
@@ -369,12 +566,164 @@ struct InstanceDeleter
 	}
 };
 
+enum class ComposeLayout
+{
+	None,
+	SideBySide,
+	Grid,
+	PictureInPicture
+};
+
+struct ComposeRect
+{
+	unsigned x, y, width, height;
+};
+
+static void compute_compose_layout(ComposeLayout layout, unsigned count, unsigned width, unsigned height,
+                                   ComposeRect *rects)
+{
+	if (!count)
+		return;
+
+	if (layout == ComposeLayout::PictureInPicture)
+	{
+		// First surface is fullscreen, the rest are stacked in quarter size along the bottom, right to left.
+		rects[0] = { 0, 0, width, height };
+		unsigned small_width = width / 4;
+		unsigned small_height = height / 4;
+		unsigned margin = height / 32;
+		for (unsigned i = 1; i < count; i++)
+		{
+			unsigned offset = i * (small_width + margin);
+			if (offset > width)
+			{
+				rects[i] = {};
+				continue;
+			}
+			rects[i] = { width - offset, height - small_height - margin, small_width, small_height };
+		}
+		return;
+	}
+
+	unsigned columns = count;
+	if (layout == ComposeLayout::Grid)
+	{
+		columns = 1;
+		while (columns * columns < count)
+			columns++;
+	}
+	unsigned rows = (count + columns - 1) / columns;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		unsigned column = i % columns;
+		unsigned row = i / columns;
+		rects[i] = { column * width / columns, row * height / rows,
+		             (column + 1) * width / columns - column * width / columns,
+		             (row + 1) * height / rows - row * height / rows };
+	}
+}
+
+// Letterbox a surface into its cell.
+static ComposeRect fit_rect_to_aspect(const ComposeRect &cell, unsigned width, unsigned height)
+{
+	if (!width || !height)
+		return {};
+
+	unsigned fit_width = cell.width;
+	unsigned fit_height = unsigned(uint64_t(cell.width) * height / width);
+	if (fit_height > cell.height)
+	{
+		fit_height = cell.height;
+		fit_width = unsigned(uint64_t(cell.height) * width / height);
+	}
+
+	return { cell.x + (cell.width - fit_width) / 2, cell.y + (cell.height - fit_height) / 2, fit_width, fit_height };
+}
+
+static Granite::VideoEncoder::Format select_encode_format(const char *encoder, unsigned bit_depth,
+                                                          bool chroma_444, bool hdr10)
+{
+	// Software codecs in FFmpeg all use yuv420p.
+	auto format = chroma_444 ?
+	              Granite::VideoEncoder::Format::YUV444P :
+	              Granite::VideoEncoder::Format::YUV420P;
+
+	if (bit_depth > 8)
+	{
+		if (strstr(encoder, "nvenc") != nullptr)
+			format = Granite::VideoEncoder::Format::P016;
+		else if (strstr(encoder, "vaapi") != nullptr)
+			format = Granite::VideoEncoder::Format::P010;
+		else if (strstr(encoder, "pyro") != nullptr)
+			format = Granite::VideoEncoder::Format::P016;
+	}
+
+	if (hdr10 && (strcmp(encoder, "pyrowave") == 0 || strcmp(encoder, "rawvideo") == 0))
+	{
+		format = chroma_444 ?
+		         Granite::VideoEncoder::Format::YUV444P16 :
+		         Granite::VideoEncoder::Format::YUV420P16;
+	}
+	else if (format == Granite::VideoEncoder::Format::YUV420P &&
+	         (strstr(encoder, "nvenc") != nullptr ||
+	          strstr(encoder, "vaapi") != nullptr ||
+	          strstr(encoder, "_pyro") != nullptr))
+	{
+		// GPU encoders only understand NV12.
+		format = Granite::VideoEncoder::Format::NV12;
+	}
+
+	return format;
+}
+
+// --encoder takes a single encoder, a comma separated list to try in order, or "auto".
+static std::vector<std::string> get_encoder_candidates(const std::string &encoder, unsigned bit_depth)
+{
+	// Fastest first. Vulkan video encodes on the GPU which already holds the frame,
+	// FFmpeg hardware encoders come next, and libx264 works everywhere.
+	if (encoder == "auto")
+	{
+		if (bit_depth > 8)
+			return { "h265_pyro", "hevc_nvenc", "hevc_vaapi", "libx264" };
+		else
+			return { "h264_pyro", "h264_nvenc", "h264_vaapi", "libx264" };
+	}
+
+	std::vector<std::string> candidates;
+	size_t begin = 0;
+	for (;;)
+	{
+		size_t end = encoder.find(',', begin);
+		auto candidate = encoder.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+		if (!candidate.empty())
+			candidates.push_back(std::move(candidate));
+		if (end == std::string::npos)
+			break;
+		begin = end + 1;
+	}
+
+	return candidates;
+}
+
+// Intra-only codecs, which no frame references. Outputs cannot mux them, only H.264, H.265 and AV1.
+static bool is_intra_only_encoder(const std::string &encoder)
+{
+	return encoder == "pyrowave" || encoder == "rawvideo";
+}
+
 struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory, Granite::MuxStreamCallback
 {
 	~SwapchainServer() override
 	{
 		group.wait_idle();
 		assert(handlers.empty());
+
+		if (local_backup.is_open())
+		{
+			local_backup.close();
+			log_local_backup_stats();
+		}
 	}
 
 	explicit SwapchainServer(Dispatcher &dispatcher_, bool gamepad_to_mouse)
@@ -410,6 +759,7 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 			dev.gpu = gpu;
 			memcpy(dev.driver_id, id_props.driverUUID, VK_UUID_SIZE);
 			memcpy(dev.device_uuid, id_props.deviceUUID, VK_UUID_SIZE);
+			dev.driver_version = props2.properties.driverVersion;
 
 			if (id_props.deviceLUIDValid)
 				memcpy(dev.luid, id_props.deviceLUID, VK_LUID_SIZE);
@@ -462,7 +812,7 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 				server.unregister_handler(this);
 
 				// Make sure we tear down the pipe handler as well.
-				const uint64_t sentinel[3] = { uint64_t(-1), uint64_t(-1), uint64_t(-1) };
+				const uint64_t sentinel[4] = { uint64_t(-1), uint64_t(-1), uint64_t(-1), 0 };
 				ssize_t ret = ::write(pipe_fd.get_native_handle(), &sentinel, sizeof(sentinel));
 				if (ret < 0 && errno != EPIPE)
 					LOGE("Failed to terminate pipe.\n");
@@ -505,6 +855,13 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 				return send_message(fd, MessageType::ErrorParameter, image_create.get_serial());
 			}
 
+			if (image_create.wire.vk_num_view_formats >
+			    sizeof(image_create.wire.vk_view_formats) / sizeof(image_create.wire.vk_view_formats[0]))
+			{
+				LOGE("Invalid num view formats.\n");
+				return send_message(fd, MessageType::ErrorParameter, image_create.get_serial());
+			}
+
 			Vulkan::ImageCreateInfo info = {};
 			info.domain = Vulkan::ImageDomain::Physical;
 			info.width = image_create.wire.width;
@@ -600,7 +957,9 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 				auto cross_info = info;
 				cross_info.external = {};
 				cross_info.misc &= ~Vulkan::IMAGE_MISC_EXTERNAL_MEMORY_BIT;
-				cross_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+				// TRANSFER_SRC for composition.
+				cross_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+				                   VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 
 				SwapchainImage image;
 				image.image = device.create_image(info);
@@ -687,6 +1046,9 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 			if (img.state != State::ClientOwned)
 				return send_message(fd, MessageType::ErrorProtocol, present.get_serial());
 
+			img.latency = {};
+			img.latency.mark(LatencyStage::Present, uint64_t(Util::get_current_time_nsecs()));
+
 			int64_t ts = server.encoder ? server.encoder->sample_realtime_pts() : 0;
 
 			Vulkan::Semaphore sem;
@@ -747,6 +1109,13 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 
 			bool wait_early = false;
 
+			// The staging memory of this image may still be read by the encoder's upload of the previous present.
+			// With external host memory, the readback writes directly into that memory, so the copy is recorded
+			// and submitted on the thread pool once the upload is done. Only the layout transition is submitted here,
+			// so the client's semaphore is consumed on this thread as usual.
+			Vulkan::Fence upload_fence = std::move(img.cross_device_upload_fence);
+			bool deferred_readback = upload_fence && img.cross_device_host_pointer;
+
 			if (img.src_cross_device_buffer)
 			{
 				cmd->acquire_image_barrier(*img.image, old_layout, new_layout,
@@ -761,12 +1130,8 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 					                   VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_TRANSFER_READ_BIT);
 				}
 
-				cmd->copy_image_to_buffer(*img.src_cross_device_buffer, *img.image, 0, {},
-				                          { img.image->get_width(), img.image->get_height(), 1 },
-				                          0, 0, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 });
-
-				cmd->barrier(VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
-				             VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+				if (!deferred_readback)
+					record_cross_device_readback(*cmd, *img.image, *img.src_cross_device_buffer);
 
 				// We must have a roundtrip between the GPUs when it's remote GPU presenting.
 				wait_early = true;
@@ -789,7 +1154,7 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 				wait_early = true;
 
 			Vulkan::Fence fence;
-			device.submit(cmd, &fence);
+			device.submit(cmd, deferred_readback ? nullptr : &fence);
 
 			// Mark the buffer async.
 			add_reference();
@@ -800,29 +1165,97 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 			if (!wait_early)
 			{
 				// Don't roundtrip to a socket and epoll loop when we can just handle the event inline.
-				const uint64_t buf[3] = { image_group_serial, present.wire.index, uint64_t(ts) };
+				const uint64_t buf[4] = { image_group_serial, present.wire.index, uint64_t(ts), 0 };
 				if (!handle_async(buf, false))
 					return false;
 			}
 
-			server.group.create_task(
-					[this, index = present.wire.index, serial = image_group_serial,
-						f = std::move(fence), ts]() mutable {
+			// Without external host memory, the readback is copied to the encoder device's staging buffer
+			// on the thread pool as soon as the source GPU is done, so the heartbeat only has to record the upload.
+			std::shared_ptr<CrossDeviceCopy> copy;
+			if (img.src_cross_device_buffer && !img.cross_device_host_pointer)
+			{
+				copy = std::make_shared<CrossDeviceCopy>();
+				copy->src_device = &device;
+				copy->dst_device = server.encoder_device;
+				copy->src = img.src_cross_device_buffer;
+				copy->dst = img.dst_cross_device_buffer;
+				copy->upload_fence = std::move(upload_fence);
+			}
+
+			Vulkan::ImageHandle readback_image;
+			Vulkan::BufferHandle readback_buffer;
+			if (deferred_readback)
+			{
+				readback_image = img.image;
+				readback_buffer = img.src_cross_device_buffer;
+			}
+
+			auto drain_task = server.group.create_task(
+					[this, dev = &device, index = present.wire.index, f = std::move(fence), copy,
+					 upload = deferred_readback ? std::move(upload_fence) : Vulkan::Fence(),
+					 readback_image, readback_buffer]() mutable {
 
 						Util::TimelineTraceFile::ScopedEvent scoped {
 							server.group.get_timeline_trace_file(), "GPU drain", uint32_t(index),
 						};
 
-						// Notify when the GPU is actually done.
+						if (upload)
+						{
+							upload->wait();
+							auto readback_cmd = dev->request_command_buffer(
+									Vulkan::CommandBuffer::Type::AsyncTransfer);
+							record_cross_device_readback(*readback_cmd, *readback_image, *readback_buffer);
+							dev->submit(readback_cmd, &f);
+						}
+
 						// We will not consider the image complete until GPU is done rendering.
 						f->wait();
-						const uint64_t buf[3] = { serial, index, uint64_t(ts) };
+						if (copy)
+							copy->map();
+					});
+			drain_task->set_desc("GPU drain");
+
+			auto notify_task = server.group.create_task(
+					[this, index = present.wire.index, serial = image_group_serial, copy, ts]() {
+						if (copy)
+							copy->unmap();
+
+						// Notify when the GPU is actually done.
+						const uint64_t buf[4] = { serial, index, uint64_t(ts), uint64_t(Util::get_current_time_nsecs()) };
 						ssize_t ret = ::write(pipe_fd.get_native_handle(), buf, sizeof(buf));
 						if (ret < 0 && errno != EPIPE)
 							LOGE("Failed to write to pipe.\n");
 
 						release_reference();
 					});
+			notify_task->set_desc("Present notify");
+
+			if (copy)
+			{
+				auto copy_task = server.group.create_task();
+				copy_task->set_desc("Cross-device copy");
+				size_t size = copy->src->get_create_info().size;
+				size_t stripe_size = std::max<size_t>(CrossDeviceCopy::MinStripeSize,
+				                                      (size + server.group.get_num_threads() - 1) /
+				                                      server.group.get_num_threads());
+				stripe_size = (stripe_size + CrossDeviceCopy::StripeAlignment - 1) &
+				              ~size_t(CrossDeviceCopy::StripeAlignment - 1);
+
+				for (size_t offset = 0; offset < size; offset += stripe_size)
+				{
+					copy_task->enqueue_task([copy, offset, count = std::min(stripe_size, size - offset)]() {
+						copy->copy_stripe(offset, count);
+					});
+				}
+
+				server.group.add_dependency(*copy_task, *drain_task);
+				server.group.add_dependency(*notify_task, *copy_task);
+			}
+			else
+			{
+				server.group.add_dependency(*notify_task, *drain_task);
+			}
 
 			if (!retire_obsolete_images())
 				return false;
@@ -830,6 +1263,17 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 			return true;
 		}
 
+		static void record_cross_device_readback(Vulkan::CommandBuffer &cmd, const Vulkan::Image &image,
+		                                         const Vulkan::Buffer &buffer)
+		{
+			cmd.copy_image_to_buffer(buffer, image, 0, {},
+			                         { image.get_width(), image.get_height(), 1 },
+			                         0, 0, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 });
+
+			cmd.barrier(VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+			            VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+		}
+
 		uint64_t compute_next_target_timestamp() const
 		{
 			// If there are no pending presentations in flight, lock-in for the next cycle.
@@ -857,6 +1301,14 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 			bool was_queued = images[index].state == State::PresentQueued;
 			assert(was_queued || images[index].state == State::PresentPendingReady);
 
+			// With immediate encode, the image may be latched before the GPU is confirmed done.
+			// Only the first transition is meaningful for latency.
+			if (was_queued)
+			{
+				images[index].latency.mark(LatencyStage::GPUDone, confirmed_gpu_done ? buf[3] : 0);
+				images[index].latency.mark(LatencyStage::Ready, uint64_t(Util::get_current_time_nsecs()));
+			}
+
 			images[index].state = confirmed_gpu_done ? State::PresentReady : State::PresentPendingReady;
 			images[index].event = { server.group.get_timeline_trace_file(),
 				confirmed_gpu_done ? "PresentPendingReady" : "PresentReady", uint32_t(index) };
@@ -882,7 +1334,7 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 
 		bool handle_async(const FileHandle &fd)
 		{
-			uint64_t buf[3];
+			uint64_t buf[4];
 			if (size_t(::read(fd.get_native_handle(), buf, sizeof(buf))) != sizeof(buf))
 				return false;
 			return handle_async(buf, true);
@@ -1055,6 +1507,7 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 			uint64_t target_timestamp = 0;
 			uint32_t target_period = 0;
 			uint64_t present_id = 0;
+			FrameTimestamps latency;
 			State state = State::ClientOwned;
 			Util::TimelineTraceFile::ScopedEvent event;
 
@@ -1063,6 +1516,45 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 			Vulkan::BufferHandle src_cross_device_buffer;
 			Vulkan::BufferHandle dst_cross_device_buffer;
 			Vulkan::ImageHandle dst_cross_device_image;
+			// Signals when the encoder device is done uploading from dst_cross_device_buffer.
+			Vulkan::Fence cross_device_upload_fence;
+		};
+
+		// Roundtrip between devices through the CPU when external host memory is not supported.
+		// The copy is split in stripes so that it is spread over the thread pool.
+		struct CrossDeviceCopy
+		{
+			enum { MinStripeSize = 1024 * 1024, StripeAlignment = 64 * 1024 };
+
+			Vulkan::Device *src_device = nullptr;
+			Vulkan::Device *dst_device = nullptr;
+			Vulkan::BufferHandle src;
+			Vulkan::BufferHandle dst;
+			Vulkan::Fence upload_fence;
+			const uint8_t *src_ptr = nullptr;
+			uint8_t *dst_ptr = nullptr;
+
+			void map()
+			{
+				if (upload_fence)
+					upload_fence->wait();
+				src_ptr = static_cast<const uint8_t *>(src_device->map_host_buffer(*src, Vulkan::MEMORY_ACCESS_READ_BIT));
+				dst_ptr = static_cast<uint8_t *>(dst_device->map_host_buffer(*dst, Vulkan::MEMORY_ACCESS_WRITE_BIT));
+			}
+
+			void copy_stripe(size_t offset, size_t size) const
+			{
+				if (src_ptr && dst_ptr)
+					memcpy(dst_ptr + offset, src_ptr + offset, size);
+			}
+
+			void unmap()
+			{
+				if (src_ptr)
+					src_device->unmap_host_buffer(*src, Vulkan::MEMORY_ACCESS_READ_BIT);
+				if (dst_ptr)
+					dst_device->unmap_host_buffer(*dst, Vulkan::MEMORY_ACCESS_WRITE_BIT);
+			}
 		};
 
 		SwapchainServer &server;
@@ -1081,6 +1573,7 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 		uint64_t timestamp_completed = 0;
 		uint64_t timestamp_stalled_count = 0;
 		uint64_t last_present_id = 0;
+		uint64_t last_encoded_present_id = 0;
 		uint64_t earliest_next_timestamp = 0;
 		FileHandle async_fd;
 		FileHandle pipe_fd;
@@ -1120,128 +1613,423 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 			if (encoder)
 			{
 				encoder->update_bitrate_kbits(video_encode.bitrate_kbits);
+				for (auto &parallel : parallel_encoders)
+					parallel.encoder->update_bitrate_kbits(video_encode.bitrate_kbits);
 				LOGI("Adjusting bitrate to %u kbits/s.\n", video_encode.bitrate_kbits);
 			}
 		}
 	}
 
-	void encode_surface(const ReadySurface &surface, uint64_t period_ns)
+	// Returns the image to read from on the encoder device, in READ_ONLY_OPTIMAL layout.
+	const Vulkan::Image *prepare_surface_image(Vulkan::CommandBuffer &cmd, const ReadySurface &surface)
 	{
-		update_bitrate();
-
-		Granite::VideoEncoder::YCbCrPipeline *ycbcr_pipeline = nullptr;
-		if (encoder)
-			ycbcr_pipeline = &pipeline[next_encode_task_slot];
+		auto &surf = surface.chain->images[surface.index];
+		if (!surf.src_cross_device_buffer)
+			return surf.image.get();
+
+		// For cross device, the staging buffer on the encoder device is filled by the time the image is ready.
+		// Either both GPUs see the same system memory, or the copy was done when the present completed.
+		cmd.image_barrier(*surf.dst_cross_device_image, VK_IMAGE_LAYOUT_UNDEFINED,
+		                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, 0,
+		                  VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+		cmd.copy_buffer_to_image(*surf.dst_cross_device_image, *surf.dst_cross_device_buffer,
+		                         0, {}, { surf.dst_cross_device_image->get_width(), surf.dst_cross_device_image->get_height(), 1 },
+		                         0, 0, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 });
+
+		cmd.image_barrier(*surf.dst_cross_device_image,
+		                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+		                  VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_BLIT_BIT,
+		                  VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT);
+
+		return surf.dst_cross_device_image.get();
+	}
 
-		client_heartbeat_count++;
-		bool encode_frame = client_heartbeat_count >= client_rate_multiplier;
-		if (encode_frame)
-			client_heartbeat_count = 0;
+	// Blits all surfaces into one encoder sized image according to the layout.
+	// The composition image takes the format of the first surface, so that surface is copied exactly.
+	const Vulkan::Image *compose_surfaces(Vulkan::CommandBuffer &cmd, const ReadySurface *surfaces, unsigned count)
+	{
+		const Vulkan::Image *images[MaxComposedSurfaces];
+		for (unsigned i = 0; i < count; i++)
+			images[i] = prepare_surface_image(cmd, surfaces[i]);
 
-		if (encoder && encoder_device && ycbcr_pipeline && encode_frame)
+		VkFormat format = images[0]->get_format();
+		if (!composition_image || composition_image->get_format() != format)
 		{
-			auto pts = surface.pts;
-			if (pts == 0)
-				pts = encoder->sample_realtime_pts();
-
-			// Composite the final YCbCr frame here.
-			// For now, just select one candidate and pretend it's the foreground flip.
+			auto info = Vulkan::ImageCreateInfo::immutable_2d_image(video_encode.width, video_encode.height, format);
+			// TRANSFER_SRC for content scaling.
+			info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			if (Vulkan::format_is_srgb(format))
+				info.misc |= Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT;
+			composition_image = encoder_device->create_image(info);
+			if (!composition_image)
+			{
+				LOGE("Failed to create composition image.\n");
+				return nullptr;
+			}
+		}
+
+		cmd.image_barrier(*composition_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		                  VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+		cmd.clear_image(*composition_image, {});
+		cmd.barrier(VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		            VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+		ComposeRect rects[MaxComposedSurfaces];
+		compute_compose_layout(video_encode.compose, count, video_encode.width, video_encode.height, rects);
+
+		for (unsigned i = 0; i < count; i++)
+		{
+			auto &img = *images[i];
+			auto rect = fit_rect_to_aspect(rects[i], img.get_width(), img.get_height());
+			if (rect.width == 0 || rect.height == 0)
+				continue;
+
+			cmd.image_barrier(img, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			                  VK_PIPELINE_STAGE_2_BLIT_BIT, 0,
+			                  VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+			cmd.blit_image(*composition_image, img,
+			               { int(rect.x), int(rect.y), 0 }, { int(rect.width), int(rect.height), 1 },
+			               {}, { int(img.get_width()), int(img.get_height()), 1 }, 0, 0);
+
+			cmd.image_barrier(img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+			                  VK_PIPELINE_STAGE_2_BLIT_BIT, 0,
+			                  VK_PIPELINE_STAGE_2_BLIT_BIT, 0);
+		}
+
+		cmd.image_barrier(*composition_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+		                  VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+
+		return composition_image.get();
+	}
+
+	// Downscales the image before YCbCr conversion, which scales it back up to the encode resolution.
+	const Vulkan::Image *scale_content(Vulkan::CommandBuffer &cmd, const Vulkan::Image &img, unsigned level)
+	{
+		if (!level)
+			return &img;
+
+		unsigned scale = ContentScaleEighths[level];
+		unsigned width = std::max(2u, video_encode.width * scale / 8);
+		unsigned height = std::max(2u, video_encode.height * scale / 8);
+
+		// Already low resolution, nothing to gain.
+		if (img.get_width() <= width && img.get_height() <= height)
+			return &img;
+
+		VkFormat format = img.get_format();
+		auto &scaled_image = scaled_images[level];
+		if (!scaled_image || scaled_image->get_format() != format ||
+		    scaled_image->get_width() != width || scaled_image->get_height() != height)
+		{
+			auto info = Vulkan::ImageCreateInfo::immutable_2d_image(width, height, format);
+			info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+			info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			if (Vulkan::format_is_srgb(format))
+				info.misc |= Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT;
+			scaled_image = encoder_device->create_image(info);
+			if (!scaled_image)
+			{
+				LOGE("Failed to create scaled image.\n");
+				return &img;
+			}
+		}
+
+		cmd.image_barrier(*scaled_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		                  VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+		cmd.image_barrier(img, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		                  VK_PIPELINE_STAGE_2_BLIT_BIT, 0,
+		                  VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+		cmd.blit_image(*scaled_image, img,
+		               {}, { int(width), int(height), 1 },
+		               {}, { int(img.get_width()), int(img.get_height()), 1 }, 0, 0);
+
+		cmd.image_barrier(img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+		                  VK_PIPELINE_STAGE_2_BLIT_BIT, 0,
+		                  VK_PIPELINE_STAGE_2_BLIT_BIT, 0);
+		cmd.image_barrier(*scaled_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+		                  VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+
+		return scaled_image.get();
+	}
+
+	double get_full_resolution_bpp(unsigned bitrate_kbits) const
+	{
+		return double(bitrate_kbits) * 1000.0 /
+		       (double(video_encode.fps) * video_encode.width * video_encode.height);
+	}
+
+	// Picks a content scale from the bits per pixel the bitrate allows, moving at most one step.
+	// The thresholds are far enough apart that one step never triggers the opposite step.
+	unsigned step_content_scale_level(unsigned bitrate_kbits, unsigned level) const
+	{
+		double full_bpp = get_full_resolution_bpp(bitrate_kbits);
+
+		auto bpp_at_level = [&](unsigned l) {
+			double scale = double(ContentScaleEighths[l]) / 8.0;
+			return full_bpp / (scale * scale);
+		};
+
+		if (level + 1 < NumContentScaleLevels && bpp_at_level(level) < ContentScaleLowBpp)
+			level++;
+		else if (level > 0 && bpp_at_level(level - 1) > ContentScaleHighBpp)
+			level--;
+
+		return level;
+	}
+
+	void update_content_scale()
+	{
+		if (!video_encode.adaptive_resolution || ++content_scale_frame_count < video_encode.fps)
+			return;
+		content_scale_frame_count = 0;
+
+		unsigned level = step_content_scale_level(video_encode.bitrate_kbits, content_scale_level);
+		if (level != content_scale_level)
+		{
+			LOGI("Adjusting content scale to %u / 8 (%.3f bits per pixel at full resolution).\n",
+			     ContentScaleEighths[level], get_full_resolution_bpp(video_encode.bitrate_kbits));
+			content_scale_level = level;
+		}
+
+		for (auto &rendition : renditions)
+		{
+			level = step_content_scale_level(rendition->bitrate_kbits, rendition->content_scale_level);
+			if (level != rendition->content_scale_level)
+			{
+				LOGI("Adjusting content scale of rendition %u to %u / 8.\n", rendition->index, ContentScaleEighths[level]);
+				rendition->content_scale_level = level;
+			}
+		}
+	}
+
+	// With parallel encode, every pipeline slot belongs to one encoder, so each encoder only sees its own frames.
+	unsigned get_slot_encoder_index(unsigned slot) const
+	{
+		return slot % (unsigned(parallel_encoders.size()) + 1);
+	}
+
+	Granite::VideoEncoder &get_slot_encoder(unsigned slot)
+	{
+		unsigned index = get_slot_encoder_index(slot);
+		return index ? *parallel_encoders[index - 1].encoder : *encoder;
+	}
+
+	Granite::TaskGroupHandle &get_slot_encode_dependency(unsigned slot)
+	{
+		unsigned index = get_slot_encoder_index(slot);
+		return index ? parallel_encoders[index - 1].last_encode_dependency : last_encode_dependency;
+	}
+
+	void complete_encoded_frame(FrameTimestamps &latency, bool is_last_encode)
+	{
+		frame_latency.add_frame(latency);
+		trace_frame_latency(latency);
+
+		if (is_last_encode)
+			encode_pacer.end_frame(uint64_t(Util::get_current_time_nsecs()));
+	}
+
+	void encode_surface(const ReadySurface &surface, uint64_t period_ns)
+	{
+		encode_surfaces(&surface, 1, period_ns);
+	}
+
+	// Surfaces without a chain are either a PipeWire image or a dummy frame, and are never composed.
+	void encode_surfaces(const ReadySurface *surfaces, unsigned count, uint64_t period_ns)
+	{
+		auto &surface = surfaces[0];
+		update_bitrate();
+		update_content_scale();
+
+		Granite::VideoEncoder::YCbCrPipeline *ycbcr_pipeline = nullptr;
+		Granite::VideoEncoder *slot_encoder = nullptr;
+		if (encoder)
+		{
+			ycbcr_pipeline = &pipeline[next_encode_task_slot];
+			slot_encoder = &get_slot_encoder(next_encode_task_slot);
+		}
+
+		client_heartbeat_count++;
+		bool encode_frame = client_heartbeat_count >= client_rate_multiplier;
+		if (encode_frame)
+			client_heartbeat_count = 0;
+
+		// Static output is encoded at a reduced rate.
+		// The idle background goes through a warm-up first, since it replaces real content.
+		bool is_idle = !surface.chain && !surface.img && !video_encode.benchmark_frames;
+		if (!is_idle && !is_static_frame(surfaces, count))
+		{
+			static_frame_count = 0;
+		}
+		else if (encode_frame)
+		{
+			static_frame_count++;
+			bool warm = !is_idle || static_frame_count > IdleWarmupFrames;
+			// Key frames are only forced from an encode, so a new client or a loss repair must not wait
+			// for the reduced rate.
+			if (warm && (static_frame_count % static_frame_interval) != 0 &&
+			    !pyro.has_pending_idr() && !outputs.has_idr_request())
+			{
+				encode_frame = false;
+			}
+		}
+
+		// A dropped frame is merged into the next one, which latches the newest present anyway.
+		if (encoder && encoder_device && encode_frame &&
+		    !encode_pacer.begin_frame(uint64_t(Util::get_current_time_nsecs())))
+		{
+			encode_frame = false;
+		}
+
+		bool overloaded;
+		if (encode_pacer.get_and_clear_overload_change(overloaded))
+		{
+			if (overloaded)
+				LOGW("Encoder cannot keep up with %u fps, dropping frames to bound latency.\n", video_encode.fps);
+			else
+				LOGI("Encoder keeps up with frame rate again.\n");
+		}
+
+		if (encoder && encoder_device && ycbcr_pipeline && encode_frame)
+		{
+			auto pts = surface.pts;
+			if (pts == 0)
+				pts = encoder->sample_realtime_pts();
+
+			FrameTimestamps latency;
+			if (surface.chain)
+				latency = surface.chain->images[surface.index].latency;
+			latency.frame_id = ++latency_frame_count;
+			latency.mark(LatencyStage::Latch, uint64_t(Util::get_current_time_nsecs()));
+
+			// Composite the final YCbCr frame here.
+			// Unless composing, just select one candidate and pretend it's the foreground flip.
 			auto cmd = encoder_device->request_command_buffer(Vulkan::CommandBuffer::Type::AsyncCompute);
 
+			// Every rendition converts the same captured or composited image, so that part is only done once.
+			// Renditions at the same content scale also share the downscaled image.
+			const Vulkan::Image *scaled_by_level[NumContentScaleLevels] = {};
+			auto process_rgb = [&](const Vulkan::Image &img, VkColorSpaceKHR color_space, bool scale) {
+				auto convert = [&](Granite::VideoEncoder &enc, Granite::VideoEncoder::YCbCrPipeline &pipe, unsigned level) {
+					const Vulkan::Image *src = &img;
+					if (scale && level)
+					{
+						if (!scaled_by_level[level])
+							scaled_by_level[level] = scale_content(*cmd, img, level);
+						src = scaled_by_level[level];
+					}
+					enc.process_rgb(*cmd, pipe, src->get_view(), color_space);
+				};
+
+				convert(*slot_encoder, *ycbcr_pipeline, content_scale_level);
+				for (auto &rendition : renditions)
+					convert(*rendition->encoder, rendition->pipeline[next_encode_task_slot], rendition->content_scale_level);
+			};
+
 			if (surface.img)
 			{
 				// External image from pipewire. Acquire and release properly from external queue.
 				cmd->acquire_image_barrier(*surface.img, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
 				                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
-				encoder->process_rgb(*cmd, *ycbcr_pipeline, surface.img->get_view(), VK_COLOR_SPACE_SRGB_NONLINEAR_KHR);
+				process_rgb(*surface.img, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR, false);
 				cmd->release_image_barrier(*surface.img, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
 				                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0);
 			}
-			else if (!surface.chain)
+			else if (!surface.chain && video_encode.benchmark_frames)
 			{
-				// Some dummy background thing.
-				auto info = Vulkan::ImageCreateInfo::immutable_2d_image(1, 1, VK_FORMAT_R8G8B8A8_UNORM);
-				info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-				info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
-				info.misc |= Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT;
-				auto img = encoder_device->create_image(info);
-				cmd->image_barrier(*img, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				                   0, 0,
-				                   VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
-
-				VkClearValue value = {};
-				value.color.float32[0] = 0.1f;
-				value.color.float32[1] = 0.2f;
-				value.color.float32[2] = 0.3f;
-				cmd->clear_image(*img, value);
-				cmd->image_barrier(*img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
-				                   VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
-				                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
-				encoder->process_rgb(*cmd, *ycbcr_pipeline, img->get_view());
+				process_rgb(render_benchmark_frame(*cmd), VK_COLOR_SPACE_SRGB_NONLINEAR_KHR, false);
 			}
-			else
+			else if (!surface.chain)
 			{
-				auto &surf = surface.chain->images[surface.index];
-				const Vulkan::ImageView *view;
-
-				if (surf.src_cross_device_buffer)
+				// Some dummy background thing.
+				if (!idle_image)
 				{
-					// For cross device, the memory is in system memory once the fence has signalled.
-					// If we have external host memory, we can bypass the memcpy since both GPUs will see the system memory.
-					if (!surf.cross_device_host_pointer)
-					{
-						auto &src_device = surface.chain->association.ctx->device;
-						auto *src = src_device.map_host_buffer(*surf.src_cross_device_buffer, Vulkan::MEMORY_ACCESS_READ_BIT);
-						auto *dst = encoder_device->map_host_buffer(*surf.dst_cross_device_buffer, Vulkan::MEMORY_ACCESS_WRITE_BIT);
-						memcpy(dst, src, surf.src_cross_device_buffer->get_create_info().size);
-						src_device.unmap_host_buffer(*surf.src_cross_device_buffer, Vulkan::MEMORY_ACCESS_READ_BIT);
-						encoder_device->unmap_host_buffer(*surf.dst_cross_device_buffer, Vulkan::MEMORY_ACCESS_WRITE_BIT);
-					}
-
-					cmd->image_barrier(*surf.dst_cross_device_image, VK_IMAGE_LAYOUT_UNDEFINED,
-					                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, 0,
-					                   VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
-
-					cmd->copy_buffer_to_image(*surf.dst_cross_device_image, *surf.dst_cross_device_buffer,
-					                          0, {}, { surf.dst_cross_device_image->get_width(), surf.dst_cross_device_image->get_height(), 1 },
-					                          0, 0, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 });
-
-					cmd->image_barrier(*surf.dst_cross_device_image,
-					                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
-					                   VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+					auto info = Vulkan::ImageCreateInfo::immutable_2d_image(1, 1, VK_FORMAT_R8G8B8A8_UNORM);
+					info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+					info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+					info.misc |= Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT;
+					idle_image = encoder_device->create_image(info);
+					cmd->image_barrier(*idle_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					                   0, 0,
+					                   VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+					VkClearValue value = {};
+					value.color.float32[0] = 0.1f;
+					value.color.float32[1] = 0.2f;
+					value.color.float32[2] = 0.3f;
+					cmd->clear_image(*idle_image, value);
+					cmd->image_barrier(*idle_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+					                   VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
 					                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
-
-					view = &surf.dst_cross_device_image->get_view();
 				}
+
+				process_rgb(*idle_image, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR, false);
+			}
+			else
+			{
+				const Vulkan::Image *img;
+				if (count > 1)
+					img = compose_surfaces(*cmd, surfaces, count);
 				else
-				{
-					view = &surf.image->get_view();
-				}
+					img = prepare_surface_image(*cmd, surface);
 
-				if (view)
-					encoder->process_rgb(*cmd, *ycbcr_pipeline, *view, surface.chain->color_space);
+				if (img)
+					process_rgb(*img, surface.chain->color_space, true);
 			}
 
-			encoder->submit_process_rgb(cmd, *ycbcr_pipeline);
+			slot_encoder->submit_process_rgb(cmd, *ycbcr_pipeline);
+
+			// Conversions for all renditions were recorded in the command buffer above.
+			// Anything submitted after it on the same queue observes them, so an empty command buffer is enough.
+			for (auto &rendition : renditions)
+			{
+				auto rendition_cmd = encoder_device->request_command_buffer(Vulkan::CommandBuffer::Type::AsyncCompute);
+				rendition->encoder->submit_process_rgb(rendition_cmd, rendition->pipeline[next_encode_task_slot]);
+			}
+			latency.mark(LatencyStage::Convert, uint64_t(Util::get_current_time_nsecs()));
 
 			// Need one binary semaphore for every composited surface.
 			// Relying on external timelines would be nice though,
 			// but won't play nice with WSI layering :(
 			int compensate_audio_us = 0;
-			if (surface.chain)
+			for (unsigned i = 0; i < count; i++)
 			{
-				auto &surf = surface.chain->images[surface.index];
+				if (!surfaces[i].chain)
+					continue;
+
+				auto &surf = surfaces[i].chain->images[surfaces[i].index];
 
 				// If we're cross device, we're done reading the image when the present fence signals,
 				// so don't need a semaphore. It will also not work since we have to send a semaphore
 				// for the expected device.
-				if (&surface.chain->association.ctx->device == encoder_device)
+				if (&surfaces[i].chain->association.ctx->device == encoder_device)
 				{
 					auto sem = encoder_device->request_semaphore_external(
 							VK_SEMAPHORE_TYPE_BINARY_KHR, Vulkan::ExternalHandle::get_opaque_semaphore_handle_type());
 					encoder_device->submit_empty(Vulkan::CommandBuffer::Type::AsyncCompute, nullptr, sem.get());
 					surf.last_read_semaphore = std::move(sem);
 				}
+				else
+				{
+					// The staging buffer cannot be overwritten by the next present until the upload is done.
+					Vulkan::Fence fence;
+					encoder_device->submit_empty(Vulkan::CommandBuffer::Type::AsyncCompute, &fence, nullptr);
+					surf.cross_device_upload_fence = std::move(fence);
+				}
+			}
+
+			if (surface.chain)
+			{
+				auto &surf = surface.chain->images[surface.index];
 
 				// Compensate audio latency with FIFO latency here.
 				// Somewhat crude, but hey.
@@ -1252,21 +2040,106 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 				                      int(period_ns / 1000);
 			}
 
-			encode_tasks[next_encode_task_slot] = group.create_task(
-					[this, ycbcr_pipeline, pts, compensate_audio_us]()
-					{
-						if (!encoder->encode_frame(*ycbcr_pipeline, pts, compensate_audio_us))
-							LOGE("Failed to encode frame.\n");
-					});
+			// With renditions, the frame is done once the slowest encode is done.
+			bool is_last_encode = renditions.empty();
+			if (encode_reorder)
+			{
+				// Packets are held back until all earlier frames are sent, which is when the frame counts as done.
+				uint64_t frame = encode_reorder->begin_frame();
+				unsigned index = get_slot_encoder_index(next_encode_task_slot);
+				encode_tasks[next_encode_task_slot] = group.create_task(
+						[this, slot_encoder, index, frame, ycbcr_pipeline, pts, compensate_audio_us,
+						 latency, is_last_encode]() mutable
+						{
+							if (!slot_encoder->encode_frame(*ycbcr_pipeline, pts, compensate_audio_us))
+								LOGE("Failed to encode frame.\n");
+							latency.mark(LatencyStage::Encoded, uint64_t(Util::get_current_time_nsecs()));
+
+							encode_reorder->end_frame(frame, index, [this, latency, is_last_encode]() mutable {
+								latency.mark(LatencyStage::Sent, uint64_t(Util::get_current_time_nsecs()));
+								complete_encoded_frame(latency, is_last_encode);
+							});
+						});
+			}
+			else
+			{
+				encode_tasks[next_encode_task_slot] = group.create_task(
+						[this, ycbcr_pipeline, pts, compensate_audio_us, latency, is_last_encode]() mutable
+						{
+							// Without parallel encode, encode tasks are serialized,
+							// so packets emitted from here belong to this frame.
+							current_encode_latency = &latency;
+							if (!encoder->encode_frame(*ycbcr_pipeline, pts, compensate_audio_us))
+								LOGE("Failed to encode frame.\n");
+							current_encode_latency = nullptr;
+
+							// When muxing directly, packets are not observable.
+							if (!latency.get(LatencyStage::Encoded))
+							{
+								auto t = uint64_t(Util::get_current_time_nsecs());
+								latency.mark(LatencyStage::Encoded, t);
+								latency.mark(LatencyStage::Sent, t);
+							}
+
+							complete_encoded_frame(latency, is_last_encode);
+						});
+			}
 
 			encode_tasks[next_encode_task_slot]->set_desc("FFmpeg encode");
 
 			// Ensure ordering between encode operations.
-			if (last_encode_dependency)
-				group.add_dependency(*encode_tasks[next_encode_task_slot], *last_encode_dependency);
-			last_encode_dependency = group.create_task();
-			group.add_dependency(*last_encode_dependency, *encode_tasks[next_encode_task_slot]);
+			// An encoder owns a single codec context and emits packets from encode_frame(),
+			// so it cannot encode frames concurrently, and inter-frame codecs need every frame in order.
+			// With parallel encode, frames of intra-only codecs are independent, so only frames which go to
+			// the same encoder are ordered, and the reorder stage restores frame order for the packets.
+			// Conversion to YCbCr for later frames still overlaps since it is submitted from the heartbeat.
+			auto &encode_dependency = get_slot_encode_dependency(next_encode_task_slot);
+			if (encode_dependency)
+				group.add_dependency(*encode_tasks[next_encode_task_slot], *encode_dependency);
+			encode_dependency = group.create_task();
+			group.add_dependency(*encode_dependency, *encode_tasks[next_encode_task_slot]);
+
+			// Renditions have their own codec contexts, so they encode in parallel with the primary encode,
+			// each serialized against its own previous frame.
+			// The slot is busy until every rendition is done, since they all read the pipelines of the slot.
+			Granite::TaskGroupHandle frame_done;
+			if (!renditions.empty())
+			{
+				frame_done = group.create_task([this]() {
+					encode_pacer.end_frame(uint64_t(Util::get_current_time_nsecs()));
+				});
+				group.add_dependency(*frame_done, *encode_tasks[next_encode_task_slot]);
+			}
+
+			for (auto &rendition : renditions)
+			{
+				auto *r = rendition.get();
+				auto *rendition_pipeline = &r->pipeline[next_encode_task_slot];
+				auto task = group.create_task([r, rendition_pipeline, pts]() {
+					if (!r->encoder->encode_frame(*rendition_pipeline, pts, 0))
+						LOGE("Failed to encode frame for rendition %u.\n", r->index);
+				});
+				task->set_desc("FFmpeg encode rendition");
+
+				if (r->last_encode_dependency)
+					group.add_dependency(*task, *r->last_encode_dependency);
+				r->last_encode_dependency = group.create_task();
+				group.add_dependency(*r->last_encode_dependency, *task);
+				group.add_dependency(*frame_done, *task);
+				task->flush();
+			}
+
 			encode_tasks[next_encode_task_slot]->flush();
+			if (frame_done)
+			{
+				frame_done->flush();
+				encode_tasks[next_encode_task_slot] = std::move(frame_done);
+			}
+
+			for (unsigned i = 0; i < count; i++)
+				if (surfaces[i].chain)
+					surfaces[i].chain->last_encoded_present_id = surfaces[i].chain->images[surfaces[i].index].present_id;
+			last_encoded_surface_count = count;
 
 			next_encode_task_slot = (next_encode_task_slot + 1) % NumEncodeTasks;
 		}
@@ -1279,7 +2152,8 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 	void notify_async_surface(const ReadySurface &surface)
 	{
 		// Defer encode / composite to heartbeat vblank.
-		if (!video_encode.immediate)
+		// Composition needs all surfaces, so it is always locked to the heartbeat.
+		if (!video_encode.immediate || video_encode.compose != ComposeLayout::None)
 			return;
 
 		// If video encode threads are busy, defer.
@@ -1293,9 +2167,24 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 
 	bool heartbeat(uint64_t period_ns)
 	{
+		if (latency_report_interval && ++latency_report_count >= latency_report_interval * client_rate_multiplier)
+		{
+			log_frame_latency();
+			log_encode_pacer_stats();
+			if (local_backup_muxed || local_backup.is_open())
+				log_local_backup_stats();
+			if (audio_record)
+				log_audio_drift_stats();
+			latency_report_count = 0;
+		}
+
 		// Only relevant if we performed encode out of band.
 		if (!video_encode.immediate && encode_tasks[next_encode_task_slot])
 		{
+			// The benchmark runs on a virtual clock, so wait instead of dropping frames.
+			if (video_encode.benchmark_frames)
+				encode_tasks[next_encode_task_slot]->wait();
+
 			if (!encode_tasks[next_encode_task_slot]->poll())
 			{
 				// Encoding is too slow. This is considered a stalled heartbeat.
@@ -1307,6 +2196,8 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 		// Latch ready surfaces. If we did out of band encode, we will signal the completion here
 		// to ensure stable frame pacing.
 		ReadySurface ready_surface = {};
+		ReadySurface compose_surfaces[MaxComposedSurfaces];
+		unsigned num_compose_surfaces = 0;
 
 		for (auto &handler : handlers)
 		{
@@ -1318,11 +2209,25 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 			}
 
 			if (index >= 0)
+			{
 				ready_surface = { handler.get(), index };
+				if (num_compose_surfaces < MaxComposedSurfaces)
+					compose_surfaces[num_compose_surfaces++] = ready_surface;
+			}
 		}
 
 		// If we're using pipewire, never encode dummy frames since we won't have normal handlers.
-		if (!video_encode.pipewire && (!video_encode.immediate || handlers.empty()))
+		if (video_encode.pipewire)
+			return true;
+
+		if (video_encode.benchmark_frames)
+			ready_surface.pts = int64_t(++benchmark_tick * period_ns / 1000);
+
+		if (video_encode.compose != ComposeLayout::None && num_compose_surfaces)
+			encode_surfaces(compose_surfaces, num_compose_surfaces, period_ns);
+		else if (video_encode.compose != ComposeLayout::None)
+			encode_surface(ready_surface, period_ns);
+		else if (!video_encode.immediate || handlers.empty())
 			encode_surface(ready_surface, period_ns);
 		return true;
 	}
@@ -1432,6 +2337,7 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 		VkPhysicalDevice gpu;
 		uint8_t device_uuid[VK_UUID_SIZE];
 		uint8_t driver_id[VK_UUID_SIZE];
+		uint32_t driver_version;
 		uint8_t luid[VK_UUID_SIZE];
 		VkBool32 luid_valid;
 		std::unique_ptr<DeviceContext> context;
@@ -1445,11 +2351,28 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 	std::vector<DeviceContextAssociation> associations;
 
 	Granite::VideoEncoder::YCbCrPipeline pipeline[NumEncodeTasks];
+	// Extra outputs run on their own threads, so a stalled ingest server cannot hold up pyro clients.
+	// Declared before the encoder, since the encoder may flush packets when it is destroyed.
+	PacketFanout outputs;
+	// Encoded packets which outlive the encoder callback are copied into buffers from here.
+	Util::IntrusivePtr<PacketBufferPool> packet_pool = Util::make_handle<PacketBufferPool>();
+	// Only with parallel encode. Declared before the encoders, since they buffer packets in it.
+	std::unique_ptr<EncodeReorder> encode_reorder;
 	std::unique_ptr<Granite::VideoEncoder> encoder;
 	Vulkan::Device *encoder_device = nullptr;
 
+	// With parallel encode, frames of intra-only codecs are spread round robin over the primary encoder
+	// and these. Each encoder is only serialized against its own previous frame.
+	struct ParallelEncoder
+	{
+		std::unique_ptr<Granite::VideoEncoder> encoder;
+		Granite::TaskGroupHandle last_encode_dependency;
+	};
+	std::vector<ParallelEncoder> parallel_encoders;
+
 	// Audio recorder must be destroyed before encoder.
-	std::unique_ptr<Granite::Audio::RecordStream> audio_record;
+	// Wraps the device stream, so audio stays locked to the heartbeat clock.
+	std::unique_ptr<DriftCompensatedRecordStream> audio_record;
 
 	Granite::TaskGroupHandle last_encode_dependency;
 	Granite::TaskGroupHandle encode_tasks[NumEncodeTasks];
@@ -1458,6 +2381,45 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 
 	PyroStreamServer pyro;
 
+	// Lower bitrate encodes of the same frame, for pyro clients which cannot keep up with the primary encode.
+	// Declared after pyro, since the encoders may flush packets when they are destroyed.
+	struct Rendition final : Granite::MuxStreamCallback
+	{
+		Rendition(PyroStreamServer &pyro_, unsigned index_)
+			: pyro(pyro_), index(index_)
+		{
+		}
+
+		PyroStreamServer &pyro;
+		unsigned index;
+		unsigned bitrate_kbits = 0;
+		unsigned content_scale_level = 0;
+		Granite::VideoEncoder::YCbCrPipeline pipeline[NumEncodeTasks];
+		std::unique_ptr<Granite::VideoEncoder> encoder;
+		Granite::TaskGroupHandle last_encode_dependency;
+
+		// Codec parameters are shared with the primary encode, which already delivered them.
+		void set_codec_parameters(const pyro_codec_parameters &) override
+		{
+		}
+
+		void write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame) override
+		{
+			pyro.write_video_packet(pts, dts, data, size, is_key_frame, index);
+		}
+
+		// Audio only goes through the primary encode.
+		void write_audio_packet(int64_t, int64_t, const void *, size_t) override
+		{
+		}
+
+		bool should_force_idr() override
+		{
+			return pyro.should_force_idr(index);
+		}
+	};
+	std::vector<std::unique_ptr<Rendition>> renditions;
+
 	struct Options
 	{
 		std::string path;
@@ -1469,7 +2431,9 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 		unsigned max_bitrate_kbits = 8000;
 		unsigned vbv_size_kbits = 6000;
 		unsigned threads = 0;
-		unsigned audio_rate = 44100;
+		unsigned audio_rate = 48000;
+		unsigned audio_channels = 2;
+		AudioDriftCompensator::Options audio_drift;
 		float gop_seconds = 2.0f;
 		bool low_latency = false;
 		bool audio = true;
@@ -1483,16 +2447,294 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 		std::string x264_preset = "fast";
 		std::string x264_tune;
 		std::string local_backup_path;
+		AsyncFileWriter::Options local_backup;
 		std::string encoder = "libx264";
+		// Where encoder probe results are cached when there is more than one encoder candidate.
+		// Empty disables the cache.
+		std::string encoder_cache_dir = EncoderProbeCache::get_default_directory();
 		std::string muxer;
+		// Muxed alongside pyro clients. When set, path is empty and the encoder goes through the mux callback.
+		std::vector<std::string> outputs;
+		ComposeLayout compose = ComposeLayout::None;
+		// Negative means pick a default based on the output.
+		int idle_fps = -1;
+		unsigned latency_report_seconds = 0;
+		bool adaptive_resolution = false;
+		// Encode synthetic frames as fast as possible instead of serving clients.
+		unsigned benchmark_frames = 0;
+		// Longest time from latching a frame until it is encoded. 0 picks two frame intervals.
+		unsigned encode_budget_ms = 0;
+		// Bitrates of extra renditions for pyro clients, in decreasing order.
+		std::vector<unsigned> simulcast_kbits;
+		// Encoders which encode frames concurrently. Only for intra-only codecs, must divide NumEncodeTasks.
+		unsigned parallel_encoders = 1;
+		PhaseOffsetPolicy phase_policy = PhaseOffsetPolicy::Median;
+		PhaseController::Options phase_controller;
 	} video_encode;
 
+	enum { MaxComposedSurfaces = 16 };
+	Vulkan::ImageHandle composition_image;
+
+	// With adaptive resolution, content is downscaled when the bitrate is too low for the encode resolution.
+	// The coded size stays fixed, since pyro clients cannot renegotiate codec parameters mid-stream.
+	enum { NumContentScaleLevels = 3 };
+	static constexpr unsigned ContentScaleEighths[NumContentScaleLevels] = { 8, 6, 4 };
+	static constexpr double ContentScaleLowBpp = 0.04;
+	static constexpr double ContentScaleHighBpp = 0.1;
+	// Indexed by content scale level. Level 0 is never scaled.
+	Vulkan::ImageHandle scaled_images[NumContentScaleLevels];
+	unsigned content_scale_level = 0;
+	unsigned content_scale_frame_count = 0;
+
+	// Drops frames which would finish encoding too late, so latency stays bounded when encoding cannot keep up.
+	EncodePacer encode_pacer;
+
+	// Per-stage latency of encoded frames.
+	FrameLatencyTracker frame_latency;
+	// Frame being encoded by the primary encoder. Unused with parallel encode, which marks latency per frame.
+	FrameTimestamps *current_encode_latency = nullptr;
+	uint64_t latency_frame_count = 0;
+	unsigned latency_report_interval = 0;
+	unsigned latency_report_count = 0;
+
+	// Stages show up as consecutive spans on a "Frame" track, with the frame ID as PID.
+	void trace_frame_latency(const FrameTimestamps &ts)
+	{
+		auto *trace_file = group.get_timeline_trace_file();
+		if (!trace_file)
+			return;
+
+		uint64_t last_ns = 0;
+		for (unsigned i = 0; i < unsigned(LatencyStage::Count); i++)
+		{
+			if (!ts.ns[i])
+				continue;
+
+			if (last_ns && ts.ns[i] >= last_ns)
+			{
+				auto *e = trace_file->allocate_event();
+				e->set_desc(FrameLatencyTracker::get_stage_name(LatencyStage(i)));
+				e->set_tid("Frame");
+				e->pid = uint32_t(ts.frame_id);
+				e->start_ns = last_ns;
+				e->end_ns = ts.ns[i];
+				trace_file->submit_event(e);
+			}
+
+			last_ns = std::max(last_ns, ts.ns[i]);
+		}
+	}
+
+	void log_frame_latency()
+	{
+		LOGI("Frame latency over last %u frames (p50 / p90 / p99 / max ms):\n",
+		     frame_latency.get_percentiles(LatencyStage::Present).num_samples);
+
+		for (unsigned i = 0; i < unsigned(LatencyStage::Count); i++)
+		{
+			auto stats = frame_latency.get_percentiles(LatencyStage(i));
+			if (!stats.num_samples)
+				continue;
+			LOGI("  %8s: %7.3f / %7.3f / %7.3f / %7.3f\n",
+			     FrameLatencyTracker::get_stage_name(LatencyStage(i)),
+			     1e-6 * double(stats.p50_ns), 1e-6 * double(stats.p90_ns),
+			     1e-6 * double(stats.p99_ns), 1e-6 * double(stats.max_ns));
+		}
+	}
+
+	// Without libavformat, the backup is the raw video bitstream of what pyro clients receive,
+	// written from a dedicated I/O thread. Otherwise, it is muxed by one of the outputs.
+	AsyncFileWriter local_backup;
+	bool local_backup_needs_key_frame = true;
+	bool local_backup_muxed = false;
+
+	void write_local_backup(const void *data, size_t size, bool is_key_frame)
+	{
+		// A dropped packet breaks decoding until the next key frame, so don't write anything until then.
+		if (local_backup_needs_key_frame && !is_key_frame)
+			return;
+
+		bool written = local_backup.write(data, size);
+		if (!written && !local_backup_needs_key_frame)
+			LOGW("Local backup cannot keep up, skipping to next key frame.\n");
+		local_backup_needs_key_frame = !written;
+	}
+
+	void log_local_backup_stats()
+	{
+		PacketFanout::SinkStats sink_stats;
+		if (local_backup_muxed && outputs.get_sink_stats(video_encode.local_backup_path, sink_stats))
+		{
+			LOGI("Local backup: %llu packets dropped, queue %.1f MB.\n",
+			     static_cast<unsigned long long>(sink_stats.dropped_packets),
+			     double(sink_stats.queued_bytes) / (1024.0 * 1024.0));
+			return;
+		}
+
+		auto stats = local_backup.get_stats();
+		LOGI("Local backup: %.1f MB written, %llu packets dropped, queue %.1f MB (peak %.1f MB), "
+		     "write %.3f ms avg / %.3f ms max%s.\n",
+		     double(stats.written_bytes) / (1024.0 * 1024.0),
+		     static_cast<unsigned long long>(stats.dropped_writes),
+		     double(stats.queued_bytes) / (1024.0 * 1024.0),
+		     double(stats.max_queued_bytes) / (1024.0 * 1024.0),
+		     stats.num_batches ? 1e-6 * double(stats.total_write_ns) / double(stats.num_batches) : 0.0,
+		     1e-6 * double(stats.max_write_ns),
+		     stats.failed ? ", write error" : "");
+	}
+
+	void log_encode_pacer_stats()
+	{
+		auto stats = encode_pacer.get_stats();
+		LOGI("Encode: %.3f ms per frame, %llu encoded, %llu dropped, %llu over budget%s.\n",
+		     stats.cost_ms,
+		     static_cast<unsigned long long>(stats.encoded_frames),
+		     static_cast<unsigned long long>(stats.dropped_frames),
+		     static_cast<unsigned long long>(stats.late_frames),
+		     stats.overloaded ? ", overloaded" : "");
+	}
+
+	void log_audio_drift_stats()
+	{
+		auto stats = audio_record->get_stats();
+		LOGI("Audio: drift %.1f ppm, resample ratio %.1f ppm, backlog %.1f ms (target %.1f ms), "
+		     "%llu frames underrun, %llu overrun, %llu discarded.\n",
+		     stats.drift_ppm, stats.ratio_ppm, stats.backlog_ms, stats.target_ms,
+		     static_cast<unsigned long long>(stats.underrun_frames),
+		     static_cast<unsigned long long>(stats.overrun_frames),
+		     static_cast<unsigned long long>(stats.discarded_frames));
+	}
+
+	// Benchmark frames scroll through a fixed pattern which is twice the height of the frame,
+	// so every frame has new content, and the encoded stream is reproducible.
+	Vulkan::ImageHandle benchmark_image;
+	Vulkan::BufferHandle benchmark_pattern;
+	uint64_t benchmark_tick = 0;
+	unsigned benchmark_frame_count = 0;
+
+	const Vulkan::Image &render_benchmark_frame(Vulkan::CommandBuffer &cmd)
+	{
+		unsigned width = video_encode.width;
+		unsigned height = video_encode.height;
+
+		if (!benchmark_image)
+		{
+			auto info = Vulkan::ImageCreateInfo::immutable_2d_image(width, height, VK_FORMAT_R8G8B8A8_UNORM);
+			info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+			info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			info.misc |= Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT;
+			benchmark_image = encoder_device->create_image(info);
+
+			// Smooth gradients with some low amplitude noise, so the encoder has realistic work to do.
+			std::vector<uint32_t> pattern(size_t(width) * height * 2);
+			uint32_t seed = 1;
+			for (unsigned y = 0; y < height * 2; y++)
+			{
+				for (unsigned x = 0; x < width; x++)
+				{
+					seed = seed * 1664525u + 1013904223u;
+					uint32_t noise = (seed >> 28) & 7;
+					uint32_t r = (x * 255 / width + noise) & 0xff;
+					uint32_t g = (y * 127 / height + noise) & 0xff;
+					uint32_t b = ((x ^ y) + noise) & 0xff;
+					pattern[size_t(y) * width + x] = r | (g << 8) | (b << 16) | 0xff000000u;
+				}
+			}
+
+			Vulkan::BufferCreateInfo buffer_info = {};
+			buffer_info.size = pattern.size() * sizeof(uint32_t);
+			buffer_info.domain = Vulkan::BufferDomain::Device;
+			buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+			benchmark_pattern = encoder_device->create_buffer(buffer_info, pattern.data());
+		}
+
+		unsigned scroll = (benchmark_frame_count++ * 8) % height;
+
+		cmd.image_barrier(*benchmark_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		                  VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+		cmd.copy_buffer_to_image(*benchmark_image, *benchmark_pattern,
+		                         VkDeviceSize(scroll) * width * sizeof(uint32_t),
+		                         {}, { width, height, 1 }, width, height,
+		                         { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 });
+		cmd.image_barrier(*benchmark_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+		                  VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+
+		return *benchmark_image;
+	}
+
+	// Drives the heartbeat on a virtual clock without a timer, so encoding runs as fast as it can.
+	bool run_benchmark(uint64_t period_ns)
+	{
+		unsigned num_ticks = video_encode.benchmark_frames * client_rate_multiplier;
+		auto start_ns = Util::get_current_time_nsecs();
+
+		for (unsigned i = 0; i < num_ticks; i++)
+			if (!heartbeat(period_ns))
+				return false;
+
+		group.wait_idle();
+		double elapsed = 1e-9 * double(Util::get_current_time_nsecs() - start_ns);
+
+		LOGI("Benchmark: encoded %u frames at %ux%u with %s in %.3f s, %.2f FPS.\n",
+		     benchmark_frame_count, video_encode.width, video_encode.height,
+		     video_encode.encoder.c_str(), elapsed, double(benchmark_frame_count) / elapsed);
+		log_frame_latency();
+		return true;
+	}
+
+	// Frames identical to the last encoded frame are encoded at a reduced rate.
+	// The idle background never changes, so keep it around.
+	// A few idle frames are encoded at full rate first so rate control can settle.
+	enum { IdleWarmupFrames = 8 };
+	Vulkan::ImageHandle idle_image;
+	unsigned static_frame_interval = 1;
+	uint64_t static_frame_count = 0;
+	unsigned last_encoded_surface_count = 0;
+
+	// A surface is unchanged if the same present is latched again, e.g. when a client
+	// renders slower than the heartbeat. Present IDs are monotonic, so this is exact.
+	bool is_static_frame(const ReadySurface *surfaces, unsigned count) const
+	{
+		if (count != last_encoded_surface_count)
+			return false;
+
+		for (unsigned i = 0; i < count; i++)
+		{
+			auto *chain = surfaces[i].chain;
+			if (!chain || chain->images[surfaces[i].index].present_id != chain->last_encoded_present_id)
+				return false;
+		}
+
+		return true;
+	}
+
 	unsigned client_rate_multiplier = 1;
 	unsigned client_heartbeat_count = 0;
 
 	void set_encode_options(const Options &opts)
 	{
 		video_encode = opts;
+		static_frame_interval = 1;
+		// In offline mode, PTS is derived from frame count, so skipped frames would distort time.
+		if (opts.idle_fps > 0 && unsigned(opts.idle_fps) < opts.fps && opts.walltime_to_pts)
+			static_frame_interval = opts.fps / unsigned(opts.idle_fps);
+		latency_report_interval = opts.latency_report_seconds * opts.fps;
+		pyro.set_phase_offset_policy(opts.phase_policy);
+
+		// The benchmark and offline mode must encode every frame.
+		// By default, a frame may wait for one frame interval behind the previous frame.
+		EncodePacer::Options pacer;
+		if (opts.walltime_to_pts && !opts.benchmark_frames)
+		{
+			pacer.budget_ns = opts.encode_budget_ms ?
+			                  uint64_t(opts.encode_budget_ms) * 1000000 :
+			                  2000000000ull / std::max(opts.fps, 1u);
+		}
+		pacer.window_frames = std::max(opts.fps, 1u);
+		encode_pacer.set_options(pacer);
+		latency_report_count = 0;
 	}
 
 	void set_client_rate_multiplier(unsigned rate)
@@ -1552,7 +2794,6 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 			options.height = video_encode.height;
 			options.frame_timebase.num = 1;
 			options.frame_timebase.den = int(video_encode.fps);
-			options.encoder = video_encode.encoder.c_str();
 			options.walltime_to_pts = video_encode.walltime_to_pts;
 
 			// For now, just assume the inputs are properly PQ encoded.
@@ -1572,58 +2813,61 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 			options.x264_preset = video_encode.x264_preset.empty() ? nullptr : video_encode.x264_preset.c_str();
 			options.x264_tune = video_encode.x264_tune.empty() ? nullptr : video_encode.x264_tune.c_str();
 			options.threads = video_encode.threads;
-			options.local_backup_path = video_encode.local_backup_path.empty() ? nullptr : video_encode.local_backup_path.c_str();
 
-			// Software codecs in FFmpeg all use yuv420p.
-			options.format = video_encode.chroma_444 ?
-			                 Granite::VideoEncoder::Format::YUV444P :
-							 Granite::VideoEncoder::Format::YUV420P;
+			// When packets pass through us, the backup is written off the encode thread, see init_local_backup().
+			// Otherwise, i.e. without libavformat or for codecs only the encoder can mux,
+			// the encoder has to mux the backup itself.
+			if (!video_encode.path.empty() && !video_encode.local_backup_path.empty())
+				options.local_backup_path = video_encode.local_backup_path.c_str();
 
-			if (video_encode.bit_depth > 8 && options.encoder)
+			if (video_encode.audio)
 			{
-				if (strstr(options.encoder, "nvenc") != nullptr)
-					options.format = Granite::VideoEncoder::Format::P016;
-				else if (strstr(options.encoder, "vaapi") != nullptr)
-					options.format = Granite::VideoEncoder::Format::P010;
-				else if (strstr(options.encoder, "pyro") != nullptr)
-					options.format = Granite::VideoEncoder::Format::P016;
+				auto *device_stream = Granite::Audio::create_default_audio_record_backend(
+						"Stream", float(video_encode.audio_rate), video_encode.audio_channels);
+				if (device_stream)
+				{
+					audio_record.reset(new DriftCompensatedRecordStream(
+							device_stream, float(video_encode.audio_rate), video_encode.audio_channels,
+							video_encode.audio_drift));
+				}
 			}
 
-			if (options.hdr10 && (strcmp(options.encoder, "pyrowave") == 0 || strcmp(options.encoder, "rawvideo") == 0))
-			{
-				options.format = video_encode.chroma_444 ?
-				                 Granite::VideoEncoder::Format::YUV444P16 :
-				                 Granite::VideoEncoder::Format::YUV420P16;
-			}
-			else if (options.format == Granite::VideoEncoder::Format::YUV420P &&
-			         (strstr(options.encoder, "nvenc") != nullptr ||
-			          strstr(options.encoder, "vaapi") != nullptr ||
-			          strstr(options.encoder, "_pyro") != nullptr))
+			pyro.set_forward_error_correction(video_encode.fec);
+			pyro.set_idr_on_packet_loss(video_encode.gop_seconds < 0.0f);
+
+			// Codec parameters are delivered during encoder init, so outputs must exist before that.
+			if (video_encode.path.empty() && !init_outputs())
 			{
-				// GPU encoders only understand NV12.
-				options.format = Granite::VideoEncoder::Format::NV12;
+				encoder.reset();
+				audio_record.reset();
+				return false;
 			}
 
-			if (video_encode.audio)
-				audio_record.reset(Granite::Audio::create_default_audio_record_backend("Stream", float(video_encode.audio_rate), 2));
+			if (video_encode.parallel_encoders > 1)
+				encode_reorder.reset(new EncodeReorder(*this, packet_pool, video_encode.parallel_encoders));
 
-			pyro.set_forward_error_correction(video_encode.fec);
-			pyro.set_idr_on_packet_loss(video_encode.gop_seconds < 0.0f);
-			encoder->set_audio_record_stream(audio_record.get());
-			if (video_encode.path.empty())
-				encoder->set_mux_stream_callback(this);
 			encoder_device = &gpu.context->device;
-			if (encoder->init(encoder_device, video_encode.path.empty() ? nullptr : video_encode.path.c_str(), options))
+			if (init_primary_encoder(gpu, options) && init_parallel_encoders(options))
 			{
 				Vulkan::ResourceLayout layout;
 				FFmpegEncode::Shaders<> bank{gpu.context->device, layout, 0};
 
-				for (auto &pipe : pipeline)
-					pipe = encoder->create_ycbcr_pipeline(bank);
+				for (unsigned i = 0; i < NumEncodeTasks; i++)
+					pipeline[i] = get_slot_encoder(i).create_ycbcr_pipeline(bank);
+
+				if (!init_renditions(options, bank))
+				{
+					parallel_encoders.clear();
+					encoder.reset();
+					encoder_device = nullptr;
+					audio_record.reset();
+					return false;
+				}
 
 				if (audio_record && !audio_record->start())
 				{
 					LOGE("Failed to initialize audio recorder.\n");
+					parallel_encoders.clear();
 					encoder.reset();
 					encoder_device = nullptr;
 					audio_record.reset();
@@ -1632,6 +2876,7 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 			}
 			else
 			{
+				parallel_encoders.clear();
 				encoder.reset();
 				encoder_device = nullptr;
 				audio_record.reset();
@@ -1643,6 +2888,172 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 		return true;
 	}
 
+	// The first candidate encoder which initializes is used. With more than one candidate, results are cached
+	// per GPU and driver version. Candidates which failed recently are only tried once everything else failed,
+	// so startup normally goes straight to one which works.
+	bool init_primary_encoder(const PhysicalDevice &gpu, Granite::VideoEncoder::Options &options)
+	{
+		auto candidates = get_encoder_candidates(video_encode.encoder, video_encode.bit_depth);
+		const char *path = video_encode.path.empty() ? nullptr : video_encode.path.c_str();
+
+		std::vector<Granite::VideoEncoder::Format> formats;
+		std::vector<std::string> keys;
+		for (auto &candidate : candidates)
+		{
+			formats.push_back(select_encode_format(candidate.c_str(), video_encode.bit_depth,
+			                                       video_encode.chroma_444, options.hdr10));
+			keys.push_back(EncoderProbeCache::make_key(candidate.c_str(), unsigned(formats.back()),
+			                                           options.width, options.height));
+		}
+
+		// A single explicit encoder is always attempted, so there is nothing to gain from the cache.
+		bool use_cache = candidates.size() > 1;
+		EncoderProbeCache cache;
+		auto now = int64_t(time(nullptr));
+		std::vector<unsigned> order;
+
+		if (use_cache)
+		{
+			cache.load(video_encode.encoder_cache_dir, gpu.device_uuid, gpu.driver_version);
+			order = cache.get_probe_order(keys, now);
+		}
+		else
+		{
+			for (unsigned i = 0; i < candidates.size(); i++)
+				order.push_back(i);
+		}
+
+		for (unsigned index : order)
+		{
+			options.encoder = candidates[index].c_str();
+			options.format = formats[index];
+
+			if (use_cache && cache.get(keys[index], now) == EncoderProbeCache::Result::Unsupported)
+				LOGI("Retrying encoder %s, which failed with this GPU and driver before.\n", options.encoder);
+
+			encoder = std::make_unique<Granite::VideoEncoder>();
+			encoder->set_audio_record_stream(audio_record.get());
+			if (encode_reorder)
+				encoder->set_mux_stream_callback(&encode_reorder->get_callback(0));
+			else if (!path)
+				encoder->set_mux_stream_callback(this);
+
+			auto start_time = Util::get_current_time_nsecs();
+			bool success = encoder->init(encoder_device, path, options);
+
+			if (use_cache)
+			{
+				cache.set(keys[index], success ? EncoderProbeCache::Result::Supported :
+				                                 EncoderProbeCache::Result::Unsupported, now);
+				cache.save();
+			}
+
+			if (success)
+			{
+				// Renditions and logs refer to the encoder by name, and options must not point into candidates.
+				video_encode.encoder = candidates[index];
+				options.encoder = video_encode.encoder.c_str();
+				if (use_cache)
+					LOGI("Using encoder %s.\n", options.encoder);
+				return true;
+			}
+
+			if (use_cache)
+			{
+				LOGW("Encoder %s failed to initialize in %.3f s, trying the next one.\n", options.encoder,
+				     1e-9 * double(Util::get_current_time_nsecs() - start_time));
+			}
+			encoder.reset();
+		}
+
+		options.encoder = nullptr;
+		return false;
+	}
+
+	// Same configuration as the primary encoder, but without audio, which only goes through the primary.
+	bool init_parallel_encoders(const Granite::VideoEncoder::Options &primary_options)
+	{
+		parallel_encoders.clear();
+		if (!encode_reorder)
+			return true;
+
+		if (!is_intra_only_encoder(video_encode.encoder))
+		{
+			LOGE("Encoder %s is not intra-only, cannot encode in parallel.\n", video_encode.encoder.c_str());
+			return false;
+		}
+
+		auto options = primary_options;
+		options.local_backup_path = nullptr;
+
+		for (unsigned i = 1; i < encode_reorder->get_num_encoders(); i++)
+		{
+			ParallelEncoder parallel;
+			parallel.encoder = std::make_unique<Granite::VideoEncoder>();
+			parallel.encoder->set_mux_stream_callback(&encode_reorder->get_callback(i));
+			if (!parallel.encoder->init(encoder_device, nullptr, options))
+			{
+				LOGE("Failed to initialize parallel encoder %u.\n", i);
+				parallel_encoders.clear();
+				return false;
+			}
+			parallel_encoders.push_back(std::move(parallel));
+		}
+
+		LOGI("Encoding with %u parallel %s encoders.\n", encode_reorder->get_num_encoders(), options.encoder);
+		return true;
+	}
+
+	bool init_renditions(const Granite::VideoEncoder::Options &primary_options, FFmpegEncode::Shaders<> &bank)
+	{
+		renditions.clear();
+		pyro.set_num_renditions(unsigned(video_encode.simulcast_kbits.size()) + 1);
+
+		for (unsigned kbits : video_encode.simulcast_kbits)
+		{
+			std::unique_ptr<Rendition> rendition{new Rendition(pyro, unsigned(renditions.size()) + 1)};
+			rendition->bitrate_kbits = kbits;
+
+			// Keep the rate control headroom of the primary encode.
+			auto options = primary_options;
+			options.bitrate_kbits = kbits;
+			options.max_bitrate_kbits = unsigned(uint64_t(primary_options.max_bitrate_kbits) * kbits /
+			                                     primary_options.bitrate_kbits);
+			options.vbv_size_kbits = unsigned(uint64_t(primary_options.vbv_size_kbits) * kbits /
+			                                  primary_options.bitrate_kbits);
+			options.local_backup_path = nullptr;
+
+			rendition->encoder = std::make_unique<Granite::VideoEncoder>();
+			rendition->encoder->set_mux_stream_callback(rendition.get());
+			if (!rendition->encoder->init(encoder_device, nullptr, options))
+			{
+				LOGE("Failed to initialize encoder for %u kbits/s rendition.\n", kbits);
+				renditions.clear();
+				return false;
+			}
+
+			for (auto &pipe : rendition->pipeline)
+				pipe = rendition->encoder->create_ycbcr_pipeline(bank);
+
+			// Start out at the scale the bitrate calls for, instead of stepping down from full resolution.
+			if (video_encode.adaptive_resolution)
+			{
+				unsigned level;
+				while ((level = step_content_scale_level(kbits, rendition->content_scale_level)) >
+				       rendition->content_scale_level)
+				{
+					rendition->content_scale_level = level;
+				}
+			}
+
+			LOGI("Rendition %u: %u kbits/s, content scale %u / 8.\n", rendition->index, kbits,
+			     ContentScaleEighths[rendition->content_scale_level]);
+			renditions.push_back(std::move(rendition));
+		}
+
+		return true;
+	}
+
 	void unregister_handler(Swapchain *handler)
 	{
 		auto itr = std::find_if(handlers.begin(), handlers.end(), [handler](const Util::IntrusivePtr<Swapchain> &ptr_handler) {
@@ -1652,27 +3063,108 @@ struct SwapchainServer final : HandlerFactoryInterface, Vulkan::InstanceFactory,
 		handlers.erase(itr);
 	}
 
+	bool init_outputs()
+	{
+		for (auto &url : video_encode.outputs)
+		{
+#ifdef HAVE_MUX_OUTPUT
+			const char *format = nullptr;
+			if (!video_encode.muxer.empty())
+				format = video_encode.muxer.c_str();
+			else if (url.find("://") != std::string::npos)
+				format = "flv";
+
+			std::unique_ptr<MuxOutput> output{new MuxOutput};
+			if (!output->init(url.c_str(), format, video_encode.walltime_to_pts))
+				return false;
+			outputs.add_sink(std::move(output), url);
+#else
+			LOGE("Cannot output to \"%s\", built without libavformat.\n", url.c_str());
+			return false;
+#endif
+		}
+
+		if (!video_encode.local_backup_path.empty() && !init_local_backup())
+			return false;
+
+		return true;
+	}
+
+	bool init_local_backup()
+	{
+		auto &path = video_encode.local_backup_path;
+#ifdef HAVE_MUX_OUTPUT
+		// Muxed on its own thread like any other output, so audio and timestamps are kept.
+		// The container is guessed from the file extension.
+		auto candidates = get_encoder_candidates(video_encode.encoder, video_encode.bit_depth);
+		if (std::none_of(candidates.begin(), candidates.end(), is_intra_only_encoder))
+		{
+			std::unique_ptr<MuxOutput> output{new MuxOutput};
+			if (!output->init(path.c_str(), nullptr, video_encode.walltime_to_pts))
+				return false;
+
+			if (video_encode.local_backup.direct_io)
+				LOGW("--local-backup-direct only applies to raw backups, ignoring.\n");
+
+			outputs.add_sink(std::move(output), path, video_encode.local_backup.ring_size,
+			                 video_encode.local_backup.policy == AsyncFileWriter::OverflowPolicy::Block);
+			local_backup_muxed = true;
+			return true;
+		}
+
+		LOGW("Encoder %s cannot be muxed, local backup \"%s\" only contains the raw video bitstream, "
+		     "without audio or timestamps.\n", video_encode.encoder.c_str(), path.c_str());
+#else
+		LOGW("Built without libavformat, local backup \"%s\" only contains the raw video bitstream, "
+		     "without audio or timestamps.\n", path.c_str());
+#endif
+		if (!local_backup.open(path.c_str(), video_encode.local_backup))
+			return false;
+		local_backup_needs_key_frame = true;
+		return true;
+	}
+
 	void set_codec_parameters(const pyro_codec_parameters &codec) override
 	{
 		pyro.set_codec_parameters(codec);
+		outputs.set_codec_parameters(codec);
 	}
 
 	void write_video_packet(int64_t pts, int64_t dts, const void *data, size_t size, bool is_key_frame) override
 	{
+		if (current_encode_latency && !current_encode_latency->get(LatencyStage::Encoded))
+			current_encode_latency->mark(LatencyStage::Encoded, uint64_t(Util::get_current_time_nsecs()));
+
 		pyro.write_video_packet(pts, dts, data, size, is_key_frame);
+
+		if (local_backup.is_open())
+			write_local_backup(data, size, is_key_frame);
+
+		outputs.write_video_packet(pts, dts, data, size, is_key_frame);
+
+		if (current_encode_latency)
+			current_encode_latency->mark(LatencyStage::Sent, uint64_t(Util::get_current_time_nsecs()));
 	}
 
 	void write_audio_packet(int64_t pts, int64_t dts, const void *data, size_t size) override
 	{
-		pyro.write_audio_packet(pts, dts, data, size);
+		// Both pyro clients and outputs retain audio, so share one copy.
+		auto packet = packet_pool->copy(data, size);
+		pyro.write_audio_packet(pts, dts, packet);
+		outputs.write_audio_packet(pts, dts, packet);
 	}
 
 	bool should_force_idr() override
 	{
-		return pyro.should_force_idr();
+		// Evaluate both, since each clears its request.
+		bool pyro_idr = pyro.should_force_idr();
+		bool output_idr = outputs.should_force_idr();
+		return pyro_idr || output_idr;
 	}
 };
 
+constexpr unsigned SwapchainServer::ContentScaleEighths[];
+
 #ifdef HAVE_PIPEWIRE
 void PipewireStream::send_encoding(const Vulkan::Image &img)
 {
@@ -1683,12 +3175,11 @@ void PipewireStream::send_encoding(const Vulkan::Image &img)
 
 struct HeartbeatHandler final : Handler
 {
-	HeartbeatHandler(Dispatcher &dispatcher_, SwapchainServer &server_, unsigned fps)
-			: Handler(dispatcher_), server(server_), timebase_ns(1000000000u / fps)
+	HeartbeatHandler(Dispatcher &dispatcher_, SwapchainServer &server_, unsigned fps,
+	                 const PhaseController::Options &phase_options)
+			: Handler(dispatcher_), server(server_), timebase_ns(1000000000u / fps),
+			  phase_controller(timebase_ns, phase_options)
 	{
-		// Nudge the timebase by up to 1% in 0.01% increments.
-		timebase_ns_fraction = timebase_ns / 10000;
-		target_interval_ns = timebase_ns;
 	}
 
 	bool handle(const FileHandle &fd, uint32_t) override
@@ -1697,7 +3188,9 @@ struct HeartbeatHandler final : Handler
 		if (::read(fd.get_native_handle(), &timeouts, sizeof(timeouts)) <= 0)
 			return false;
 
-		update_loop(fd, server.pyro.get_phase_offset_us());
+		int phase_offset_us = 0;
+		bool has_phase_offset = server.pyro.get_phase_offset_us(phase_offset_us);
+		update_loop(fd, has_phase_offset, phase_offset_us);
 
 		for (uint64_t i = 1; i < timeouts; i++)
 		{
@@ -1722,8 +3215,24 @@ struct HeartbeatHandler final : Handler
 		delete this;
 	}
 
-	void update_loop(const FileHandle &fd, int phase_offset_us)
+	void update_loop(const FileHandle &fd, bool has_phase_offset, int phase_offset_us)
 	{
+		auto output = phase_controller.update(has_phase_offset, phase_offset_us);
+
+		if (phase_controller.is_locked() != phase_locked)
+		{
+			phase_locked = phase_controller.is_locked();
+			if (phase_locked)
+				LOGI("Heartbeat phase locked after %llu ticks.\n",
+				     static_cast<unsigned long long>(phase_controller.get_lock_in_ticks()));
+			else
+				LOGW("Heartbeat phase lock lost, jitter was %.0f us.\n", phase_controller.get_jitter_us());
+		}
+
+		// Avoid reprogramming the timer for sub-microsecond period changes.
+		if (output.phase_step_ns == 0 && std::abs(output.period_adjust_ns - period_adjust_ns) < 1000)
+			return;
+
 		timespec tv = {};
 		itimerspec itimer = {};
 		clock_gettime(CLOCK_MONOTONIC, &tv);
@@ -1735,62 +3244,23 @@ struct HeartbeatHandler final : Handler
 				(tv.tv_sec + itimer.it_value.tv_sec) * 1000000000ull +
 				tv.tv_nsec + itimer.it_value.tv_nsec;
 
-		// Add larger immediate offsets, but accelerate slowly.
-		constexpr int respond_factor = 60;
-		bool sets_time = false;
+		target_time_ns += output.phase_step_ns;
+		period_adjust_ns = output.period_adjust_ns;
+		uint64_t target_interval_ns = timebase_ns + period_adjust_ns;
 
-		if (abs(phase_offset_us) > 200)
-		{
-			if (phase_offset_us > 0 && tick_interval_offset < 50)
-			{
-				// Client want frame delivered later, increase interval.
-				// Offset the interval more sharply so we can respond in time.
-				tick_interval_offset += 2;
-				target_time_ns += respond_factor * timebase_ns_fraction;
-				target_interval_ns += 2 * timebase_ns_fraction;
-				sets_time = true;
-			}
-			else if (phase_offset_us < 0 && tick_interval_offset > -50)
-			{
-				// Client want frame delivered sooner, reduce interval.
-				// Offset the interval more sharply so we can respond in time.
-				tick_interval_offset -= 2;
-				target_time_ns -= respond_factor * timebase_ns_fraction;
-				target_interval_ns -= 2 * timebase_ns_fraction;
-				sets_time = true;
-			}
-		}
+		itimer.it_value.tv_nsec = long(target_time_ns % 1000000000);
+		itimer.it_value.tv_sec = time_t(target_time_ns / 1000000000);
+		itimer.it_interval.tv_nsec = long(target_interval_ns % 1000000000);
+		itimer.it_interval.tv_sec = time_t(target_interval_ns / 1000000000);
 
-		// When we get no messages, move towards center.
-		if (tick_interval_offset > 0)
-		{
-			tick_interval_offset--;
-			target_interval_ns -= timebase_ns_fraction;
-			sets_time = true;
-		}
-		else if (tick_interval_offset < 0)
-		{
-			tick_interval_offset++;
-			target_interval_ns += timebase_ns_fraction;
-			sets_time = true;
-		}
-
-		if (sets_time)
-		{
-			itimer.it_value.tv_nsec = long(target_time_ns % 1000000000);
-			itimer.it_value.tv_sec = time_t(target_time_ns / 1000000000);
-			itimer.it_interval.tv_nsec = long(target_interval_ns % 1000000000);
-			itimer.it_interval.tv_sec = time_t(target_interval_ns / 1000000000);
-
-			timerfd_settime(fd.get_native_handle(), TFD_TIMER_ABSTIME, &itimer, nullptr);
-		}
+		timerfd_settime(fd.get_native_handle(), TFD_TIMER_ABSTIME, &itimer, nullptr);
 	}
 
 	SwapchainServer &server;
 	uint64_t timebase_ns;
-	uint64_t timebase_ns_fraction = 0;
-	uint64_t target_interval_ns = 0;
-	int tick_interval_offset = 0;
+	PhaseController phase_controller;
+	int64_t period_adjust_ns = 0;
+	bool phase_locked = false;
 };
 
 static void print_help()
@@ -1810,14 +3280,34 @@ static void print_help()
 	     "\t[--max-bitrate-kbits SIZE]\n"
 	     "\t[--vbv-size-kbits SIZE]\n"
 	     "\t[--local-backup PATH]\n"
-	     "\t[--encoder ENCODER]\n"
+	     "\t[--local-backup-policy drop/block (when the disk cannot keep up while serving pyro clients)]\n"
+	     "\t[--local-backup-buffer-mb SIZE]\n"
+	     "\t[--local-backup-direct (bypass the page cache, raw backups only)]\n"
+	     "\t[--encoder ENCODER (comma separated list to try in order, or auto)]\n"
+	     "\t[--encoder-cache DIR (where encoder probe results are cached, empty to disable)]\n"
 	     "\t[--muxer MUXER]\n"
+	     "\t[--output URL (additional output, may be repeated)]\n"
 	     "\t[--port PORT]\n"
 	     "\t[--audio-rate RATE]\n"
+	     "\t[--audio-channels CHANNELS]\n"
+	     "\t[--audio-latency-ms MILLISECONDS (buffering between capture and encode)]\n"
 	     "\t[--low-latency]\n"
 	     "\t[--no-audio]\n"
 	     "\t[--immediate-encode]\n"
+	     "\t[--compose side-by-side/grid/pip (encode all clients in one frame)]\n"
+	     "\t[--idle-fps FPS (rate to encode when nothing changes on screen, 0 for full rate)]\n"
+	     "\t[--latency-report SECONDS (log per-stage frame latency percentiles)]\n"
+	     "\t[--adaptive-resolution (downscale content when bitrate is low)]\n"
+	     "\t[--simulcast-kbits SIZE (extra lower bitrate rendition for pyro clients, may be repeated)]\n"
+	     "\t[--encode-budget-ms MILLISECONDS (drop frames which would take longer to encode)]\n"
+	     "\t[--parallel-encode COUNT (encode frames concurrently over COUNT encoders, pyrowave and rawvideo to pyro clients only)]\n"
+	     "\t[--benchmark FRAMES (encode synthetic frames as fast as possible and report throughput)]\n"
+	     "\t[--phase-policy sum/median/primary (how phase requests from multiple clients are combined)]\n"
+	     "\t[--phase-kp GAIN]\n"
+	     "\t[--phase-ki GAIN]\n"
+	     "\t[--phase-deadband-us MICROSECONDS]\n"
 	     "\t[--debug-gamepad-to-mouse]\n"
+	     "\t[--trace PATH (record all traffic sent to pyro clients)]\n"
 #ifdef HAVE_PIPEWIRE
 		 "\t[--pipewire]\n"
 #endif
@@ -1832,6 +3322,7 @@ static int main_inner(int argc, char **argv)
 	SwapchainServer::Options opts;
 	unsigned device_index = 0;
 	std::string port;
+	std::string trace_path;
 
 	opts.width = 1280;
 	opts.height = 720;
@@ -1853,10 +3344,27 @@ static int main_inner(int argc, char **argv)
 	cbs.add("--max-bitrate-kbits", [&](Util::CLIParser &parser) { opts.max_bitrate_kbits = parser.next_uint(); });
 	cbs.add("--threads", [&](Util::CLIParser &parser) { opts.threads = parser.next_uint(); });
 	cbs.add("--local-backup", [&](Util::CLIParser &parser) { opts.local_backup_path = parser.next_string(); });
+	cbs.add("--local-backup-policy", [&](Util::CLIParser &parser) {
+		std::string policy = parser.next_string();
+		if (policy == "drop")
+			opts.local_backup.policy = AsyncFileWriter::OverflowPolicy::Drop;
+		else if (policy == "block")
+			opts.local_backup.policy = AsyncFileWriter::OverflowPolicy::Block;
+		else
+			throw std::invalid_argument("Unknown local backup policy.");
+	});
+	cbs.add("--local-backup-buffer-mb", [&](Util::CLIParser &parser) {
+		opts.local_backup.ring_size = size_t(parser.next_uint()) * 1024 * 1024;
+	});
+	cbs.add("--local-backup-direct", [&](Util::CLIParser &) { opts.local_backup.direct_io = true; });
 	cbs.add("--encoder", [&](Util::CLIParser &parser) { opts.encoder = parser.next_string(); });
+	cbs.add("--encoder-cache", [&](Util::CLIParser &parser) { opts.encoder_cache_dir = parser.next_string(); });
 	cbs.add("--muxer", [&](Util::CLIParser &parser) { opts.muxer = parser.next_string(); });
+	cbs.add("--output", [&](Util::CLIParser &parser) { opts.outputs.emplace_back(parser.next_string()); });
 	cbs.add("--port", [&](Util::CLIParser &parser) { port = parser.next_string(); });
 	cbs.add("--audio-rate", [&](Util::CLIParser &parser) { opts.audio_rate = parser.next_uint(); });
+	cbs.add("--audio-channels", [&](Util::CLIParser &parser) { opts.audio_channels = parser.next_uint(); });
+	cbs.add("--audio-latency-ms", [&](Util::CLIParser &parser) { opts.audio_drift.target_latency_ms = parser.next_uint(); });
 	cbs.add("--low-latency", [&](Util::CLIParser &) { opts.low_latency = true; });
 	cbs.add("--no-audio", [&](Util::CLIParser &) { opts.audio = false; });
 	cbs.add("--immediate-encode", [&](Util::CLIParser &) { opts.immediate = true; });
@@ -1866,6 +3374,39 @@ static int main_inner(int argc, char **argv)
 	cbs.add("--fec", [&](Util::CLIParser &) { opts.fec = true; });
 	cbs.add("--offline", [&](Util::CLIParser &) { opts.walltime_to_pts = false; });
 	cbs.add("--debug-gamepad-to-mouse", [&](Util::CLIParser &) { debug_gamepad_to_mouse = true; });
+	cbs.add("--trace", [&](Util::CLIParser &parser) { trace_path = parser.next_string(); });
+	cbs.add("--idle-fps", [&](Util::CLIParser &parser) { opts.idle_fps = int(parser.next_uint()); });
+	cbs.add("--latency-report", [&](Util::CLIParser &parser) { opts.latency_report_seconds = parser.next_uint(); });
+	cbs.add("--adaptive-resolution", [&](Util::CLIParser &) { opts.adaptive_resolution = true; });
+	cbs.add("--simulcast-kbits", [&](Util::CLIParser &parser) { opts.simulcast_kbits.push_back(parser.next_uint()); });
+	cbs.add("--benchmark", [&](Util::CLIParser &parser) { opts.benchmark_frames = parser.next_uint(); });
+	cbs.add("--encode-budget-ms", [&](Util::CLIParser &parser) { opts.encode_budget_ms = parser.next_uint(); });
+	cbs.add("--parallel-encode", [&](Util::CLIParser &parser) { opts.parallel_encoders = parser.next_uint(); });
+	cbs.add("--compose", [&](Util::CLIParser &parser) {
+		std::string layout = parser.next_string();
+		if (layout == "side-by-side")
+			opts.compose = ComposeLayout::SideBySide;
+		else if (layout == "grid")
+			opts.compose = ComposeLayout::Grid;
+		else if (layout == "pip")
+			opts.compose = ComposeLayout::PictureInPicture;
+		else
+			throw std::invalid_argument("Unknown compose layout.");
+	});
+	cbs.add("--phase-policy", [&](Util::CLIParser &parser) {
+		std::string policy = parser.next_string();
+		if (policy == "sum")
+			opts.phase_policy = PhaseOffsetPolicy::Sum;
+		else if (policy == "median")
+			opts.phase_policy = PhaseOffsetPolicy::Median;
+		else if (policy == "primary")
+			opts.phase_policy = PhaseOffsetPolicy::Primary;
+		else
+			throw std::invalid_argument("Unknown phase policy.");
+	});
+	cbs.add("--phase-kp", [&](Util::CLIParser &parser) { opts.phase_controller.kp = parser.next_double(); });
+	cbs.add("--phase-ki", [&](Util::CLIParser &parser) { opts.phase_controller.ki = parser.next_double(); });
+	cbs.add("--phase-deadband-us", [&](Util::CLIParser &parser) { opts.phase_controller.deadband_us = parser.next_uint(); });
 #ifdef HAVE_PIPEWIRE
 	cbs.add("--pipewire", [&](Util::CLIParser &) { opts.pipewire = true; });
 #endif
@@ -1881,23 +3422,133 @@ static int main_inner(int argc, char **argv)
 		return EXIT_SUCCESS;
 	}
 
-	if (opts.path.empty() && port.empty())
+	if (opts.benchmark_frames)
+	{
+		if (!port.empty())
+		{
+			LOGE("Cannot serve clients in benchmark mode.\n");
+			return EXIT_FAILURE;
+		}
+
+		// Without a URL, encoded packets are discarded.
+		// Timing must not depend on wall time, and audio capture is not deterministic.
+		opts.walltime_to_pts = false;
+		opts.audio = false;
+	}
+	else if (opts.path.empty() && port.empty() && opts.outputs.empty())
 	{
 		LOGE("Encode URL required.\n");
 		print_help();
 		return EXIT_FAILURE;
 	}
 
-	if (!opts.path.empty() && !port.empty())
+	// With more than one destination, a single encode is fanned out to all of them.
+	bool fan_out = !port.empty() || !opts.outputs.empty();
+
+#ifdef HAVE_MUX_OUTPUT
+	// A local backup counts as a destination, so a slow disk cannot stall the stream on the encode thread.
+	// Unless the encoder can only be muxed by itself.
+	if (!opts.local_backup_path.empty())
 	{
-		LOGE("Cannot use both TCP output and URL output.\n");
-		print_help();
+		auto candidates = get_encoder_candidates(opts.encoder, opts.bit_depth);
+		if (std::none_of(candidates.begin(), candidates.end(), is_intra_only_encoder))
+			fan_out = true;
+	}
+#endif
+
+	if (!opts.path.empty() && fan_out)
+	{
+		opts.outputs.insert(opts.outputs.begin(), opts.path);
+		opts.path.clear();
+	}
+
+	if (!opts.simulcast_kbits.empty())
+	{
+		if (port.empty())
+		{
+			LOGE("Simulcast requires serving pyro clients with --port.\n");
+			return EXIT_FAILURE;
+		}
+
+		if (opts.simulcast_kbits.size() >= PyroStreamServer::MaxRenditions)
+		{
+			LOGE("At most %u simulcast renditions are supported.\n", unsigned(PyroStreamServer::MaxRenditions) - 1);
+			return EXIT_FAILURE;
+		}
+
+		// Clients step down from the primary encode, so renditions must be ordered by decreasing quality.
+		std::sort(opts.simulcast_kbits.begin(), opts.simulcast_kbits.end(), std::greater<unsigned>());
+		if (opts.simulcast_kbits.front() >= opts.bitrate_kbits || opts.simulcast_kbits.back() == 0)
+		{
+			LOGE("Simulcast bitrates must be lower than --bitrate-kbits.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (opts.parallel_encoders != 1)
+	{
+		// Frames are spread over independent encoders, so no frame can reference another.
+		// Lists and auto could resolve to an inter-frame codec, so the encoder must be explicit.
+		if (!is_intra_only_encoder(opts.encoder))
+		{
+			LOGE("Parallel encode requires a single intra-only --encoder, pyrowave or rawvideo.\n");
+			return EXIT_FAILURE;
+		}
+
+		// Outputs only mux H.264, H.265 and AV1, and parallel encoders cannot mux on their own.
+		if (!opts.path.empty() || !opts.outputs.empty())
+		{
+			LOGE("Parallel encode only serves pyro clients, it cannot be combined with a URL or --output.\n");
+			return EXIT_FAILURE;
+		}
+
+		// Without wall time, every encoder derives PTS from its own frame count, which repeats across encoders.
+		if (!opts.walltime_to_pts)
+		{
+			LOGE("Parallel encode requires wall time PTS, it cannot be combined with --offline or --benchmark.\n");
+			return EXIT_FAILURE;
+		}
+
+		// Every encoder owns a fixed subset of the pipeline slots.
+		if (opts.parallel_encoders == 0 || SwapchainServer::NumEncodeTasks % opts.parallel_encoders != 0)
+		{
+			LOGE("Parallel encoder count must divide %u.\n", unsigned(SwapchainServer::NumEncodeTasks));
+			return EXIT_FAILURE;
+		}
+
+		// Renditions are still encoded one frame at a time, so they would hold back the parallel encode.
+		if (!opts.simulcast_kbits.empty())
+		{
+			LOGE("Parallel encode cannot be combined with simulcast.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (opts.audio && (opts.audio_channels == 0 || opts.audio_channels > 8))
+	{
+		LOGE("Audio must have between 1 and 8 channels.\n");
 		return EXIT_FAILURE;
 	}
 
+	// Backlog beyond 4x the target is treated as a stall, which must fit in the capture ring.
+	if (opts.audio && (opts.audio_drift.target_latency_ms == 0 ||
+	                   opts.audio_drift.target_latency_ms * 4 >= opts.audio_drift.ring_size_ms))
+	{
+		LOGE("Audio latency must be between 1 and %u ms.\n", (opts.audio_drift.ring_size_ms - 1) / 4);
+		return EXIT_FAILURE;
+	}
+
+	// Pyro clients deal with variable frame rate just fine, but some muxers and services expect constant frame rate.
+	if (opts.idle_fps < 0)
+		opts.idle_fps = port.empty() || !opts.outputs.empty() ? 0 : 4;
+
 	LOGI("Encoding: %u x %u @ %u fps (client %u fps) to \"%s\" || rate = %u kb/s || maxrate = %u kb/s || vbvsize = %u kb/s || gop = %f seconds\n",
 	     opts.width, opts.height, opts.fps, opts.fps * client_rate_multiplier, opts.path.c_str(),
 	     opts.bitrate_kbits, opts.max_bitrate_kbits, opts.vbv_size_kbits, opts.gop_seconds);
+	for (auto &output : opts.outputs)
+		LOGI("  Also muxing to \"%s\".\n", output.c_str());
+	for (auto kbits : opts.simulcast_kbits)
+		LOGI("  Simulcast rendition at %u kb/s.\n", kbits);
 
 	Dispatcher dispatcher{socket_path.c_str(), port.c_str()};
 	SwapchainServer server{dispatcher, debug_gamepad_to_mouse};
@@ -1905,8 +3556,13 @@ static int main_inner(int argc, char **argv)
 	server.set_encode_options(opts);
 	if (!server.init_encoder_for_device(device_index))
 		return EXIT_FAILURE;
+	if (!trace_path.empty() && !server.pyro.open_trace(trace_path.c_str()))
+		return EXIT_FAILURE;
 	dispatcher.set_handler_factory_interface(&server);
 
+	if (opts.benchmark_frames)
+		return server.run_benchmark(1000000000u / (opts.fps * client_rate_multiplier)) ? EXIT_SUCCESS : EXIT_FAILURE;
+
 	FileHandle timer_fd{timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)};
 	if (!timer_fd)
 		return EXIT_FAILURE;
@@ -1918,7 +3574,8 @@ static int main_inner(int argc, char **argv)
 		return EXIT_FAILURE;
 
 	if (!dispatcher.add_connection(
-			std::move(timer_fd), new HeartbeatHandler(dispatcher, server, opts.fps * client_rate_multiplier), 0,
+			std::move(timer_fd), new HeartbeatHandler(dispatcher, server, opts.fps * client_rate_multiplier,
+			                     opts.phase_controller), 0,
 			Dispatcher::ConnectionType::Input))
 	{
 		return EXIT_FAILURE;
@@ -0,0 +1,283 @@
+#include "cli_parser.hpp"
+#include "logging.hpp"
+#include "pyro_client.hpp"
+#include "pyro_trace.hpp"
+#include <random>
+#include <thread>
+#include <chrono>
+#include <string.h>
+#include <stdlib.h>
+
+using namespace PyroFling;
+
+static void print_help()
+{
+	LOGI("pyrofling-replay\n"
+	     "\t[--speed SPEED (1.0 is original timing, 0 replays as fast as possible)]\n"
+	     "\t[--cookie COOKIE (stream to replay, defaults to the first stream in the trace)]\n"
+	     "\t[--drop-rate RATE (0.0 to 1.0)]\n"
+	     "\t[--burst-length LENGTH (average length of a drop burst)]\n"
+	     "\t[--reorder-rate RATE (0.0 to 1.0)]\n"
+	     "\t[--duplicate-rate RATE (0.0 to 1.0)]\n"
+	     "\t[--seed SEED]\n"
+	     "\t[--dump-video PATH]\n"
+	     "\t[--debug-log PATH]\n"
+	     "\ttrace\n");
+}
+
+struct Impairment
+{
+	double drop_rate = 0.0;
+	unsigned burst_length = 1;
+	double reorder_rate = 0.0;
+	double duplicate_rate = 0.0;
+};
+
+struct ReplayStats
+{
+	uint64_t datagrams = 0;
+	uint64_t dropped = 0;
+	uint64_t reordered = 0;
+	uint64_t duplicated = 0;
+	uint64_t video_packets = 0;
+	uint64_t audio_packets = 0;
+	uint64_t video_bytes = 0;
+};
+
+struct Replayer
+{
+	PyroStreamClient client;
+	Impairment impairment;
+	std::default_random_engine rng;
+	ReplayStats stats;
+	FILE *dump_video = nullptr;
+
+	std::vector<uint8_t> held_datagram;
+	unsigned burst_remaining = 0;
+
+	bool feed(const std::vector<uint8_t> &datagram)
+	{
+		if (!client.process_datagram(datagram.data(), datagram.size()))
+		{
+			LOGE("Stream broke after %llu datagrams.\n", static_cast<unsigned long long>(stats.datagrams));
+			return false;
+		}
+
+		if (client.has_completed_packet())
+		{
+			bool is_audio = (client.get_payload_header().encoded & PYRO_PAYLOAD_STREAM_TYPE_BIT) != 0;
+			if (is_audio)
+			{
+				stats.audio_packets++;
+			}
+			else
+			{
+				stats.video_packets++;
+				stats.video_bytes += client.get_packet_size();
+				if (dump_video)
+					fwrite(client.get_packet_data(), 1, client.get_packet_size(), dump_video);
+			}
+			client.release_completed_packet();
+		}
+
+		return true;
+	}
+
+	bool push_datagram(const std::vector<uint8_t> &datagram)
+	{
+		stats.datagrams++;
+		std::uniform_real_distribution<double> dist{0.0, 1.0};
+
+		// Losses on real networks tend to come in bursts.
+		if (burst_remaining == 0 && impairment.drop_rate > 0.0 &&
+		    dist(rng) < impairment.drop_rate / double(impairment.burst_length))
+		{
+			burst_remaining = impairment.burst_length;
+		}
+
+		if (burst_remaining)
+		{
+			burst_remaining--;
+			stats.dropped++;
+			return true;
+		}
+
+		if (impairment.duplicate_rate > 0.0 && dist(rng) < impairment.duplicate_rate)
+		{
+			stats.duplicated++;
+			if (!feed(datagram))
+				return false;
+		}
+
+		// Delay the datagram until after the next one.
+		if (held_datagram.empty() && impairment.reorder_rate > 0.0 && dist(rng) < impairment.reorder_rate)
+		{
+			stats.reordered++;
+			held_datagram = datagram;
+			return true;
+		}
+
+		if (!feed(datagram))
+			return false;
+
+		if (!held_datagram.empty())
+		{
+			auto held = std::move(held_datagram);
+			held_datagram.clear();
+			if (!feed(held))
+				return false;
+		}
+
+		return true;
+	}
+
+	bool flush()
+	{
+		if (held_datagram.empty())
+			return true;
+		auto held = std::move(held_datagram);
+		held_datagram.clear();
+		return feed(held);
+	}
+};
+
+int main(int argc, char **argv)
+{
+	Util::CLICallbacks cbs;
+	std::string trace_path;
+	std::string dump_video_path;
+	std::string debug_log_path;
+	double speed = 1.0;
+	uint64_t cookie = 0;
+	unsigned seed = 0;
+	Impairment impairment;
+
+	cbs.add("--help", [&](Util::CLIParser &parser) { parser.end(); });
+	cbs.add("--speed", [&](Util::CLIParser &parser) { speed = parser.next_double(); });
+	cbs.add("--cookie", [&](Util::CLIParser &parser) { cookie = parser.next_uint(); });
+	cbs.add("--drop-rate", [&](Util::CLIParser &parser) { impairment.drop_rate = parser.next_double(); });
+	cbs.add("--burst-length", [&](Util::CLIParser &parser) { impairment.burst_length = parser.next_uint(); });
+	cbs.add("--reorder-rate", [&](Util::CLIParser &parser) { impairment.reorder_rate = parser.next_double(); });
+	cbs.add("--duplicate-rate", [&](Util::CLIParser &parser) { impairment.duplicate_rate = parser.next_double(); });
+	cbs.add("--seed", [&](Util::CLIParser &parser) { seed = parser.next_uint(); });
+	cbs.add("--dump-video", [&](Util::CLIParser &parser) { dump_video_path = parser.next_string(); });
+	cbs.add("--debug-log", [&](Util::CLIParser &parser) { debug_log_path = parser.next_string(); });
+	cbs.default_handler = [&](const char *path) { trace_path = path; };
+	Util::CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+	else if (parser.is_ended_state())
+	{
+		print_help();
+		return EXIT_SUCCESS;
+	}
+	else if (trace_path.empty())
+	{
+		LOGE("Trace path required.\n");
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	if (impairment.burst_length == 0)
+		impairment.burst_length = 1;
+
+	TraceReader reader;
+	if (!reader.open(trace_path.c_str()))
+		return EXIT_FAILURE;
+
+	Replayer replayer;
+	replayer.impairment = impairment;
+	replayer.rng.seed(seed);
+	replayer.client.set_offline_codec_parameters({});
+	if (!debug_log_path.empty())
+		replayer.client.set_debug_log(debug_log_path.c_str());
+
+	struct FileDeleter { void operator()(FILE *fp) { if (fp) fclose(fp); }};
+	std::unique_ptr<FILE, FileDeleter> dump_video;
+	if (!dump_video_path.empty())
+	{
+		dump_video.reset(fopen(dump_video_path.c_str(), "wb"));
+		if (!dump_video)
+		{
+			LOGE("Failed to open \"%s\".\n", dump_video_path.c_str());
+			return EXIT_FAILURE;
+		}
+		replayer.dump_video = dump_video.get();
+	}
+
+	TraceRecord record;
+	uint64_t first_timestamp_ns = UINT64_MAX;
+	auto start_time = std::chrono::steady_clock::now();
+	bool ok = true;
+
+	while (ok && reader.read_record(record))
+	{
+		// Lock onto the first stream unless one is selected explicitly.
+		if (cookie == 0)
+			cookie = record.header.cookie;
+		if (record.header.cookie != cookie)
+			continue;
+
+		if (first_timestamp_ns == UINT64_MAX)
+			first_timestamp_ns = record.header.timestamp_ns;
+
+		if (speed > 0.0)
+		{
+			auto delay_ns = double(record.header.timestamp_ns - first_timestamp_ns) / speed;
+			std::this_thread::sleep_until(start_time + std::chrono::nanoseconds(int64_t(delay_ns)));
+		}
+
+		if (record.header.type == TraceRecordType::TCP)
+		{
+			pyro_message_type type;
+			if (record.data.size() < sizeof(type))
+				continue;
+			memcpy(&type, record.data.data(), sizeof(type));
+
+			pyro_codec_parameters codec = {};
+			if (type == PYRO_MESSAGE_CODEC_PARAMETERS && record.data.size() == sizeof(type) + sizeof(codec))
+			{
+				memcpy(&codec, record.data.data() + sizeof(type), sizeof(codec));
+				replayer.client.set_offline_codec_parameters(codec);
+				LOGI("Codec parameters: video codec %d, %u x %u @ %u / %u fps.\n",
+				     int(codec.video_codec), codec.width, codec.height,
+				     codec.frame_rate_num, codec.frame_rate_den);
+			}
+		}
+		else if (record.header.type == TraceRecordType::UDP)
+		{
+			ok = replayer.push_datagram(record.data);
+		}
+	}
+
+	if (ok)
+		ok = replayer.flush();
+
+	auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	auto &stats = replayer.stats;
+	auto &progress = replayer.client.get_progress_report();
+
+	LOGI("Replayed stream %llu: %llu datagrams in %.3f s (%.0f datagrams / s).\n",
+	     static_cast<unsigned long long>(cookie),
+	     static_cast<unsigned long long>(stats.datagrams), elapsed,
+	     elapsed > 0.0 ? double(stats.datagrams) / elapsed : 0.0);
+	LOGI("  Impairment: %llu dropped, %llu reordered, %llu duplicated.\n",
+	     static_cast<unsigned long long>(stats.dropped),
+	     static_cast<unsigned long long>(stats.reordered),
+	     static_cast<unsigned long long>(stats.duplicated));
+	LOGI("  Completed: %llu video packets (%llu bytes), %llu audio packets.\n",
+	     static_cast<unsigned long long>(stats.video_packets),
+	     static_cast<unsigned long long>(stats.video_bytes),
+	     static_cast<unsigned long long>(stats.audio_packets));
+	LOGI("  Client: %llu dropped video, %llu dropped audio, %llu key frames, %llu FEC recovered.\n",
+	     static_cast<unsigned long long>(progress.total_dropped_video_packets),
+	     static_cast<unsigned long long>(progress.total_dropped_audio_packets),
+	     static_cast<unsigned long long>(progress.total_received_key_frames),
+	     static_cast<unsigned long long>(progress.total_recovered_packets));
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}